@@ -0,0 +1,335 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "dsfdatareader.h"
+#include "audiohash.h"
+
+namespace {
+  //////////////////////////// XXH64 //////////////////////////////
+
+  const uint64_t PRIME64_1 = 0x9e3779b185ebca87ULL;
+  const uint64_t PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+  const uint64_t PRIME64_3 = 0x165667b19e3779f9ULL;
+  const uint64_t PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+  const uint64_t PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+  inline uint64_t rotl64(uint64_t x, int r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  inline uint64_t read64(const unsigned char *p)
+  {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+      v = (v << 8) | p[i];
+    return v;
+  }
+
+  inline uint32_t read32(const unsigned char *p)
+  {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | 
+      (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+  {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+  }
+
+  inline uint64_t xxhMerge(uint64_t acc, uint64_t v)
+  {
+    acc ^= xxhRound(0, v);
+    return acc * PRIME64_1 + PRIME64_4;
+  }
+
+  uint64_t xxh64(const unsigned char *p, size_t len, uint64_t seed = 0)
+  {
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+      uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+      uint64_t v2 = seed + PRIME64_2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - PRIME64_1;
+      for (; p + 32 <= end; p += 32) {
+	v1 = xxhRound(v1, read64(p));
+	v2 = xxhRound(v2, read64(p + 8));
+	v3 = xxhRound(v3, read64(p + 16));
+	v4 = xxhRound(v4, read64(p + 24));
+      }
+      h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+      h = xxhMerge(h, v1);
+      h = xxhMerge(h, v2);
+      h = xxhMerge(h, v3);
+      h = xxhMerge(h, v4);
+    } else {
+      h = seed + PRIME64_5;
+    }
+
+    h += len;
+    for (; p + 8 <= end; p += 8)
+      h = rotl64(h ^ xxhRound(0, read64(p)), 27) * PRIME64_1 + PRIME64_4;
+    if (p + 4 <= end) {
+      h = rotl64(h ^ (read32(p) * PRIME64_1), 23) * PRIME64_2 + PRIME64_3;
+      p += 4;
+    }
+    for (; p < end; p++)
+      h = rotl64(h ^ (*p * PRIME64_5), 11) * PRIME64_1;
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  //////////////////////////// SHA-256 //////////////////////////////
+
+  const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  inline uint32_t rotr32(uint32_t x, int r)
+  {
+    return (x >> r) | (x << (32 - r));
+  }
+
+  void sha256Block(uint32_t *state, const unsigned char *p)
+  {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+      w[i] = (static_cast<uint32_t>(p[4 * i]) << 24) | (p[4 * i + 1] << 16) |
+	(p[4 * i + 2] << 8) | p[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ 
+	(w[i - 15] >> 3);
+      uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ 
+	(w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + 
+	((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+      uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + 
+	((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+
+  std::string sha256(const unsigned char *p, size_t len)
+  {
+    uint32_t state[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    size_t full = len / 64 * 64;
+    for (size_t i = 0; i < full; i += 64)
+      sha256Block(state, p + i);
+
+    // Padding: 0x80, zeros and the length in bits, big endian
+    unsigned char tail[128] = { 0 };
+    size_t rest = len - full;
+    memcpy(tail, p + full, rest);
+    tail[rest] = 0x80;
+    size_t tailSize = rest + 9 <= 64 ? 64 : 128;
+    uint64_t bits = static_cast<uint64_t>(len) * 8;
+    for (int i = 0; i < 8; i++)
+      tail[tailSize - 1 - i] = (bits >> (8 * i)) & 0xff;
+    for (size_t i = 0; i < tailSize; i += 64)
+      sha256Block(state, tail + i);
+
+    std::string digest;
+    for (int i = 0; i < 8; i++)
+      for (int j = 24; j >= 0; j -= 8)
+	digest += static_cast<char>((state[i] >> j) & 0xff);
+    return digest;
+  }
+
+  // Digest of len bytes at p, big endian
+  std::string digestOf(AudioHash::Algorithm a, const unsigned char *p, 
+		       size_t len)
+  {
+    if (a == AudioHash::SHA256)
+      return sha256(p, len);
+
+    uint64_t h = xxh64(p, len);
+    std::string digest;
+    for (int i = 56; i >= 0; i -= 8)
+      digest += static_cast<char>((h >> i) & 0xff);
+    return digest;
+  }
+}
+
+//////////////////////////// IMPL //////////////////////////////
+class AudioHash::AudioHashImpl {
+ public:
+  AudioHashImpl(Algorithm algorithm, unsigned int threads) :
+    _algorithm(algorithm),
+    _threads(threads > 0 ? threads : 1)
+  {}
+  ~AudioHashImpl() {}
+
+  /////////////// Variables //////////////
+  Algorithm _algorithm;
+  unsigned int _threads;
+};
+
+//////////////////////////// PUBLIC //////////////////////////////
+
+AudioHash::AudioHash(Algorithm algorithm, unsigned int threads) :
+  _i(new AudioHashImpl(algorithm, threads))
+{
+}
+
+AudioHash::~AudioHash()
+{
+  delete _i;
+}
+
+bool AudioHash::hash(const char *file, std::string &digest, 
+		     std::ostream &err)
+{
+  uint64_t offset, size;
+  {
+    DSFDataReader reader(file);
+    if (!reader.isValid()) {
+      err << file << ": error reading audio data." << std::endl;
+      return false;
+    }
+    offset = reader.dataOffset();
+    size = reader.dataSize();
+  }
+
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    err << file << ": error reading audio data." << std::endl;
+    return false;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, offset, size, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  // Each thread takes the next piece until there's none left
+  uint64_t pieces = (size + PIECE_SIZE - 1) / PIECE_SIZE;
+  std::vector<std::string> digests(pieces);
+  std::atomic<uint64_t> next(0);
+  std::atomic<bool> failed(false);
+
+  auto work = [&]() {
+    std::vector<unsigned char> buf(PIECE_SIZE);
+    for (uint64_t i = next++; i < pieces && !failed; i = next++) {
+      size_t len = i + 1 < pieces ? PIECE_SIZE : size - i * PIECE_SIZE;
+      size_t n = 0;
+      while (n < len) {
+	ssize_t r = pread(fd, &buf[n], len - n, offset + i * PIECE_SIZE + n);
+	if (r <= 0) {
+	  failed = true;
+	  return;
+	}
+	n += r;
+      }
+      digests[i] = digestOf(_i->_algorithm, &buf[0], len);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < _i->_threads && t < pieces; t++)
+    threads.emplace_back(work);
+  work();
+  for (auto &t : threads)
+    t.join();
+  close(fd);
+
+  if (failed) {
+    err << file << ": error reading audio data." << std::endl;
+    return false;
+  }
+
+  std::string all;
+  for (auto &d : digests)
+    all += d;
+  for (int i = 0; i < 64; i += 8)
+    all += static_cast<char>((size >> i) & 0xff);
+  std::string root = digestOf(_i->_algorithm, 
+			     reinterpret_cast<const unsigned char *>(all.data()),
+			     all.size());
+
+  static const char hex[] = "0123456789abcdef";
+  digest = _i->_algorithm == SHA256 ? "sha256:" : "xxh64:";
+  for (unsigned char c : root) {
+    digest += hex[c >> 4];
+    digest += hex[c & 0xf];
+  }
+  return true;
+}
+
+bool AudioHash::algorithmByName(const std::string &name, Algorithm &a)
+{
+  if (name == "xxh64")
+    a = XXH64;
+  else if (name == "sha256")
+    a = SHA256;
+  else
+    return false;
+  return true;
+}
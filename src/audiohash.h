@@ -0,0 +1,63 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _AUDIOHASH_H_
+#define _AUDIOHASH_H_
+
+#include <ostream>
+#include <string>
+
+//
+// Hashes the audio data of DSF files (--audio-hash), so that edits of
+// the tags don't change the result.
+//
+// The data chunk is cut into pieces of 4 MB, hashed by several threads
+// at once. The digest is the hash of the hashes of the pieces followed
+// by the length of the data, as a little endian 64-bit integer. It's
+// written as the name of the hash, a colon and the digest in hex, e.g.
+// "xxh64:0123456789abcdef".
+//
+class AudioHash {
+ public:
+  enum Algorithm { XXH64, SHA256 };
+
+  AudioHash(Algorithm algorithm, unsigned int threads);
+  ~AudioHash();
+
+  // Hash the audio of file into digest. Errors go to err.
+  bool hash(const char *file, std::string &digest, std::ostream &err);
+
+  // The algorithm called name ("xxh64" or "sha256"). Return false if
+  // there's none.
+  static bool algorithmByName(const std::string &name, Algorithm &a);
+
+  // Size of the pieces hashed on their own
+  static const unsigned int PIECE_SIZE = 4 << 20;
+
+ private:
+  AudioHash(const AudioHash &);
+  AudioHash &operator=(const AudioHash &);
+
+  class AudioHashImpl;
+  AudioHashImpl *_i;
+};
+
+#endif
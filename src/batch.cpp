@@ -0,0 +1,226 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "batch.h"
+
+namespace {
+
+// Set while a worker thread runs a job, or by an ErrScope
+thread_local std::ostream *jobErr = 0;
+
+} // namespace
+
+//////////////////////////// IMPL //////////////////////////////
+class BatchProcessor::BatchProcessorImpl {
+ public:
+  // One queued file. Output is kept here until all files added before
+  // it have been flushed.
+  struct Slot {
+    Slot(const TagLib::String &f) : file(f), done(false), ok(false) {}
+    TagLib::String file;
+    std::ostringstream out;
+    std::ostringstream err;
+    bool done;
+    bool ok;
+  };
+
+  BatchProcessorImpl(unsigned int jobs, const Job &job, std::ostream &out,
+		     std::ostream &err) :
+    _job(job),
+    _jobs(jobs),
+    _out(out),
+    _err(err),
+    _window(jobs * 4),
+    _failed(0),
+    _stop(false)
+  {}
+  ~BatchProcessorImpl() {}
+
+  // Worker thread main loop
+  void work();
+
+  // Print the finished slots at the head of _slots. Must be called
+  // with _lock held.
+  void flush(std::unique_lock<std::mutex> &lock);
+
+  /////////////// Variables //////////////
+  Job _job;
+  unsigned int _jobs;
+  std::ostream &_out;
+  std::ostream &_err;
+  size_t _window;            // max. number of unflushed slots
+  unsigned int _failed;
+  bool _stop;
+
+  std::deque<Slot *> _slots; // all unflushed slots, in input order
+  std::deque<Slot *> _queue; // slots not yet picked up by a worker
+  std::vector<std::thread> _workers;
+  std::mutex _lock;
+  std::condition_variable _queued;   // signalled when _queue grows
+  std::condition_variable _finished; // signalled when a slot is done
+};
+
+void BatchProcessor::BatchProcessorImpl::work()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+
+  while (true) {
+    while (_queue.empty() && !_stop)
+      _queued.wait(lock);
+    if (_queue.empty())
+      return;
+
+    Slot *s = _queue.front();
+    _queue.pop_front();
+
+    lock.unlock();
+    bool ok = false;
+    std::ostream *outerErr = jobErr;
+    jobErr = &s->err;
+    try {
+      ok = _job(s->file, s->out, s->err);
+    } catch (std::exception &e) {
+      s->err << s->file << ": " << e.what() << std::endl;
+    }
+    jobErr = outerErr;
+    lock.lock();
+
+    s->ok = ok;
+    s->done = true;
+    _finished.notify_all();
+  }
+}
+
+void BatchProcessor::BatchProcessorImpl::flush(std::unique_lock<std::mutex> &lock)
+{
+  while (!_slots.empty() && _slots.front()->done) {
+    Slot *s = _slots.front();
+    _slots.pop_front();
+
+    // The slot is ours now, no need to hold the lock while printing
+    lock.unlock();
+    _out << s->out.str();
+    _out.flush();
+    _err << s->err.str();
+    lock.lock();
+
+    if (!s->ok)
+      _failed++;
+    delete s;
+  }
+}
+
+///////////////////////////// BATCHPROCESSOR //////////////////////////
+BatchProcessor::BatchProcessor(unsigned int jobs, const Job &job,
+			       std::ostream &out, std::ostream &err)
+{
+  if (jobs == 0)
+    jobs = defaultJobs();
+  _i = new BatchProcessorImpl(jobs, job, out, err);
+
+  if (jobs > 1) {
+    for (unsigned int n = 0; n < jobs; n++)
+      _i->_workers.push_back(std::thread(&BatchProcessorImpl::work, _i));
+  }
+}
+
+BatchProcessor::~BatchProcessor()
+{
+  finish();
+  delete _i;
+}
+
+void BatchProcessor::add(const TagLib::String &file)
+{
+  if (_i->_workers.empty()) {
+    ErrScope scope(_i->_err);
+    if (!_i->_job(file, _i->_out, _i->_err))
+      _i->_failed++;
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(_i->_lock);
+
+  BatchProcessorImpl::Slot *s = new BatchProcessorImpl::Slot(file);
+  _i->_slots.push_back(s);
+  _i->_queue.push_back(s);
+  _i->_queued.notify_one();
+
+  // Print whatever is ready, and keep the number of buffered results
+  // bounded so that memory stays flat on long file lists
+  _i->flush(lock);
+  while (_i->_slots.size() >= _i->_window) {
+    _i->_finished.wait(lock);
+    _i->flush(lock);
+  }
+}
+
+unsigned int BatchProcessor::finish()
+{
+  if (_i->_workers.empty())
+    return _i->_failed;
+
+  {
+    std::unique_lock<std::mutex> lock(_i->_lock);
+    while (!_i->_slots.empty()) {
+      _i->flush(lock);
+      if (!_i->_slots.empty())
+	_i->_finished.wait(lock);
+    }
+    _i->_stop = true;
+    _i->_queued.notify_all();
+  }
+
+  for (auto &t : _i->_workers)
+    t.join();
+  _i->_workers.clear();
+  return _i->_failed;
+}
+
+unsigned int BatchProcessor::defaultJobs()
+{
+  unsigned int n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+std::ostream &BatchProcessor::err()
+{
+  return jobErr ? *jobErr : std::cerr;
+}
+
+BatchProcessor::ErrScope::ErrScope(std::ostream &err) :
+  _outer(jobErr)
+{
+  jobErr = &err;
+}
+
+BatchProcessor::ErrScope::~ErrScope()
+{
+  jobErr = _outer;
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <functional>
+#include <iostream>
+
+#include <taglib/tstring.h>
+
+//
+// Runs a job for every file of a batch on a pool of worker threads.
+//
+// Whatever a job writes to its output streams is buffered and flushed
+// in the order the files were added, so the output of a parallel run is
+// identical to that of a sequential one. A failed job only affects its
+// own file.
+//
+class BatchProcessor {
+ public:
+  // Process one file. Return false on error.
+  typedef std::function<bool (const TagLib::String &file,
+			      std::ostream &out,
+			      std::ostream &err)> Job;
+
+  // With jobs == 1 every file is processed in the calling thread and
+  // output goes straight to out/err.
+  BatchProcessor(unsigned int jobs, const Job &job, 
+		 std::ostream &out = std::cout, std::ostream &err = std::cerr);
+  ~BatchProcessor();
+
+  // Queue a file. Blocks while too many results are waiting to be flushed.
+  void add(const TagLib::String &file);
+
+  // Wait for all queued files. Return the number of failed jobs.
+  unsigned int finish();
+
+  // Number of worker threads used by --jobs=0
+  static unsigned int defaultJobs();
+
+  // The err stream of the job running on the calling thread, cerr
+  // outside of jobs. For code that isn't handed the stream, like the
+  // diagnostics of DSFFile.
+  static std::ostream &err();
+
+  // Sends err() of the calling thread to a stream other than cerr
+  // outside of jobs, while it exists. For runs of metadsfd.
+  class ErrScope {
+   public:
+    ErrScope(std::ostream &err);
+    ~ErrScope();
+
+   private:
+    ErrScope(const ErrScope &);
+    ErrScope &operator=(const ErrScope &);
+
+    std::ostream *_outer;
+  };
+
+ private:
+  BatchProcessor(const BatchProcessor &);
+  BatchProcessor &operator=(const BatchProcessor &);
+
+  class BatchProcessorImpl;
+  BatchProcessorImpl *_i;
+};
+
+#endif
@@ -0,0 +1,490 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <mutex>
+#include <memory>
+
+#include <taglib/id3v2frame.h>
+#include <taglib/attachedpictureframe.h>
+
+#include "catalog.h"
+#include "dsfprobe.h"
+#include "dsfheader.h"
+#include "batch.h"
+
+//
+// File layout, all integers little endian:
+//
+//   header   magic "MDSFCAT1", u32 count, u32 record size, 
+//            u64 records offset, u64 file length
+//   records  count fixed size records, sorted by path:
+//              u64 path offset, u32 path length, u32 frame count,
+//              u64 inode, u64 size, i64 mtime, u32 mtime ns,
+//              u32 ID3v2 header length, u64 frames offset,
+//              DSD + fmt chunks (80 bytes), ID3v2 header (10 bytes), pad
+//   frames   u8[4] ID, u32 picture type, u64 text offset, u32 text length,
+//            pad
+//   strings  paths and frame texts
+//
+static const char MAGIC[] = "MDSFCAT1";
+static const unsigned int HEADER_SIZE = 32;
+static const unsigned int RECORD_SIZE = 152;
+static const unsigned int FRAME_SIZE = 24;
+static const unsigned int DSF_HEADER_SIZE = 
+  DSFHeader::DSD_HEADER_SIZE + DSFHeader::FMT_HEADER_SIZE;
+static const unsigned int ID3V2_HEADER_SIZE = 10;
+
+static inline uint64_t get64(const unsigned char *p)
+{
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+static inline uint32_t get32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | 
+    (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline void put64(std::string &s, uint64_t v)
+{
+  for (int i = 0; i < 8; i++)
+    s += static_cast<char>((v >> (i * 8)) & 0xff);
+}
+
+static inline void put32(std::string &s, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    s += static_cast<char>((v >> (i * 8)) & 0xff);
+}
+
+// Fixed length field, truncated or zero padded
+static inline void putBytes(std::string &s, const TagLib::ByteVector &v, 
+			    unsigned int length)
+{
+  unsigned int n = std::min(v.size(), length);
+  s.append(v.data(), n);
+  s.append(length - n, '\0');
+}
+
+//////////////////////////// IMPL //////////////////////////////
+class Catalog::CatalogImpl {
+ public:
+  CatalogImpl(const char *file) :
+    _file(file),
+    _map(0),
+    _length(0),
+    _count(0)
+  {}
+  ~CatalogImpl() { unmap(); }
+
+  // Map the catalog file, if there's a valid one
+  void map();
+  void unmap();
+
+  // Index of the record of path, or -1
+  long search(const std::string &path) const;
+
+  // Decode record i. Returns false if it's corrupt.
+  bool decode(unsigned int i, Entry &e) const;
+
+  const unsigned char *record(unsigned int i) const {
+    return _map + HEADER_SIZE + static_cast<uint64_t>(i) * RECORD_SIZE;
+  }
+
+  // Serialize entries, sorted by path
+  static std::string encode(const std::vector<const Entry *> &entries);
+
+  /////////////// Variables //////////////
+  std::string _file;
+  const unsigned char *_map;
+  uint64_t _length;
+  unsigned int _count;
+
+  std::mutex _lock;                   // protects _updates, _removedTrees
+  std::map<std::string, std::unique_ptr<Entry> > _updates; // null: remove
+  std::vector<std::string> _removedTrees; // directories, with trailing /
+
+  // Whether path was in a directory given to removeTree()
+  bool isRemoved(const std::string &path) const {
+    for (auto &t : _removedTrees)
+      if (path.compare(0, t.size(), t) == 0)
+	return true;
+    return false;
+  }
+};
+
+void Catalog::CatalogImpl::map()
+{
+  unmap();
+
+  int fd = open(_file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= HEADER_SIZE) {
+    void *p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED) {
+      _map = static_cast<const unsigned char *>(p);
+      _length = st.st_size;
+    }
+  }
+  close(fd);
+
+  if (!_map)
+    return;
+
+  // Anything that doesn't look right is treated as an empty catalog
+  if (memcmp(_map, MAGIC, 8) != 0 || get32(_map + 12) != RECORD_SIZE ||
+      get64(_map + 16) != HEADER_SIZE || get64(_map + 24) != _length ||
+      HEADER_SIZE + static_cast<uint64_t>(get32(_map + 8)) * RECORD_SIZE > 
+      _length) {
+    BatchProcessor::err() << _file << ": not a valid catalog, ignored"
+      << std::endl;
+    unmap();
+    return;
+  }
+  _count = get32(_map + 8);
+}
+
+void Catalog::CatalogImpl::unmap()
+{
+  if (_map)
+    munmap(const_cast<unsigned char *>(_map), _length);
+  _map = 0;
+  _length = 0;
+  _count = 0;
+}
+
+long Catalog::CatalogImpl::search(const std::string &path) const
+{
+  long lo = 0, hi = static_cast<long>(_count) - 1;
+
+  while (lo <= hi) {
+    long mid = (lo + hi) / 2;
+    const unsigned char *r = record(mid);
+    uint64_t offset = get64(r);
+    uint32_t length = get32(r + 8);
+    if (offset + length > _length)
+      return -1;
+
+    int c = memcmp(_map + offset, path.data(), 
+		   std::min(static_cast<size_t>(length), path.size()));
+    if (c == 0)
+      c = length < path.size() ? -1 : (length > path.size() ? 1 : 0);
+    if (c == 0)
+      return mid;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -1;
+}
+
+bool Catalog::CatalogImpl::decode(unsigned int i, Entry &e) const
+{
+  const unsigned char *r = record(i);
+  uint64_t pathOffset = get64(r);
+  uint32_t pathLength = get32(r + 8);
+  uint32_t frameCount = get32(r + 12);
+  uint64_t framesOffset = get64(r + 48);
+
+  if (pathOffset + pathLength > _length ||
+      framesOffset + static_cast<uint64_t>(frameCount) * FRAME_SIZE > _length)
+    return false;
+
+  e.path.assign(reinterpret_cast<const char *>(_map + pathOffset), 
+		pathLength);
+  e.ino = get64(r + 16);
+  e.size = get64(r + 24);
+  e.mtime = static_cast<int64_t>(get64(r + 32));
+  e.mtimeNsec = get32(r + 40);
+  e.DSFHeader = TagLib::ByteVector(reinterpret_cast<const char *>(r + 56),
+				   DSF_HEADER_SIZE);
+  if (get32(r + 44) > 0)
+    e.ID3v2Header = 
+      TagLib::ByteVector(reinterpret_cast<const char *>(r + 136),
+			 ID3V2_HEADER_SIZE);
+  else
+    e.ID3v2Header.clear();
+
+  e.frames.resize(frameCount);
+  for (uint32_t n = 0; n < frameCount; n++) {
+    const unsigned char *f = _map + framesOffset + n * FRAME_SIZE;
+    uint64_t textOffset = get64(f + 8);
+    uint32_t textLength = get32(f + 16);
+    if (textOffset + textLength > _length)
+      return false;
+
+    e.frames[n].id = TagLib::ByteVector(reinterpret_cast<const char *>(f), 4);
+    e.frames[n].pictureType = get32(f + 4);
+    e.frames[n].text.assign(reinterpret_cast<const char *>(_map + textOffset),
+			    textLength);
+  }
+  return true;
+}
+
+std::string Catalog::CatalogImpl::encode(const std::vector<const Entry *> &entries)
+{
+  uint64_t frameCount = 0;
+  for (auto e : entries)
+    frameCount += e->frames.size();
+
+  uint64_t recordsOffset = HEADER_SIZE;
+  uint64_t framesOffset = recordsOffset + entries.size() * RECORD_SIZE;
+  uint64_t stringsOffset = framesOffset + frameCount * FRAME_SIZE;
+
+  std::string records, frames, strings;
+  for (auto e : entries) {
+    put64(records, stringsOffset + strings.size());
+    put32(records, e->path.size());
+    put32(records, e->frames.size());
+    strings += e->path;
+
+    put64(records, e->ino);
+    put64(records, e->size);
+    put64(records, e->mtime);
+    put32(records, e->mtimeNsec);
+    put32(records, e->ID3v2Header.isEmpty() ? 0 : ID3V2_HEADER_SIZE);
+    put64(records, framesOffset + frames.size());
+    putBytes(records, e->DSFHeader, DSF_HEADER_SIZE);
+    putBytes(records, e->ID3v2Header, ID3V2_HEADER_SIZE);
+    records.append(RECORD_SIZE - 146, '\0');
+
+    for (auto &f : e->frames) {
+      putBytes(frames, f.id, 4);
+      put32(frames, f.pictureType);
+      put64(frames, stringsOffset + strings.size());
+      put32(frames, f.text.size());
+      put32(frames, 0);
+      strings += f.text;
+    }
+  }
+
+  std::string s(MAGIC, 8);
+  put32(s, entries.size());
+  put32(s, RECORD_SIZE);
+  put64(s, recordsOffset);
+  put64(s, stringsOffset + strings.size());
+  return s + records + frames + strings;
+}
+
+///////////////////////////// CATALOG //////////////////////////
+Catalog::Catalog(const char *file)
+{
+  _i = new CatalogImpl(file);
+  _i->map();
+}
+
+Catalog::~Catalog()
+{
+  delete _i;
+}
+
+unsigned int Catalog::size() const
+{
+  return _i->_count;
+}
+
+bool Catalog::find(const std::string &path, const struct stat &st, 
+		   Entry &e) const
+{
+  long i = _i->search(path);
+  if (i < 0 || !_i->decode(i, e))
+    return false;
+
+#ifdef __linux__
+  uint32_t nsec = st.st_mtim.tv_nsec;
+#else
+  uint32_t nsec = 0;
+#endif
+  return e.ino == static_cast<uint64_t>(st.st_ino) && 
+    e.size == static_cast<uint64_t>(st.st_size) &&
+    e.mtime == static_cast<int64_t>(st.st_mtime) && e.mtimeNsec == nsec;
+}
+
+void Catalog::update(const Entry &e)
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  _i->_updates[e.path].reset(new Entry(e));
+}
+
+bool Catalog::remove(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  auto u = _i->_updates.find(path);
+  bool found = u != _i->_updates.end() ? u->second != 0 : 
+    _i->search(path) >= 0 && !_i->isRemoved(path);
+
+  // Nothing to save otherwise
+  if (found)
+    _i->_updates[path].reset();
+  return found;
+}
+
+void Catalog::removeTree(const std::string &dir)
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  std::string prefix = dir;
+  if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+    prefix += '/';
+
+  // Updates made before this are gone too
+  auto it = _i->_updates.lower_bound(prefix);
+  while (it != _i->_updates.end() && 
+	 it->first.compare(0, prefix.size(), prefix) == 0)
+    it = _i->_updates.erase(it);
+  _i->_removedTrees.push_back(prefix);
+}
+
+void Catalog::listTree(const std::string &dir, 
+		       std::vector<std::string> &paths) const
+{
+  std::string prefix = dir;
+  if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+    prefix += '/';
+
+  for (unsigned int n = 0; n < _i->_count; n++) {
+    const unsigned char *r = _i->record(n);
+    uint64_t offset = get64(r);
+    uint32_t length = get32(r + 8);
+    if (offset + length <= _i->_length && length > prefix.size() &&
+	memcmp(_i->_map + offset, prefix.data(), prefix.size()) == 0)
+      paths.push_back(std::string(reinterpret_cast<const char *>
+				  (_i->_map + offset), length));
+  }
+}
+
+bool Catalog::save()
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  if (_i->_updates.empty() && _i->_removedTrees.empty())
+    return true;
+
+  std::string lockFile = _i->_file + ".lock";
+  int lockFd = open(lockFile.c_str(), O_RDWR | O_CREAT, 0644);
+  if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0) {
+    BatchProcessor::err() << lockFile << ": can't lock" << std::endl;
+    if (lockFd >= 0)
+      close(lockFd);
+    return false;
+  }
+
+  // Someone else may have saved in the meantime
+  _i->map();
+
+  // Merge the sorted records with the sorted updates
+  std::vector<Entry> old;
+  std::vector<const Entry *> entries;
+  old.reserve(_i->_count);
+  for (unsigned int n = 0; n < _i->_count; n++) {
+    Entry e;
+    if (_i->decode(n, e))
+      old.push_back(e);
+  }
+
+  auto u = _i->_updates.begin();
+  auto o = old.begin();
+  while (u != _i->_updates.end() || o != old.end()) {
+    if (o == old.end() || (u != _i->_updates.end() && u->first < o->path)) {
+      if (u->second)
+	entries.push_back(u->second.get());
+      u++;
+    } else if (u == _i->_updates.end() || o->path < u->first) {
+      if (!_i->isRemoved(o->path))
+	entries.push_back(&*o);
+      o++;
+    } else { // updated
+      if (u->second)
+	entries.push_back(u->second.get());
+      u++;
+      o++;
+    }
+  }
+
+  std::string data = CatalogImpl::encode(entries);
+
+  // Readers keep seeing the old catalog until the rename
+  std::ostringstream tmp;
+  tmp << _i->_file << ".tmp." << getpid();
+  bool ok = false;
+  int fd = open(tmp.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    ok = write(fd, data.data(), data.size()) == 
+      static_cast<ssize_t>(data.size()) && fdatasync(fd) == 0;
+    close(fd);
+    ok = ok && rename(tmp.str().c_str(), _i->_file.c_str()) == 0;
+    if (!ok)
+      unlink(tmp.str().c_str());
+  }
+  if (!ok)
+    BatchProcessor::err() << _i->_file << ": error writing catalog"
+      << std::endl;
+
+  _i->_updates.clear();
+  _i->_removedTrees.clear();
+  _i->map();
+  flock(lockFd, LOCK_UN);
+  close(lockFd);
+  return ok;
+}
+
+void Catalog::makeEntry(const std::string &path, const struct stat &st,
+			DSFProbe &probe, Entry &e)
+{
+  e.path = path;
+  e.ino = st.st_ino;
+  e.size = st.st_size;
+  e.mtime = st.st_mtime;
+#ifdef __linux__
+  e.mtimeNsec = st.st_mtim.tv_nsec;
+#else
+  e.mtimeNsec = 0;
+#endif
+  e.DSFHeader = probe.DSFHeaderData();
+  e.ID3v2Header = probe.ID3v2HeaderData();
+
+  TagLib::ID3v2::FrameList l = probe.frameList();
+  e.frames.clear();
+  e.frames.reserve(l.size());
+  for (auto it = l.begin(); it != l.end(); it++) {
+    Frame f;
+    TagLib::ID3v2::AttachedPictureFrame *apic = 
+      dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
+    f.id = (*it)->frameID();
+    f.pictureType = apic ? apic->type() : NO_PICTURE;
+    f.text = (*it)->toString().to8Bit(true);
+    e.frames.push_back(f);
+  }
+}
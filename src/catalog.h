@@ -0,0 +1,110 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _CATALOG_H_
+#define _CATALOG_H_
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <taglib/tbytevector.h>
+
+class DSFProbe;
+
+//
+// A persistent index of the headers and tags of DSF files, so read-only
+// runs don't have to open files that haven't changed since last time.
+//
+// Entries are keyed by absolute path and only valid as long as inode,
+// size and mtime of the file still match. For each file the DSD and fmt
+// chunks and the ID3v2 header are kept as they are on disk, plus the ID
+// and text (as printed by --show-tags) of every frame.
+//
+// The catalog file is mapped read-only and searched in place. Updates
+// are collected in memory and written by save() to a new file that
+// replaces the old one with rename(), so readers always see a complete
+// catalog. Writers are serialized with flock() on <file>.lock, and merge
+// their updates into whatever catalog is current when they get the lock.
+//
+// find() and update() can be called from several threads.
+//
+class Catalog {
+ public:
+  struct Frame {
+    TagLib::ByteVector id;
+    unsigned int pictureType; // APIC only, NO_PICTURE otherwise
+    std::string text;         // UTF-8
+  };
+
+  struct Entry {
+    std::string path;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mtimeNsec;
+    TagLib::ByteVector DSFHeader;   // DSD + fmt chunks
+    TagLib::ByteVector ID3v2Header; // empty if there's no tag
+    std::vector<Frame> frames;
+  };
+
+  static const unsigned int NO_PICTURE = 0xffffffff;
+
+  // Opens file if it exists. A missing or unreadable catalog is empty.
+  Catalog(const char *file);
+  ~Catalog();
+
+  // Number of entries in the catalog file
+  unsigned int size() const;
+
+  // Returns true and fills e if path has an entry that matches st
+  bool find(const std::string &path, const struct stat &st, Entry &e) const;
+
+  // Add or replace the entry of e.path
+  void update(const Entry &e);
+
+  // Drop the entry of path. Returns false if there was none.
+  bool remove(const std::string &path);
+
+  // Drop the entries of all files below dir
+  void removeTree(const std::string &dir);
+
+  // Append the paths of the files below dir in the catalog file
+  void listTree(const std::string &dir, std::vector<std::string> &paths) const;
+
+  // Write all updates. Returns false on error.
+  bool save();
+
+  // Build an entry from a probe that read the whole tag
+  static void makeEntry(const std::string &path, const struct stat &st,
+			DSFProbe &probe, Entry &e);
+
+ private:
+  Catalog(const Catalog &);
+  Catalog &operator=(const Catalog &);
+
+  class CatalogImpl;
+  CatalogImpl *_i;
+};
+
+#endif
@@ -0,0 +1,338 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "catalogwatcher.h"
+#include "catalog.h"
+#include "dirwalker.h"
+#include "dsfprobe.h"
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+} // namespace
+
+//////////////////////////// IMPL //////////////////////////////
+class CatalogWatcher::CatalogWatcherImpl {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  CatalogWatcherImpl(Catalog &catalog, unsigned int settleMillis) :
+    _catalog(catalog),
+    _settle(settleMillis),
+    _fd(-1)
+  {}
+  ~CatalogWatcherImpl() {
+    if (_fd >= 0)
+      close(_fd);
+  }
+
+  // Watch dir and its subdirectories, and bring the files in them up
+  // to date. Returns false if a directory couldn't be watched.
+  bool watchTree(const std::string &dir, std::ostream &out);
+
+  // Read pending inotify events
+  void readEvents(std::ostream &out);
+
+  // Bring everything below the roots up to date after events were lost
+  void rescan(std::ostream &out);
+
+  // Re-read file, or drop it from the catalog if it's gone or not a
+  // DSF file. Returns true if the catalog changed.
+  bool refresh(const std::string &file, std::ostream &out);
+
+  /////////////// Variables //////////////
+  Catalog &_catalog;
+  std::chrono::milliseconds _settle;
+  int _fd;
+  std::vector<std::string> _roots;         // given to add()
+  std::map<int, std::string> _dirs;        // watch descriptor => directory
+  std::map<std::string, Clock::time_point> _pending; // file => last event
+};
+
+bool CatalogWatcher::CatalogWatcherImpl::watchTree(const std::string &dir,
+						   std::ostream &out)
+{
+#ifdef __linux__
+  const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | 
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+
+  // The walker only reports files, find the directories as we go
+  bool ok = true;
+  std::vector<std::string> stack(1, dir);
+  while (!stack.empty()) {
+    std::string d = stack.back();
+    stack.pop_back();
+
+    int wd = inotify_add_watch(_fd, d.c_str(), mask);
+    if (wd < 0) {
+      std::cerr << d << ": can't watch: " << strerror(errno) << std::endl;
+      if (errno == ENOSPC)
+	std::cerr << "(see /proc/sys/fs/inotify/max_user_watches)" << std::endl;
+      ok = false;
+      continue;
+    }
+    _dirs[wd] = d;
+
+    DIR *dp = opendir(d.c_str());
+    if (!dp)
+      continue;
+    struct dirent *e;
+    while ((e = readdir(dp)) != 0) {
+      if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+	continue;
+      std::string path = d + "/" + e->d_name;
+      struct stat st;
+      if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+	stack.push_back(path);
+    }
+    closedir(dp);
+  }
+
+  // Files that were there before the watches, or changed while the
+  // catalog wasn't watched
+  bool changed = false;
+  DirWalker walker(DirWalker::DEFAULT_THREADS, 
+    [&](const TagLib::String &file) {
+      changed = refresh(file.toCString(), out) || changed;
+    });
+  walker.add(dir.c_str());
+  walker.finish();
+  if (changed)
+    _catalog.save();
+  return ok;
+#else
+  return false;
+#endif
+}
+
+bool CatalogWatcher::CatalogWatcherImpl::refresh(const std::string &file,
+						 std::ostream &out)
+{
+  Catalog::Entry e;
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    return _catalog.remove(file);
+  if (_catalog.find(file, st, e))
+    return false;
+
+  DSFProbe probe(file.c_str(), true);
+  if (!probe.isValid())
+    return _catalog.remove(file);
+  Catalog::makeEntry(file, st, probe, e);
+  _catalog.update(e);
+  out << file << ": updated" << std::endl;
+  return true;
+}
+
+void CatalogWatcher::CatalogWatcherImpl::readEvents(std::ostream &out)
+{
+#ifdef __linux__
+  char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  ssize_t n = read(_fd, buf, sizeof(buf));
+  if (n <= 0)
+    return;
+
+  Clock::time_point now = Clock::now();
+  bool overflow = false;
+  for (char *p = buf; p < buf + n; ) {
+    struct inotify_event *ev = reinterpret_cast<struct inotify_event *>(p);
+    p += sizeof(struct inotify_event) + ev->len;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+      overflow = true;
+      continue;
+    }
+
+    auto d = _dirs.find(ev->wd);
+    if (d == _dirs.end())
+      continue;
+
+    if (ev->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+      _dirs.erase(d);
+      continue;
+    }
+    if (ev->len == 0)
+      continue;
+
+    std::string path = d->second + "/" + ev->name;
+    if (ev->mask & IN_ISDIR) {
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+	watchTree(path, out);
+      } else if (ev->mask & IN_MOVED_FROM) {
+	// Its watches stay but would report the old path
+	for (auto it = _dirs.begin(); it != _dirs.end(); ) {
+	  if (it->second == path || 
+	      it->second.compare(0, path.size() + 1, path + "/") == 0) {
+	    inotify_rm_watch(_fd, it->first);
+	    it = _dirs.erase(it);
+	  } else {
+	    it++;
+	  }
+	}
+	_catalog.removeTree(path);
+	_catalog.save();
+	out << path << ": removed" << std::endl;
+      }
+      continue;
+    }
+
+    // IN_CREATE alone is followed by IN_CLOSE_WRITE, unless it's a link
+    _pending[path] = now;
+  }
+
+  if (overflow)
+    rescan(out);
+#endif
+}
+
+void CatalogWatcher::CatalogWatcherImpl::rescan(std::ostream &out)
+{
+  std::cerr << "inotify: events lost, rescanning" << std::endl;
+
+  // Files deleted meanwhile are only found through the catalog. The
+  // walk then finds new and changed files, and directories created
+  // meanwhile get their watches. The catalog is saved in between so
+  // the walk doesn't read the same files again.
+  for (auto &root : _roots) {
+    std::vector<std::string> files;
+    bool changed = false;
+    _catalog.listTree(root, files);
+    for (auto &file : files)
+      changed = refresh(file, out) || changed;
+    if (changed)
+      _catalog.save();
+    watchTree(root, out);
+  }
+}
+
+///////////////////////////// CATALOGWATCHER //////////////////////////
+CatalogWatcher::CatalogWatcher(Catalog &catalog, unsigned int settleMillis)
+{
+  _i = new CatalogWatcherImpl(catalog, settleMillis);
+#ifdef __linux__
+  _i->_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (_i->_fd < 0)
+    std::cerr << "inotify: " << strerror(errno) << std::endl;
+#endif
+}
+
+CatalogWatcher::~CatalogWatcher()
+{
+  delete _i;
+}
+
+bool CatalogWatcher::add(const std::string &dir, std::ostream &out)
+{
+  if (_i->_fd < 0)
+    return false;
+
+  // Paths are built as dir + "/" + name
+  std::string d = dir;
+  while (d.size() > 1 && d[d.size() - 1] == '/')
+    d.erase(d.size() - 1);
+  _i->_roots.push_back(d);
+  return _i->watchTree(d, out);
+}
+
+void CatalogWatcher::run(std::ostream &out)
+{
+  if (_i->_fd < 0)
+    return;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = requestStop;
+  sigaction(SIGINT, &sa, 0);
+  sigaction(SIGTERM, &sa, 0);
+
+  while (!stopRequested) {
+    // Sleep until the next file settles, or for good if none is pending
+    int timeout = -1;
+    CatalogWatcherImpl::Clock::time_point now = 
+      CatalogWatcherImpl::Clock::now();
+    for (auto &p : _i->_pending) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+	(p.second + _i->_settle - now).count();
+      if (left < 0)
+	left = 0;
+      if (timeout < 0 || left < timeout)
+	timeout = left;
+    }
+
+    struct pollfd pfd = { _i->_fd, POLLIN, 0 };
+    int r = poll(&pfd, 1, timeout);
+    if (r > 0)
+      _i->readEvents(out);
+
+    // Files without events for a while
+    now = CatalogWatcherImpl::Clock::now();
+    bool changed = false;
+    for (auto it = _i->_pending.begin(); it != _i->_pending.end(); ) {
+      if (it->second + _i->_settle <= now) {
+	changed = _i->refresh(it->first, out) || changed;
+	it = _i->_pending.erase(it);
+      } else {
+	it++;
+      }
+    }
+    if (changed)
+      _i->_catalog.save();
+  }
+
+  // Don't lose what was about to settle
+  bool changed = false;
+  for (auto &p : _i->_pending)
+    changed = _i->refresh(p.first, out) || changed;
+  if (changed)
+    _i->_catalog.save();
+}
+
+bool CatalogWatcher::isSupported()
+{
+#ifdef __linux__
+  return true;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _CATALOGWATCHER_H_
+#define _CATALOGWATCHER_H_
+
+#include <ostream>
+#include <string>
+
+class Catalog;
+
+//
+// Keeps a catalog up to date with directory trees (--watch).
+//
+// Every directory below the roots is watched with inotify. A file that
+// is written, created, moved in or out, or deleted is looked at again
+// once it has had no events for a while, so a file being copied is read
+// once, after the copy. Settled files are added, updated or removed and
+// the catalog saved. Nothing runs in between events.
+// If the kernel's event queue overflows, the roots are scanned again.
+//
+// Only supported on Linux.
+//
+class CatalogWatcher {
+ public:
+  CatalogWatcher(Catalog &catalog, unsigned int settleMillis = 2000);
+  ~CatalogWatcher();
+
+  // Watch dir and everything below it. The files in it are brought
+  // up to date right away. Returns false on error.
+  bool add(const std::string &dir, std::ostream &out);
+
+  // Process events until SIGINT or SIGTERM. Files added or updated are
+  // reported to out.
+  void run(std::ostream &out);
+
+  // Whether inotify is available
+  static bool isSupported();
+
+ private:
+  CatalogWatcher(const CatalogWatcher &);
+  CatalogWatcher &operator=(const CatalogWatcher &);
+
+  class CatalogWatcherImpl;
+  CatalogWatcherImpl *_i;
+};
+
+#endif
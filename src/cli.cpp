@@ -0,0 +1,45 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <stdlib.h>
+
+#include "cli.h"
+#include "daemon.h"
+#include "options.h"
+
+int main(int argc, char *argv[])
+{
+  // Hand the command line to metadsfd if there's one. Standard input
+  // isn't forwarded, so --files-from=- always runs here, however it's
+  // spelled.
+  const char *socket = getenv("METADSF_SOCKET");
+  if (socket && *socket) {
+    OptionObj opt;
+    if (!opt.parse(argc - 1, argv + 1))
+      return 1;
+
+    int status;
+    if (opt.filesFrom != "-" && DaemonClient::run(socket, argc, argv, status))
+      return status;
+  }
+
+  return run(argc, argv);
+}
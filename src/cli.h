@@ -0,0 +1,47 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _CLI_H_
+#define _CLI_H_
+
+#include <ostream>
+#include <string>
+#include <taglib/tstring.h>
+
+// What metadsfd keeps from one request to the next, and where a
+// request comes from
+struct RunContext {
+  RunContext() : jobs(1), out(0), err(0) {}
+
+  unsigned int jobs;      // when --jobs isn't given
+  TagLib::String catalog; // for read-only runs without --catalog
+  std::string cwd;        // relative paths start here, if not empty
+  std::ostream *out;      // instead of cout, if not null
+  std::ostream *err;      // instead of cerr, if not null
+};
+
+// One metadsf command line, from option parsing to exit status. Output
+// goes to cout and cerr unless context has streams of its own. The
+// process's working directory is never changed: with a context cwd,
+// relative file names are made absolute from it, and so are printed.
+int run(int argc, char *argv[], const RunContext *context = 0);
+
+#endif
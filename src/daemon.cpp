@@ -0,0 +1,459 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "daemon.h"
+#include "cli.h"
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+bool writeAll(int fd, const char *data, size_t length)
+{
+  while (length > 0) {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool readAll(int fd, char *data, size_t length)
+{
+  while (length > 0) {
+    ssize_t n = recv(fd, data, length, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool socketAddress(const char *path, struct sockaddr_un &addr)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+int connectTo(const char *path)
+{
+  struct sockaddr_un addr;
+  if (!socketAddress(path, addr))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), 
+	      sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Sends whatever is written to it as frames of one type. Once the
+// client is gone, output is dropped so that the run can finish.
+//
+// Worker threads of the run write to its streams too, so there is no
+// put area for them to share: every write ends up in xsputn(), which
+// appends to the buffer under a lock.
+class FrameBuf : public std::streambuf {
+ public:
+  FrameBuf(int fd, char type) : _fd(fd), _type(type), _ok(true) {}
+
+ protected:
+  virtual int overflow(int c) {
+    if (c != traits_type::eof()) {
+      char ch = c;
+      xsputn(&ch, 1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  virtual std::streamsize xsputn(const char *s, std::streamsize n) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _buf.append(s, n);
+    if (_buf.size() >= FRAME_SIZE)
+      flush();
+    return n;
+  }
+
+  virtual int sync() {
+    std::lock_guard<std::mutex> lock(_lock);
+    flush();
+    return 0;
+  }
+
+ private:
+  static const size_t FRAME_SIZE = 65536;
+
+  // With _lock held
+  void flush() {
+    for (size_t pos = 0; pos < _buf.size() && _ok; pos += FRAME_SIZE) {
+      uint32_t n = _buf.size() - pos > FRAME_SIZE ? FRAME_SIZE : 
+	_buf.size() - pos;
+      _ok = DaemonProtocol::writeFrame(_fd, _type, _buf.data() + pos, n);
+    }
+    _buf.clear();
+  }
+
+  int _fd;
+  char _type;
+  bool _ok;
+  std::mutex _lock;
+  std::string _buf;
+};
+
+} // namespace
+
+///////////////////////////// DAEMONPROTOCOL //////////////////////////
+bool DaemonProtocol::writeFrame(int fd, char type, const char *data, 
+				uint32_t length)
+{
+  char header[5];
+  for (int i = 0; i < 4; i++)
+    header[i] = (length >> (i * 8)) & 0xff;
+  header[4] = type;
+  return writeAll(fd, header, sizeof(header)) && writeAll(fd, data, length);
+}
+
+bool DaemonProtocol::readFrame(int fd, char &type, std::string &payload)
+{
+  unsigned char header[5];
+  if (!readAll(fd, reinterpret_cast<char *>(header), sizeof(header)))
+    return false;
+
+  uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16) |
+    (static_cast<uint32_t>(header[3]) << 24);
+  if (length > MAX_FRAME)
+    return false;
+
+  type = header[4];
+  payload.resize(length);
+  return length == 0 || readAll(fd, &payload[0], length);
+}
+
+std::string DaemonProtocol::defaultSocket()
+{
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir && *dir)
+    return std::string(dir) + "/metadsfd.sock";
+  return "/tmp/metadsfd-" + std::to_string(getuid()) + ".sock";
+}
+
+///////////////////////////// DAEMONCLIENT //////////////////////////
+bool DaemonClient::run(const char *socket, int argc, char *argv[], 
+		       int &status)
+{
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd)))
+    return false;
+
+  int fd = connectTo(socket);
+  if (fd < 0)
+    return false;
+
+  std::string request(cwd, strlen(cwd) + 1);
+  for (int i = 1; i < argc; i++)
+    request.append(argv[i], strlen(argv[i]) + 1);
+
+  if (!DaemonProtocol::writeFrame(fd, DaemonProtocol::REQUEST, 
+				  request.data(), request.size())) {
+    close(fd);
+    return false;
+  }
+
+  // From here on the command may have run, don't run it again
+  status = 1;
+  char type;
+  std::string payload;
+  while (DaemonProtocol::readFrame(fd, type, payload)) {
+    if (type == DaemonProtocol::OUT) {
+      std::cout.write(payload.data(), payload.size());
+      std::cout.flush();
+    } else if (type == DaemonProtocol::ERR) {
+      std::cerr.write(payload.data(), payload.size());
+    } else if (type == DaemonProtocol::EXIT && payload.size() == 4) {
+      const unsigned char *p = 
+	reinterpret_cast<const unsigned char *>(payload.data());
+      status = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+      close(fd);
+      return true;
+    }
+  }
+
+  std::cerr << "Lost connection to metadsfd" << std::endl;
+  close(fd);
+  return true;
+}
+
+//////////////////////////// IMPL //////////////////////////////
+class Daemon::DaemonImpl {
+ public:
+  DaemonImpl(const char *socket, const RunContext &context, 
+	     unsigned int clients) :
+    _socket(socket),
+    _context(context),
+    _clients(clients > 0 ? clients : 1),
+    _fd(-1),
+    _stop(false)
+  {}
+  ~DaemonImpl() {
+    if (_fd >= 0) {
+      close(_fd);
+      unlink(_socket.c_str());
+    }
+  }
+
+  // Run the request of one client
+  void handle(int fd);
+
+  // Thread body: handle queued connections until stopped and none is
+  // left
+  void work();
+
+  /////////////// Variables //////////////
+  std::string _socket;
+  RunContext _context;
+  unsigned int _clients;       // requests run at the same time
+  int _fd;
+  std::vector<std::thread> _workers;
+  std::deque<int> _pending;    // accepted, no worker yet
+  bool _stop;
+  std::mutex _lock;
+  std::condition_variable _queued; // a connection is pending, or _stop
+  std::condition_variable _taken;  // a connection left _pending
+};
+
+void Daemon::DaemonImpl::handle(int fd)
+{
+  // Don't let a client that never sends anything hold a worker
+  struct timeval tv = { 10, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  char type;
+  std::string request;
+  if (!DaemonProtocol::readFrame(fd, type, request) || 
+      type != DaemonProtocol::REQUEST || request.empty() ||
+      request[request.size() - 1] != '\0')
+    return;
+
+  // cwd, then the arguments
+  std::vector<std::string> args;
+  for (size_t pos = 0; pos < request.size(); ) {
+    size_t end = request.find('\0', pos);
+    args.push_back(request.substr(pos, end - pos));
+    pos = end + 1;
+  }
+
+  int status = 1;
+  FrameBuf outBuf(fd, DaemonProtocol::OUT);
+  FrameBuf errBuf(fd, DaemonProtocol::ERR);
+  std::ostream out(&outBuf);
+  std::ostream err(&errBuf);
+
+  // Other requests run at the same time, so the process stays where it
+  // is: run() takes relative paths from the client's directory
+  struct stat st;
+  if (stat(args[0].c_str(), &st) != 0) {
+    err << args[0] << ": " << strerror(errno) << std::endl;
+  } else if (!S_ISDIR(st.st_mode) || args[0][0] != '/') {
+    err << args[0] << ": not an absolute directory" << std::endl;
+  } else {
+    std::vector<char *> argv;
+    std::string prog = PROG;
+    argv.push_back(&prog[0]);
+    for (size_t i = 1; i < args.size(); i++)
+      argv.push_back(&args[i][0]);
+    argv.push_back(0);
+
+    RunContext context = _context;
+    context.cwd = args[0];
+    context.out = &out;
+    context.err = &err;
+    try {
+      status = run(argv.size() - 1, &argv[0], &context);
+    } catch (std::exception &e) {
+      err << e.what() << std::endl;
+    }
+  }
+
+  out.flush();
+  err.flush();
+
+  char exit[4];
+  for (int i = 0; i < 4; i++)
+    exit[i] = (status >> (i * 8)) & 0xff;
+  DaemonProtocol::writeFrame(fd, DaemonProtocol::EXIT, exit, sizeof(exit));
+}
+
+void Daemon::DaemonImpl::work()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+  while (true) {
+    _queued.wait(lock, [this] { return _stop || !_pending.empty(); });
+    if (_pending.empty())
+      return;
+    int fd = _pending.front();
+    _pending.pop_front();
+    _taken.notify_one();
+
+    lock.unlock();
+    handle(fd);
+    close(fd);
+    lock.lock();
+  }
+}
+
+///////////////////////////// DAEMON //////////////////////////
+Daemon::Daemon(const char *socket, const RunContext &context, 
+	       unsigned int clients)
+{
+  _i = new DaemonImpl(socket, context, clients);
+}
+
+Daemon::~Daemon()
+{
+  delete _i;
+}
+
+bool Daemon::listen()
+{
+  struct sockaddr_un addr;
+  if (!socketAddress(_i->_socket.c_str(), addr)) {
+    std::cerr << _i->_socket << ": socket path too long" << std::endl;
+    return false;
+  }
+
+  // A socket nobody answers on is left over from a daemon that died
+  int fd = connectTo(_i->_socket.c_str());
+  if (fd >= 0) {
+    close(fd);
+    std::cerr << _i->_socket << ": metadsfd is already running" << std::endl;
+    return false;
+  }
+  unlink(_i->_socket.c_str());
+
+  _i->_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_i->_fd < 0) {
+    std::cerr << "socket: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  mode_t mask = umask(077);
+  int r = bind(_i->_fd, reinterpret_cast<struct sockaddr *>(&addr), 
+	       sizeof(addr));
+  umask(mask);
+  if (r != 0 || ::listen(_i->_fd, 64) != 0) {
+    std::cerr << _i->_socket << ": " << strerror(errno) << std::endl;
+    close(_i->_fd);
+    _i->_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void Daemon::serve()
+{
+  // No SA_RESTART, so that accept() returns on a signal
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = requestStop;
+  sigaction(SIGINT, &sa, 0);
+  sigaction(SIGTERM, &sa, 0);
+  signal(SIGPIPE, SIG_IGN);
+
+  // The signals must interrupt accept() in this thread, so the workers
+  // and the threads of their runs never take them
+  sigset_t stopSignals, mask;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &mask);
+  for (unsigned int n = 0; n < _i->_clients; n++)
+    _i->_workers.push_back(std::thread(&DaemonImpl::work, _i));
+  pthread_sigmask(SIG_SETMASK, &mask, 0);
+
+  while (!stopRequested) {
+    // No more than one waiting connection per worker, the others wait
+    // in the listen backlog
+    {
+      std::unique_lock<std::mutex> lock(_i->_lock);
+      while (!stopRequested && _i->_pending.size() >= _i->_clients)
+	_i->_taken.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    if (stopRequested)
+      break;
+
+    int fd = accept(_i->_fd, 0, 0);
+    if (fd < 0)
+      continue;
+    std::lock_guard<std::mutex> lock(_i->_lock);
+    _i->_pending.push_back(fd);
+    _i->_queued.notify_one();
+  }
+
+  // Connections already accepted are still answered
+  {
+    std::lock_guard<std::mutex> lock(_i->_lock);
+    _i->_stop = true;
+    _i->_queued.notify_all();
+  }
+  for (auto &t : _i->_workers)
+    t.join();
+  _i->_workers.clear();
+}
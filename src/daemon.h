@@ -0,0 +1,103 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <stdint.h>
+#include <string>
+
+struct RunContext;
+
+//
+// metadsfd runs metadsf command lines sent over a Unix domain socket,
+// so that clients don't pay for process start and static tables on
+// every call, and share its catalog.
+//
+// Every message is a frame: a 32-bit little endian payload length, a
+// type byte and the payload. A client sends one REQUEST, holding its
+// working directory and arguments (without the program name), each
+// terminated by a NUL. The daemon answers with any number of OUT and
+// ERR frames, the standard output and error of the run as they are
+// written, and an EXIT frame with the exit status as a 32-bit little
+// endian integer. Then the connection is closed.
+//
+// Up to a given number of requests run at the same time, each on a
+// thread of its own. The daemon never changes directory: relative paths
+// of a request, on its command line and in the files it reads, are
+// taken from the client's working directory.
+//
+class DaemonProtocol {
+ public:
+  enum FrameType {
+    REQUEST = 'R',
+    OUT = 'O',
+    ERR = 'E',
+    EXIT = 'X'
+  };
+
+  // Largest frame accepted
+  static const uint32_t MAX_FRAME = 1 << 24;
+
+  // Return false on error
+  static bool writeFrame(int fd, char type, const char *data, 
+			 uint32_t length);
+  static bool readFrame(int fd, char &type, std::string &payload);
+
+  // Where metadsfd listens by default
+  static std::string defaultSocket();
+};
+
+class DaemonClient {
+ public:
+  // Run a command line in the daemon listening on socket, copying its
+  // output to cout/cerr. Returns false if the daemon can't be reached,
+  // in which case nothing has been run.
+  static bool run(const char *socket, int argc, char *argv[], int &status);
+};
+
+class Daemon {
+ public:
+  static const unsigned int DEFAULT_CLIENTS = 4;
+
+  // context is copied into every request. clients requests are run at
+  // the same time, more connections wait.
+  Daemon(const char *socket, const RunContext &context, 
+	 unsigned int clients = DEFAULT_CLIENTS);
+  ~Daemon();
+
+  // Create the socket, accessible by the current user only. Prints an
+  // error and returns false if that fails or another daemon is using it.
+  bool listen();
+
+  // Serve requests until SIGINT or SIGTERM, then answer those already
+  // accepted
+  void serve();
+
+ private:
+  Daemon(const Daemon &);
+  Daemon &operator=(const Daemon &);
+
+  class DaemonImpl;
+  DaemonImpl *_i;
+};
+
+#endif
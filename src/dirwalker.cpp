@@ -0,0 +1,275 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "dirwalker.h"
+
+#ifdef __linux__
+// What getdents64() returns, glibc doesn't declare it
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+//////////////////////////// IMPL //////////////////////////////
+class DirWalker::DirWalkerImpl {
+ public:
+  DirWalkerImpl(const Callback &callback, const char *magic, 
+		std::ostream &err) :
+    _callback(callback),
+    _err(err),
+    _busy(0),
+    _errors(0),
+    _stop(false)
+  {
+    memcpy(_magic, magic, sizeof(_magic));
+  }
+  ~DirWalkerImpl() {}
+
+  // Worker thread main loop
+  void work();
+
+  // Read one directory. Subdirectories are queued, DSF files passed to
+  // the callback.
+  void walk(const std::string &dir);
+
+  // Whether name (in the directory dirfd) starts with _magic
+  bool hasMagic(int dirfd, const char *name) const;
+
+  // Handle one directory entry of type type (DT_*)
+  void entry(int dirfd, const std::string &dir, const char *name, 
+	     unsigned char type, std::vector<std::string> &files,
+	     std::vector<std::string> &dirs);
+
+  /////////////// Variables //////////////
+  Callback _callback;
+  std::ostream &_err;        // guarded by _callbackLock
+  char _magic[4];            // of the files to pass on
+  std::mutex _callbackLock;  // one callback at a time
+
+  std::deque<std::string> _queue; // directories to read
+  unsigned int _busy;             // directories being read
+  unsigned int _errors;
+  bool _stop;
+  std::vector<std::thread> _workers;
+  std::mutex _lock;
+  std::condition_variable _queued; // signalled when _queue grows or _stop
+  std::condition_variable _idle;   // signalled when a directory is done
+};
+
+void DirWalker::DirWalkerImpl::work()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+
+  while (true) {
+    while (_queue.empty() && !_stop)
+      _queued.wait(lock);
+    if (_queue.empty())
+      return;
+
+    std::string dir = _queue.front();
+    _queue.pop_front();
+    _busy++;
+
+    lock.unlock();
+    walk(dir);
+    lock.lock();
+
+    _busy--;
+    _idle.notify_all();
+  }
+}
+
+bool DirWalker::DirWalkerImpl::hasMagic(int dirfd, const char *name) const
+{
+  int fd = openat(dirfd, name, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  char magic[4];
+  bool ok = pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+    memcmp(magic, _magic, sizeof(magic)) == 0;
+  close(fd);
+  return ok;
+}
+
+void DirWalker::DirWalkerImpl::entry(int dirfd, const std::string &dir,
+				     const char *name, unsigned char type,
+				     std::vector<std::string> &files,
+				     std::vector<std::string> &dirs)
+{
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    return;
+
+  // Find out what it is if readdir didn't tell
+  if (type == DT_UNKNOWN || type == DT_LNK) {
+    struct stat st;
+    int flags = type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0;
+    if (fstatat(dirfd, name, &st, flags) != 0)
+      return;
+    if (S_ISREG(st.st_mode))
+      type = DT_REG;
+    else if (S_ISDIR(st.st_mode) && type == DT_UNKNOWN)
+      type = DT_DIR;
+    else
+      return;
+  }
+
+  std::string path = dir;
+  if (path.empty() || path[path.size() - 1] != '/')
+    path += '/';
+  path += name;
+
+  if (type == DT_DIR)
+    dirs.push_back(path);
+  else if (type == DT_REG && hasMagic(dirfd, name))
+    files.push_back(path);
+}
+
+void DirWalker::DirWalkerImpl::walk(const std::string &dir)
+{
+  std::vector<std::string> files;
+  std::vector<std::string> dirs;
+
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    std::lock_guard<std::mutex> lock(_callbackLock);
+    _err << dir << ": " << strerror(errno) << std::endl;
+    _errors++;
+    return;
+  }
+
+#ifdef __linux__
+  char buf[65536];
+  long n;
+  while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+    for (long pos = 0; pos < n; ) {
+      linux_dirent64 *d = reinterpret_cast<linux_dirent64 *>(buf + pos);
+      entry(fd, dir, d->d_name, d->d_type, files, dirs);
+      pos += d->d_reclen;
+    }
+  }
+  // What was read before the error is still walked
+  if (n < 0) {
+    std::lock_guard<std::mutex> lock(_callbackLock);
+    _err << dir << ": " << strerror(errno) << std::endl;
+    _errors++;
+  }
+  close(fd);
+#else
+  DIR *d = fdopendir(fd);
+  if (!d) {
+    std::lock_guard<std::mutex> lock(_callbackLock);
+    _err << dir << ": " << strerror(errno) << std::endl;
+    _errors++;
+    close(fd);
+    return;
+  }
+  struct dirent *e;
+  while ((e = readdir(d)) != 0)
+    entry(fd, dir, e->d_name, e->d_type, files, dirs);
+  closedir(d);
+#endif
+
+  if (!dirs.empty()) {
+    std::sort(dirs.begin(), dirs.end());
+    std::lock_guard<std::mutex> lock(_lock);
+    _queue.insert(_queue.end(), dirs.begin(), dirs.end());
+    _queued.notify_all();
+  }
+
+  std::sort(files.begin(), files.end());
+  std::lock_guard<std::mutex> lock(_callbackLock);
+  for (auto &f : files)
+    _callback(TagLib::String(f));
+}
+
+///////////////////////////// DIRWALKER //////////////////////////
+DirWalker::DirWalker(unsigned int threads, const Callback &callback,
+		     const char *magic, std::ostream &err)
+{
+  _i = new DirWalkerImpl(callback, magic, err);
+  if (threads == 0)
+    threads = 1;
+  for (unsigned int n = 0; n < threads; n++)
+    _i->_workers.push_back(std::thread(&DirWalkerImpl::work, _i));
+}
+
+DirWalker::~DirWalker()
+{
+  finish();
+  delete _i;
+}
+
+void DirWalker::add(const TagLib::String &path)
+{
+  struct stat st;
+  if (stat(path.toCString(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    std::lock_guard<std::mutex> lock(_i->_lock);
+    _i->_queue.push_back(path.toCString());
+    _i->_queued.notify_one();
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_i->_callbackLock);
+  _i->_callback(path);
+}
+
+unsigned int DirWalker::finish()
+{
+  if (_i->_workers.empty())
+    return _i->_errors;
+
+  {
+    std::unique_lock<std::mutex> lock(_i->_lock);
+    while (!_i->_queue.empty() || _i->_busy > 0)
+      _i->_idle.wait(lock);
+    _i->_stop = true;
+    _i->_queued.notify_all();
+  }
+
+  for (auto &t : _i->_workers)
+    t.join();
+  _i->_workers.clear();
+  return _i->_errors;
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _DIRWALKER_H_
+#define _DIRWALKER_H_
+
+#include <functional>
+#include <iostream>
+
+#include <taglib/tstring.h>
+
+//
+// Finds DSF files in directory trees (--recursive).
+//
+// Directories are read by a pool of threads, with getdents64() on
+// Linux. A file is taken to be a DSF file if it starts with "DSD ",
+// whatever its name, or with another magic given to the constructor,
+// e.g. "FRM8" for DSDIFF files. Files are handed out as soon as their directory
+// has been read, sorted by name within each directory; directories are
+// visited in no particular order. Symbolic links to files are followed,
+// links to directories are not. Directories that can't be read are
+// reported on the err stream given to the constructor.
+//
+class DirWalker {
+ public:
+  // Called for every file found, one call at a time
+  typedef std::function<void (const TagLib::String &file)> Callback;
+
+  DirWalker(unsigned int threads, const Callback &callback,
+	    const char *magic = "DSD ", std::ostream &err = std::cerr);
+  ~DirWalker();
+
+  // Walk path if it's a directory, otherwise pass it on as is
+  void add(const TagLib::String &path);
+
+  // Wait for all walks. Return the number of directories that couldn't
+  // be read.
+  unsigned int finish();
+
+  // Threads used by --recursive
+  static const unsigned int DEFAULT_THREADS = 8;
+
+ private:
+  DirWalker(const DirWalker &);
+  DirWalker &operator=(const DirWalker &);
+
+  class DirWalkerImpl;
+  DirWalkerImpl *_i;
+};
+
+#endif
@@ -0,0 +1,305 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ANALYZER_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ANALYZER_NEON
+#endif
+
+#include "dsdanalyzer.h"
+
+namespace
+{
+  const double OVERLOAD = 0.5; // modulation allowed by SACD
+
+  inline uint64_t load64(const unsigned char *p)
+  {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  ////////////////////////////// kernels //////////////////////////////
+
+  uint64_t countScalar(const unsigned char *p, size_t n)
+  {
+    uint64_t ones = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+      ones += __builtin_popcountll(load64(p + i));
+    for (; i < n; i++)
+      ones += __builtin_popcount(p[i]);
+    return ones;
+  }
+
+#ifdef ANALYZER_X86
+  __attribute__((target("popcnt")))
+  uint64_t countPOPCNT(const unsigned char *p, size_t n)
+  {
+    uint64_t a = 0, b = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      a += __builtin_popcountll(load64(p + i));
+      b += __builtin_popcountll(load64(p + i + 8));
+    }
+    for (; i < n; i++)
+      a += __builtin_popcount(p[i]);
+    return a + b;
+  }
+
+  // Nibbles looked up in a table of their ones, summed by psadbw
+  __attribute__((target("avx2")))
+  uint64_t countAVX2(const unsigned char *p, size_t n)
+  {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 
+					   1, 2, 2, 3, 2, 3, 3, 4,
+					   0, 1, 1, 2, 1, 2, 2, 3, 
+					   1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+      __m256i c = _mm256_add_epi8(
+	_mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+	_mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), 
+						    low)));
+      sum = _mm256_add_epi64(sum, _mm256_sad_epu8(c, _mm256_setzero_si256()));
+    }
+    uint64_t ones = _mm256_extract_epi64(sum, 0) + 
+      _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) + 
+      _mm256_extract_epi64(sum, 3);
+    return ones + countScalar(p + i, n - i);
+  }
+#endif
+
+#ifdef ANALYZER_NEON
+  uint64_t countNEON(const unsigned char *p, size_t n)
+  {
+    uint64x2_t sum = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+      sum = vpadalq_u32(sum, 
+			vpaddlq_u16(vpaddlq_u8(vcntq_u8(vld1q_u8(p + i)))));
+    return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1) + 
+      countScalar(p + i, n - i);
+  }
+#endif
+
+  // Whether every byte is 0x69 or 0x96, i.e. all its bits are the same
+  // once xored with 0x69
+  bool isIdle(const unsigned char *p, size_t n)
+  {
+    const uint64_t idle = 0x6969696969696969ULL;
+    const uint64_t inByte = 0x7f7f7f7f7f7f7f7fULL;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t x = load64(p + i) ^ idle;
+      if (((x ^ (x >> 1)) & inByte) != 0)
+	return false;
+    }
+    for (; i < n; i++)
+      if (p[i] != 0x69 && p[i] != 0x96)
+	return false;
+    return true;
+  }
+
+  // The best kernel this CPU can run, picked once
+  struct Kernels {
+    Kernels() : count(countScalar), name("scalar") {
+#ifdef ANALYZER_X86
+      if (__builtin_cpu_supports("avx2")) {
+	count = countAVX2;
+	name = "AVX2";
+      } else if (__builtin_cpu_supports("popcnt")) {
+	count = countPOPCNT;
+	name = "POPCNT";
+      }
+#elif defined(ANALYZER_NEON)
+      count = countNEON;
+      name = "NEON";
+#endif
+    }
+
+    uint64_t (*count)(const unsigned char *, size_t);
+    const char *name;
+  };
+
+  const Kernels &kernels()
+  {
+    static const Kernels k;
+    return k;
+  }
+}
+
+class DSDAnalyzer::AnalyzerPrivate
+{
+public:
+  AnalyzerPrivate(unsigned int sampleRate, unsigned int window) :
+    sampleRate(sampleRate),
+    window((window + 7) / 8),
+    filled(0),
+    ones(0),
+    idle(true),
+    samples(0),
+    totalOnes(0),
+    peak(0),
+    peakAt(0),
+    overload(0),
+    heard(false),
+    leading(0),
+    trailing(0)
+  {
+    if (this->window == 0)
+      this->window = 1;
+  }
+
+  // Account for the current window and start the next one. An
+  // incomplete window is too short to say much about the level.
+  void close(bool complete);
+
+  unsigned int sampleRate;
+  size_t window;       // bytes per window
+  size_t filled;       // bytes of the current window seen so far
+  uint64_t ones;       // in the current window
+  bool idle;           // whether the current window is silent so far
+  uint64_t samples;    // before the current window
+  uint64_t totalOnes;
+  double peak;
+  uint64_t peakAt;     // first sample of the loudest window
+  uint64_t overload;   // samples in overloaded windows
+  bool heard;          // whether a window wasn't silent
+  uint64_t leading;    // samples of silence at the start
+  uint64_t trailing;   // and since the last window that wasn't silent
+};
+
+void DSDAnalyzer::AnalyzerPrivate::close(bool complete)
+{
+  if (filled == 0)
+    return;
+
+  uint64_t bits = filled * 8;
+  double modulation = fabs(2.0 * ones / bits - 1);
+  if (complete && modulation > peak) {
+    peak = modulation;
+    peakAt = samples;
+  }
+  if (complete && modulation > OVERLOAD)
+    overload += bits;
+
+  if (idle) {
+    if (!heard)
+      leading += bits;
+    trailing += bits;
+  } else {
+    heard = true;
+    trailing = 0;
+  }
+
+  samples += bits;
+  totalOnes += ones;
+  filled = 0;
+  ones = 0;
+  idle = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public members
+////////////////////////////////////////////////////////////////////////////////
+
+DSDAnalyzer::DSDAnalyzer(unsigned int sampleRate, unsigned int window)
+{
+  d = new AnalyzerPrivate(sampleRate, window);
+}
+
+DSDAnalyzer::~DSDAnalyzer()
+{
+  delete d;
+}
+
+void DSDAnalyzer::process(const unsigned char *data, size_t size)
+{
+  const Kernels &k = kernels();
+  while (size > 0) {
+    size_t n = d->window - d->filled;
+    if (n > size)
+      n = size;
+
+    uint64_t ones = k.count(data, n);
+    // Idle bytes have 4 ones each, so most windows are ruled out here
+    if (d->idle)
+      d->idle = ones == n * 4 && isIdle(data, n);
+    d->ones += ones;
+    d->filled += n;
+    if (d->filled == d->window)
+      d->close(true);
+
+    data += n;
+    size -= n;
+  }
+}
+
+void DSDAnalyzer::finish()
+{
+  d->close(false);
+}
+
+double DSDAnalyzer::density() const
+{
+  return d->samples > 0 ? static_cast<double>(d->totalOnes) / d->samples : 0;
+}
+
+double DSDAnalyzer::peakModulation() const
+{
+  return d->peak;
+}
+
+double DSDAnalyzer::peakTime() const
+{
+  return static_cast<double>(d->peakAt) / d->sampleRate;
+}
+
+double DSDAnalyzer::overloadSeconds() const
+{
+  return static_cast<double>(d->overload) / d->sampleRate;
+}
+
+double DSDAnalyzer::silenceAtStart() const
+{
+  return static_cast<double>(d->leading) / d->sampleRate;
+}
+
+double DSDAnalyzer::silenceAtEnd() const
+{
+  // All of it is at the start if nothing else was heard
+  return d->heard ? static_cast<double>(d->trailing) / d->sampleRate : 0;
+}
+
+const char *DSDAnalyzer::kernel()
+{
+  return kernels().name;
+}
@@ -0,0 +1,111 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_DSDANALYZER_H
+#define TAGLIB_DSDANALYZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! Level statistics of one channel of 1-bit DSD
+
+/*!
+ * The stream is cut into windows of a fixed number of samples, and the
+ * ones in each window are counted. With d the density of ones in a
+ * window, its modulation is 2d - 1: 0 for silence, 1 or -1 for a
+ * stream of all ones or all zeros. SACD allows 50% modulation
+ * sustained, which is taken as the overload threshold; it's also the
+ * 0 dB reference of SACD levels.
+ *
+ * A window is silent if it only holds the idle pattern 0x69, or 0x96
+ * with the bits the other way round.
+ *
+ * Ones are counted with AVX2 or NEON where the CPU has them, otherwise
+ * with the popcount instruction or the compiler's builtin.
+ */
+
+class DSDAnalyzer
+{
+ public:
+  /*!
+   * Counts windows of \a window samples (rounded up to a multiple of
+   * 8) of a stream at \a sampleRate.
+   */
+  DSDAnalyzer(unsigned int sampleRate, unsigned int window);
+
+  /*!
+   * Destroys this instance.
+   */
+  ~DSDAnalyzer();
+
+  /*!
+   * Goes on with \a size bytes of samples at \a data.
+   */
+  void process(const unsigned char *data, size_t size);
+
+  /*!
+   * Accounts for the last window if it's incomplete, for everything
+   * but the peak and overload. Must be called once all the samples have
+   * been processed.
+   */
+  void finish();
+
+  /*!
+   * Returns the density of ones over the whole stream. The DC offset is
+   * 2 * density() - 1.
+   */
+  double density() const;
+
+  /*!
+   * Returns the highest modulation of a window, from 0 to 1, and when
+   * that window starts, in seconds.
+   */
+  double peakModulation() const;
+  double peakTime() const;
+
+  /*!
+   * Returns the length of the windows modulated more than 50% put
+   * together, in seconds.
+   */
+  double overloadSeconds() const;
+
+  /*!
+   * Returns the length of the silence at the start and at the end, in
+   * seconds.
+   */
+  double silenceAtStart() const;
+  double silenceAtEnd() const;
+
+  /*!
+   * Returns the name of the instruction set used to count ones:
+   * "AVX2", "NEON", "POPCNT" or "scalar".
+   */
+  static const char *kernel();
+
+ private:
+  DSDAnalyzer(const DSDAnalyzer &);
+  DSDAnalyzer &operator=(const DSDAnalyzer &);
+
+  class AnalyzerPrivate;
+  AnalyzerPrivate *d;
+};
+
+#endif
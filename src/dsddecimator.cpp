@@ -0,0 +1,384 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DECIMATOR_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DECIMATOR_NEON
+#endif
+
+#include "dsddecimator.h"
+
+namespace
+{
+  const double PASSBAND = 0.45;    // of the output rate
+  const double ATTENUATION = 100;  // dB, in the bands folded onto it
+  const unsigned char SILENCE = 0x69; // as many ones as zeros
+
+  // Kaiser windowed sinc with a cutoff at cutoff * fs, the transition
+  // band width * fs wide. The length is odd, or a multiple of align if
+  // that's more than 1. DC gain is 1.
+  std::vector<float> lowpass(double cutoff, double width, 
+			     unsigned int align)
+  {
+    unsigned int n = ceil((ATTENUATION - 7.95) / (14.36 * width)) + 1;
+    n = (n + align - 1) / align * align;
+    if (align == 1 && n % 2 == 0)
+      n++;
+
+    double beta = 0.1102 * (ATTENUATION - 8.7);
+    auto i0 = [](double x) {
+      double sum = 1, term = 1;
+      for (int k = 1; term > sum * 1e-12; k++) {
+	term *= (x / (2 * k)) * (x / (2 * k));
+	sum += term;
+      }
+      return sum;
+    };
+
+    std::vector<double> h(n);
+    double sum = 0, mid = (n - 1) / 2.0;
+    for (unsigned int i = 0; i < n; i++) {
+      double t = i - mid;
+      double r = t / mid;
+      double sinc = t == 0 ? 2 * cutoff : 
+	sin(2 * M_PI * cutoff * t) / (M_PI * t);
+      h[i] = sinc * i0(beta * sqrt(1 - r * r)) / i0(beta);
+      sum += h[i];
+    }
+
+    std::vector<float> taps;
+    for (unsigned int i = 0; i < n; i++)
+      taps.push_back(h[i] / sum);
+    return taps;
+  }
+
+  ////////////////////////////// kernels //////////////////////////////
+
+  float dotScalar(const float *x, const float *h, size_t n)
+  {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (size_t i = 0; i < n; i += 4) {
+      s0 += x[i] * h[i];
+      s1 += x[i + 1] * h[i + 1];
+      s2 += x[i + 2] * h[i + 2];
+      s3 += x[i + 3] * h[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+  }
+
+  // out[i] = sum over k of table[k][data[i - k]], K tables of 256
+  void lookupScalar(const unsigned char *data, size_t n, 
+		    const float *table, unsigned int K, float *out)
+  {
+    for (size_t i = 0; i < n; i++) {
+      const unsigned char *p = data + i;
+      float s0 = 0, s1 = 0;
+      unsigned int k = 0;
+      for (; k + 1 < K; k += 2) {
+	s0 += table[k * 256 + p[-static_cast<int>(k)]];
+	s1 += table[(k + 1) * 256 + p[-static_cast<int>(k) - 1]];
+      }
+      if (k < K)
+	s0 += table[k * 256 + p[-static_cast<int>(k)]];
+      out[i] = s0 + s1;
+    }
+  }
+
+#ifdef DECIMATOR_X86
+  __attribute__((target("avx2,fma")))
+  float dotAVX2(const float *x, const float *h, size_t n)
+  {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), 
+			   _mm256_loadu_ps(h + i), s0);
+      s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), 
+			   _mm256_loadu_ps(h + i + 8), s1);
+    }
+    if (i < n)
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), 
+			   _mm256_loadu_ps(h + i), s0);
+    s0 = _mm256_add_ps(s0, s1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(s0), 
+			  _mm256_extractf128_ps(s0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+  }
+
+  // Eight outputs at a time, gathering from each table
+  __attribute__((target("avx2,fma")))
+  void lookupAVX2(const unsigned char *data, size_t n, 
+		  const float *table, unsigned int K, float *out)
+  {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+      unsigned int k = 0;
+      for (; k + 1 < K; k += 2) {
+	__m256i b0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+	  reinterpret_cast<const __m128i *>(data + i - k)));
+	__m256i b1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+	  reinterpret_cast<const __m128i *>(data + i - k - 1)));
+	s0 = _mm256_add_ps(s0, _mm256_i32gather_ps(table + k * 256, b0, 4));
+	s1 = _mm256_add_ps(s1, 
+			   _mm256_i32gather_ps(table + (k + 1) * 256, b1, 4));
+      }
+      if (k < K) {
+	__m256i b0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+	  reinterpret_cast<const __m128i *>(data + i - k)));
+	s0 = _mm256_add_ps(s0, _mm256_i32gather_ps(table + k * 256, b0, 4));
+      }
+      _mm256_storeu_ps(out + i, _mm256_add_ps(s0, s1));
+    }
+    lookupScalar(data + i, n - i, table, K, out + i);
+  }
+#endif
+
+#ifdef DECIMATOR_NEON
+  float dotNEON(const float *x, const float *h, size_t n)
+  {
+    float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+    for (size_t i = 0; i < n; i += 8) {
+      s0 = vmlaq_f32(s0, vld1q_f32(x + i), vld1q_f32(h + i));
+      s1 = vmlaq_f32(s1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+    }
+    s0 = vaddq_f32(s0, s1);
+    float32x2_t s = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+  }
+#endif
+
+  // The best kernels this CPU can run, picked once
+  struct Kernels {
+    Kernels() : dot(dotScalar), lookup(lookupScalar), name("scalar") {
+#ifdef DECIMATOR_X86
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+	dot = dotAVX2;
+	lookup = lookupAVX2;
+	name = "AVX2";
+      }
+#elif defined(DECIMATOR_NEON)
+      dot = dotNEON;
+      name = "NEON";
+#endif
+    }
+
+    float (*dot)(const float *, const float *, size_t);
+    void (*lookup)(const unsigned char *, size_t, const float *, 
+		   unsigned int, float *);
+    const char *name;
+  };
+
+  const Kernels &kernels()
+  {
+    static const Kernels k;
+    return k;
+  }
+}
+
+class DSDDecimator::DecimatorPrivate
+{
+public:
+  DecimatorPrivate() : 
+    isValid(false),
+    ratio(0),
+    K(0)
+  {}
+
+  // Half-band filter going down by 2. All taps but the centre one are
+  // zero on one side of it, so only every other sample is multiplied,
+  // after being copied next to each other.
+  struct HalfBand {
+    void init(const std::vector<float> &h);
+    void reset();
+    size_t run(const float *in, size_t n, float *out);
+
+    unsigned int length;      // of the whole filter, odd
+    unsigned int phase;       // of the non-zero taps
+    float centre;
+    std::vector<float> taps;  // the non-zero ones, a multiple of 8
+    std::vector<float> buf;   // input not consumed yet
+    std::vector<float> every2; // every other sample of buf, from phase
+  };
+
+  bool isValid;
+  unsigned int ratio;
+  unsigned int K;               // bytes per first stage output
+  std::vector<float> table;     // K tables of 256 sums of 8 taps
+  std::vector<unsigned char> bytes; // K - 1 bytes of history + input
+  std::vector<HalfBand> stages;
+  std::vector<float> work[2];
+};
+
+void DSDDecimator::DecimatorPrivate::HalfBand::init(
+  const std::vector<float> &h)
+{
+  length = h.size();
+  unsigned int mid = length / 2;
+  phase = 1 - mid % 2;
+  centre = h[mid];
+  taps.clear();
+  for (unsigned int i = phase; i < length; i += 2)
+    taps.push_back(h[i]);
+  taps.resize((taps.size() + 7) / 8 * 8, 0.0f);
+}
+
+void DSDDecimator::DecimatorPrivate::HalfBand::reset()
+{
+  // So that every 2 samples in give one out
+  buf.assign(length - 2, 0);
+}
+
+size_t DSDDecimator::DecimatorPrivate::HalfBand::run(const float *in, 
+						     size_t n, float *out)
+{
+  buf.insert(buf.end(), in, in + n);
+  if (buf.size() < length)
+    return 0;
+
+  size_t count = (buf.size() - length) / 2 + 1;
+  every2.resize(count + taps.size());
+  for (size_t j = 0; j < every2.size(); j++) {
+    size_t i = 2 * j + phase;
+    every2[j] = i < buf.size() ? buf[i] : 0;
+  }
+
+  const Kernels &k = kernels();
+  size_t mid = length / 2;
+  for (size_t m = 0; m < count; m++)
+    out[m] = k.dot(&every2[m], &taps[0], taps.size()) + 
+      centre * buf[2 * m + mid];
+
+  buf.erase(buf.begin(), buf.begin() + 2 * count);
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public members
+////////////////////////////////////////////////////////////////////////////////
+
+DSDDecimator::DSDDecimator(unsigned int inRate, unsigned int outRate)
+{
+  d = new DecimatorPrivate;
+
+  if (outRate == 0 || inRate % outRate != 0)
+    return;
+  unsigned int ratio = inRate / outRate;
+  if (ratio < 8 || (ratio & (ratio - 1)) != 0)
+    return;
+
+  // What mustn't be folded onto the passband: everything above
+  // rate - passband at the output of each stage
+  double passband = PASSBAND * outRate;
+  unsigned int rate = inRate / 8;
+
+  std::vector<float> h = lowpass(0.5 / 8, (rate - 2 * passband) / inRate, 8);
+  d->K = h.size() / 8;
+  d->table.resize(d->K * 256);
+  for (unsigned int k = 0; k < d->K; k++) {
+    // Table k is for the byte k bytes before the newest one. Its
+    // bit b is sample 8 * k + 7 - b counting back from the newest.
+    for (unsigned int v = 0; v < 256; v++) {
+      float sum = 0;
+      for (unsigned int b = 0; b < 8; b++)
+	sum += (v & (1 << b) ? 1 : -1) * h[8 * k + 7 - b];
+      d->table[k * 256 + v] = sum;
+    }
+  }
+
+  for (; rate > outRate; rate /= 2) {
+    d->stages.push_back(DecimatorPrivate::HalfBand());
+    d->stages.back().init(lowpass(0.25, (rate / 2 - 2 * passband) / rate, 1));
+  }
+
+  d->ratio = ratio;
+  d->isValid = true;
+  reset();
+}
+
+DSDDecimator::~DSDDecimator()
+{
+  delete d;
+}
+
+bool DSDDecimator::isValid() const
+{
+  return d->isValid;
+}
+
+unsigned int DSDDecimator::ratio() const
+{
+  return d->ratio;
+}
+
+size_t DSDDecimator::process(const unsigned char *data, size_t size, 
+			     float *out)
+{
+  if (!d->isValid || size == 0)
+    return 0;
+
+  size_t history = d->K - 1;
+  d->bytes.resize(history + size);
+  memcpy(&d->bytes[history], data, size);
+
+  std::vector<float> *in = &d->work[0], *next = &d->work[1];
+  in->resize(size);
+  kernels().lookup(&d->bytes[history], size, &d->table[0], d->K, 
+		   &(*in)[0]);
+  memmove(&d->bytes[0], &d->bytes[size], history);
+
+  size_t n = size;
+  for (size_t i = 0; i < d->stages.size(); i++) {
+    bool last = i + 1 == d->stages.size();
+    if (!last)
+      next->resize(n / 2 + 1);
+    n = d->stages[i].run(&(*in)[0], n, last ? out : &(*next)[0]);
+    std::swap(in, next);
+  }
+  if (d->stages.empty())
+    memcpy(out, &(*in)[0], n * sizeof(float));
+  return n;
+}
+
+void DSDDecimator::reset()
+{
+  if (!d->isValid)
+    return;
+
+  d->bytes.assign(d->K - 1, SILENCE);
+  for (auto &s : d->stages)
+    s.reset();
+}
+
+const char *DSDDecimator::kernel()
+{
+  return kernels().name;
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_DSDDECIMATOR_H
+#define TAGLIB_DSDDECIMATOR_H
+
+#include <stddef.h>
+
+//! Converts one channel of 1-bit DSD to PCM
+
+/*!
+ * Filters and decimates the 1-bit stream in several stages. The first
+ * one goes down by a factor of 8: each byte of input is one step of an
+ * FIR filter whose taps are summed 8 at a time, with a table lookup
+ * per byte. Every following stage is a half-band FIR filter halving the
+ * rate, run with AVX2 or NEON where the CPU has them.
+ *
+ * Everything below 0.45 times the output rate is kept, everything that
+ * would be folded into it is attenuated by at least 100 dB. The output
+ * lags the input by the group delay of the filters, a few dozen output
+ * samples. A full scale DSD signal, all ones or all zeros, gives 1.0 or
+ * -1.0.
+ *
+ * An instance keeps the history of a single channel and is meant to be
+ * used by one thread at a time.
+ */
+
+class DSDDecimator
+{
+ public:
+  /*!
+   * Sets up the filters going from \a inRate (e.g. 2822400) to
+   * \a outRate (e.g. 88200).
+   */
+  DSDDecimator(unsigned int inRate, unsigned int outRate);
+
+  /*!
+   * Destroys this instance.
+   */
+  ~DSDDecimator();
+
+  /*!
+   * Returns true if the rates are supported: \a outRate is \a inRate
+   * divided by 8, 16, 32 and so on.
+   */
+  bool isValid() const;
+
+  /*!
+   * Returns the number of input samples per output sample.
+   */
+  unsigned int ratio() const;
+
+  /*!
+   * Filters \a size bytes of samples at \a data, LSB first as in a DSF
+   * file, and writes the PCM samples that are complete to \a out.
+   * Returns how many were written, at most size * 8 / ratio() + 1.
+   */
+  size_t process(const unsigned char *data, size_t size, float *out);
+
+  /*!
+   * Forgets the input seen so far, e.g. before going on with another
+   * file.
+   */
+  void reset();
+
+  /*!
+   * Returns the name of the instruction set used by the filters:
+   * "AVX2", "NEON" or "scalar".
+   */
+  static const char *kernel();
+
+ private:
+  DSDDecimator(const DSDDecimator &);
+  DSDDecimator &operator=(const DSDDecimator &);
+
+  class DecimatorPrivate;
+  DecimatorPrivate *d;
+};
+
+#endif
@@ -0,0 +1,877 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSDIFF_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define DSDIFF_NEON
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dsfdatareader.h"
+#include "dsdiffconverter.h"
+
+namespace {
+  const unsigned int BLOCK_SIZE = DSFDataReader::BLOCK_SIZE;
+
+  // Groups of blocks, i.e. of 4096 bytes per channel, in a buffer
+  const unsigned int GROUPS = 32;
+
+  // Buffers between the thread converting and the thread writing
+  const unsigned int SLOTS = 4;
+
+  // DSDIFF channel IDs of the DSF channel types, in the order of DSF
+  struct Layout {
+    DSFHeader::ChannelType type;
+    unsigned int channels;
+    const char *ids[6];
+  };
+
+  const Layout LAYOUTS[] = {
+    { DSFHeader::Mono, 1, { "C   " } },
+    { DSFHeader::Stereo, 2, { "SLFT", "SRGT" } },
+    { DSFHeader::Stereo, 2, { "MLFT", "MRGT" } },
+    { DSFHeader::ThreeChannels, 3, { "MLFT", "MRGT", "C   " } },
+    { DSFHeader::Quad, 4, { "MLFT", "MRGT", "LS  ", "RS  " } },
+    { DSFHeader::FourChannels, 4, { "MLFT", "MRGT", "C   ", "LFE " } },
+    { DSFHeader::FiveChannels, 5, { "MLFT", "MRGT", "C   ", "LS  ", "RS  " } },
+    { DSFHeader::FiveOneChannels, 6, 
+      { "MLFT", "MRGT", "C   ", "LFE ", "LS  ", "RS  " } }
+  };
+
+  const unsigned int MAX_CHANNELS = 6;
+
+  void putID(std::vector<unsigned char> &v, const char *id)
+  {
+    v.insert(v.end(), id, id + 4);
+  }
+
+  void putBE(std::vector<unsigned char> &v, uint64_t n, int bytes)
+  {
+    for (int i = bytes - 1; i >= 0; i--)
+      v.push_back((n >> (i * 8)) & 0xff);
+  }
+
+  void putLE(std::vector<unsigned char> &v, uint64_t n, int bytes)
+  {
+    for (int i = 0; i < bytes; i++)
+      v.push_back((n >> (i * 8)) & 0xff);
+  }
+
+  uint64_t getBE(const unsigned char *p, int bytes)
+  {
+    uint64_t n = 0;
+    for (int i = 0; i < bytes; i++)
+      n = (n << 8) | p[i];
+    return n;
+  }
+
+  bool readAll(int fd, unsigned char *p, size_t size, uint64_t offset)
+  {
+    while (size > 0) {
+      ssize_t r = pread(fd, p, size, offset);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r <= 0)
+	return false;
+      p += r;
+      size -= r;
+      offset += r;
+    }
+    return true;
+  }
+
+  bool writeAll(int fd, const unsigned char *p, size_t size)
+  {
+    while (size > 0) {
+      ssize_t r = write(fd, p, size);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r <= 0)
+	return false;
+      p += r;
+      size -= r;
+    }
+    return true;
+  }
+
+  // Append size bytes of in at offset to out. The kernel copies them
+  // without going through user space if it can, e.g. not across file
+  // systems on older kernels.
+  bool copyRange(int in, uint64_t offset, uint64_t size, int out)
+  {
+#ifdef __linux__
+    loff_t off = offset;
+    while (size > 0) {
+      ssize_t r = copy_file_range(in, &off, out, nullptr, size, 0);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r <= 0)
+	break;
+      size -= r;
+    }
+    offset = off;
+#endif
+
+    std::vector<unsigned char> buf(1 << 20);
+    while (size > 0) {
+      size_t n = std::min<uint64_t>(size, buf.size());
+      if (!readAll(in, &buf[0], n, offset) || !writeAll(out, &buf[0], n))
+	return false;
+      offset += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  ////////////////////////////// kernels //////////////////////////////
+
+  struct Reversed {
+    Reversed() {
+      for (int i = 0; i < 256; i++) {
+	unsigned char r = 0;
+	for (int b = 0; b < 8; b++)
+	  if (i & (1 << b))
+	    r |= 0x80 >> b;
+	table[i] = r;
+      }
+    }
+    unsigned char table[256];
+  };
+
+  // Every byte with its bits the other way round
+  const unsigned char *reversed()
+  {
+    static const Reversed r;
+    return r.table;
+  }
+
+  void reverseScalar(const unsigned char *in, unsigned char *out, size_t n)
+  {
+    const unsigned char *t = reversed();
+    for (size_t i = 0; i < n; i++)
+      out[i] = t[in[i]];
+  }
+
+  // n bytes of a and b, reversed, into n pairs of bytes at out
+  void interleave2Scalar(const unsigned char *a, const unsigned char *b,
+			 unsigned char *out, size_t n)
+  {
+    const unsigned char *t = reversed();
+    for (size_t i = 0; i < n; i++) {
+      out[2 * i] = t[a[i]];
+      out[2 * i + 1] = t[b[i]];
+    }
+  }
+
+  // And back
+  void deinterleave2Scalar(const unsigned char *in, unsigned char *a,
+			   unsigned char *b, size_t n)
+  {
+    const unsigned char *t = reversed();
+    for (size_t i = 0; i < n; i++) {
+      a[i] = t[in[2 * i]];
+      b[i] = t[in[2 * i + 1]];
+    }
+  }
+
+#ifdef DSDIFF_X86
+  // Each nibble looked up reversed, in the other half of the byte
+  __attribute__((target("avx2")))
+  inline __m256i reverse32(__m256i v)
+  {
+    const __m256i high = _mm256_setr_epi8(
+      0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+      0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+      0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+      0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0);
+    const __m256i low = _mm256_setr_epi8(
+      0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+      0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+      0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+      0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    return _mm256_or_si256(
+      _mm256_shuffle_epi8(high, _mm256_and_si256(v, nibble)),
+      _mm256_shuffle_epi8(low, _mm256_and_si256(_mm256_srli_epi16(v, 4), 
+						nibble)));
+  }
+
+  __attribute__((target("avx2")))
+  void reverseAVX2(const unsigned char *in, unsigned char *out, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+	reverse32(_mm256_loadu_si256(
+	  reinterpret_cast<const __m256i *>(in + i))));
+    reverseScalar(in + i, out + i, n - i);
+  }
+
+  // unpack works within 128-bit lanes, permute2x128 puts the lanes
+  // back in order
+  __attribute__((target("avx2")))
+  void interleave2AVX2(const unsigned char *a, const unsigned char *b,
+		       unsigned char *out, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i x = reverse32(_mm256_loadu_si256(
+	reinterpret_cast<const __m256i *>(a + i)));
+      __m256i y = reverse32(_mm256_loadu_si256(
+	reinterpret_cast<const __m256i *>(b + i)));
+      __m256i lo = _mm256_unpacklo_epi8(x, y);
+      __m256i hi = _mm256_unpackhi_epi8(x, y);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i),
+			  _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i + 32),
+			  _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave2Scalar(a + i, b + i, out + 2 * i, n - i);
+  }
+
+  // Even bytes to the low half of each lane, odd bytes to the high
+  // half, then the halves gathered across lanes
+  __attribute__((target("avx2")))
+  void deinterleave2AVX2(const unsigned char *in, unsigned char *a,
+			 unsigned char *b, size_t n)
+  {
+    const __m256i split = _mm256_setr_epi8(
+      0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+      0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i x = _mm256_shuffle_epi8(reverse32(_mm256_loadu_si256(
+	reinterpret_cast<const __m256i *>(in + 2 * i))), split);
+      __m256i y = _mm256_shuffle_epi8(reverse32(_mm256_loadu_si256(
+	reinterpret_cast<const __m256i *>(in + 2 * i + 32))), split);
+      x = _mm256_permute4x64_epi64(x, 0xd8);
+      y = _mm256_permute4x64_epi64(y, 0xd8);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i),
+			  _mm256_permute2x128_si256(x, y, 0x20));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(b + i),
+			  _mm256_permute2x128_si256(x, y, 0x31));
+    }
+    deinterleave2Scalar(in + 2 * i, a + i, b + i, n - i);
+  }
+#endif
+
+#ifdef DSDIFF_NEON
+  void reverseNEON(const unsigned char *in, unsigned char *out, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+      vst1q_u8(out + i, vrbitq_u8(vld1q_u8(in + i)));
+    reverseScalar(in + i, out + i, n - i);
+  }
+
+  void interleave2NEON(const unsigned char *a, const unsigned char *b,
+		       unsigned char *out, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      uint8x16x2_t v;
+      v.val[0] = vrbitq_u8(vld1q_u8(a + i));
+      v.val[1] = vrbitq_u8(vld1q_u8(b + i));
+      vst2q_u8(out + 2 * i, v);
+    }
+    interleave2Scalar(a + i, b + i, out + 2 * i, n - i);
+  }
+
+  void deinterleave2NEON(const unsigned char *in, unsigned char *a,
+			 unsigned char *b, size_t n)
+  {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      uint8x16x2_t v = vld2q_u8(in + 2 * i);
+      vst1q_u8(a + i, vrbitq_u8(v.val[0]));
+      vst1q_u8(b + i, vrbitq_u8(v.val[1]));
+    }
+    deinterleave2Scalar(in + 2 * i, a + i, b + i, n - i);
+  }
+#endif
+
+  // The best kernels this CPU can run, picked once
+  struct Kernels {
+    Kernels() :
+      reverse(reverseScalar),
+      interleave2(interleave2Scalar),
+      deinterleave2(deinterleave2Scalar),
+      name("scalar")
+    {
+#ifdef DSDIFF_X86
+      if (__builtin_cpu_supports("avx2")) {
+	reverse = reverseAVX2;
+	interleave2 = interleave2AVX2;
+	deinterleave2 = deinterleave2AVX2;
+	name = "AVX2";
+      }
+#elif defined(DSDIFF_NEON)
+      reverse = reverseNEON;
+      interleave2 = interleave2NEON;
+      deinterleave2 = deinterleave2NEON;
+      name = "NEON";
+#endif
+    }
+
+    void (*reverse)(const unsigned char *, unsigned char *, size_t);
+    void (*interleave2)(const unsigned char *, const unsigned char *,
+			unsigned char *, size_t);
+    void (*deinterleave2)(const unsigned char *, unsigned char *,
+			  unsigned char *, size_t);
+    const char *name;
+  };
+
+  const Kernels &kernels()
+  {
+    static const Kernels k;
+    return k;
+  }
+
+  // n bytes of every channel, LSB first, into n frames of DSDIFF. Only
+  // mono and stereo have kernels of their own.
+  void interleave(const unsigned char *const *planes, unsigned int channels,
+		  unsigned char *out, size_t n)
+  {
+    if (channels == 1) {
+      kernels().reverse(planes[0], out, n);
+    } else if (channels == 2) {
+      kernels().interleave2(planes[0], planes[1], out, n);
+    } else {
+      const unsigned char *t = reversed();
+      for (unsigned int ch = 0; ch < channels; ch++)
+	for (size_t i = 0; i < n; i++)
+	  out[i * channels + ch] = t[planes[ch][i]];
+    }
+  }
+
+  // n frames of DSDIFF into n bytes of every channel, channel k of DSF
+  // being channel order[k] of DSDIFF
+  void deinterleave(const unsigned char *in, unsigned int channels,
+		    const unsigned int *order, unsigned char *const *planes,
+		    size_t n)
+  {
+    if (channels == 1) {
+      kernels().reverse(in, planes[0], n);
+    } else if (channels == 2) {
+      kernels().deinterleave2(in, planes[order[0]], planes[order[1]], n);
+    } else {
+      const unsigned char *t = reversed();
+      for (unsigned int k = 0; k < channels; k++)
+	for (size_t i = 0; i < n; i++)
+	  planes[k][i] = t[in[i * channels + order[k]]];
+    }
+  }
+
+  // Fills a buffer with the next bytes to write, or leaves it empty at
+  // the end. Returns false on error.
+  typedef std::function<bool (std::vector<unsigned char> &)> Producer;
+
+  // Write to fd what produce makes on a thread of its own, at most
+  // SLOTS buffers ahead. Sets readError if produce failed.
+  bool pump(const Producer &produce, int fd, bool &readError)
+  {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<std::vector<unsigned char> > spare(SLOTS);
+    std::deque<std::vector<unsigned char> > full;
+    bool done = false, stop = false;
+    readError = false;
+
+    std::thread producer([&]() {
+	while (true) {
+	  std::vector<unsigned char> buf;
+	  {
+	    std::unique_lock<std::mutex> l(lock);
+	    changed.wait(l, [&]() { return !spare.empty() || stop; });
+	    if (stop)
+	      return;
+	    buf.swap(spare.back());
+	    spare.pop_back();
+	  }
+
+	  buf.clear();
+	  bool ok = produce(buf);
+
+	  std::lock_guard<std::mutex> l(lock);
+	  if (!ok || buf.empty()) {
+	    readError = !ok;
+	    done = true;
+	    changed.notify_all();
+	    return;
+	  }
+	  full.push_back(std::move(buf));
+	  changed.notify_all();
+	}
+      });
+
+    bool ok = true;
+    while (true) {
+      std::vector<unsigned char> buf;
+      {
+	std::unique_lock<std::mutex> l(lock);
+	changed.wait(l, [&]() { return !full.empty() || done; });
+	if (full.empty())
+	  break;
+	buf.swap(full.front());
+	full.pop_front();
+      }
+
+      ok = writeAll(fd, &buf[0], buf.size());
+
+      std::lock_guard<std::mutex> l(lock);
+      if (!ok) {
+	stop = true;
+	changed.notify_all();
+	break;
+      }
+      spare.push_back(std::move(buf));
+      changed.notify_all();
+    }
+
+    producer.join();
+    return ok && !readError;
+  }
+}
+
+//////////////////////////// IMPL //////////////////////////////
+class DSDIFFConverter::DSDIFFConverterImpl {
+ public:
+  DSDIFFConverterImpl() :
+    _bytesWritten(0),
+    _elapsedSeconds(0)
+  {}
+  ~DSDIFFConverterImpl() {}
+
+  // Create file and fill it with write, which reports its own errors.
+  // Nothing is left behind on failure.
+  bool create(const char *file, const std::function<bool (int fd)> &write,
+	      std::ostream &err);
+
+  /////////////// Variables //////////////
+  uint64_t _bytesWritten;
+  double _elapsedSeconds;
+};
+
+bool DSDIFFConverter::DSDIFFConverterImpl::create(const char *file, 
+  const std::function<bool (int fd)> &write, std::ostream &err)
+{
+  // Never overwrite, it may well be the original of another conversion
+  int fd = open(file, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    if (errno == EEXIST)
+      err << file << ": file exists, not overwritten." << std::endl;
+    else
+      err << file << ": can't create file." << std::endl;
+    return false;
+  }
+
+  bool ok = write(fd);
+  off_t size = lseek(fd, 0, SEEK_CUR);
+  if (close(fd) != 0 && ok) {
+    err << file << ": error writing file." << std::endl;
+    ok = false;
+  }
+  if (!ok) {
+    unlink(file);
+    return false;
+  }
+  _bytesWritten = size;
+  return true;
+}
+
+//////////////////////////// PUBLIC //////////////////////////////
+
+DSDIFFConverter::DSDIFFConverter() :
+  _i(new DSDIFFConverterImpl())
+{
+}
+
+DSDIFFConverter::~DSDIFFConverter()
+{
+  delete _i;
+}
+
+bool DSDIFFConverter::toDSDIFF(const char *dsfFile, const char *dffFile,
+			       std::ostream &err)
+{
+  auto start = std::chrono::steady_clock::now();
+  _i->_bytesWritten = 0;
+  _i->_elapsedSeconds = 0;
+
+  DSFDataReader reader(dsfFile);
+  if (!reader.isValid()) {
+    err << dsfFile << ": error reading audio data." << std::endl;
+    return false;
+  }
+
+  const DSFHeader &h = reader.header();
+  if (h.bitsPerSample() != 1) {
+    err << dsfFile << ": only 1 bit per sample can be converted." 
+	<< std::endl;
+    return false;
+  }
+  const Layout *layout = nullptr;
+  for (auto &l : LAYOUTS)
+    if (l.type == h.channelType() && l.channels == h.channelNum()) {
+      layout = &l;
+      break;
+    }
+  if (!layout) {
+    err << dsfFile << ": unknown channel type." << std::endl;
+    return false;
+  }
+
+  int in = open(dsfFile, O_RDONLY);
+  struct stat st;
+  if (in < 0 || fstat(in, &st) != 0) {
+    if (in >= 0)
+      close(in);
+    err << dsfFile << ": can't open file." << std::endl;
+    return false;
+  }
+
+  // The ID3v2 tag runs from the metadata offset to the end of the file
+  uint64_t end = std::min<uint64_t>(h.fileSize(), st.st_size);
+  uint64_t tagOffset = h.ID3v2Offset();
+  uint64_t tagSize = tagOffset > 0 && tagOffset < end ? end - tagOffset : 0;
+
+  unsigned int channels = h.channelNum();
+  uint64_t perChannel = (h.sampleCount() + 7) / 8;
+  uint64_t dataSize = perChannel * channels;
+  const char compression[] = "not compressed";
+
+  std::vector<unsigned char> v;
+  putID(v, "FRM8");
+  putBE(v, 0, 8);                         // set below
+  putID(v, "DSD ");
+  putID(v, "FVER");
+  putBE(v, 4, 8);
+  putBE(v, 0x01050000, 4);                // 1.5.0.0
+  putID(v, "PROP");
+  putBE(v, 4 + 16 + 14 + 4 * channels + 32, 8);
+  putID(v, "SND ");
+  putID(v, "FS  ");
+  putBE(v, 4, 8);
+  putBE(v, h.sampleRate(), 4);
+  putID(v, "CHNL");
+  putBE(v, 2 + 4 * channels, 8);
+  putBE(v, channels, 2);
+  for (unsigned int ch = 0; ch < channels; ch++)
+    putID(v, layout->ids[ch]);
+  putID(v, "CMPR");
+  putBE(v, 4 + 1 + 14, 8);
+  putID(v, "DSD ");
+  v.push_back(14);
+  v.insert(v.end(), compression, compression + 14);
+  v.push_back(0);                         // pad byte
+  putID(v, "DSD ");
+  putBE(v, dataSize, 8);
+
+  uint64_t formSize = v.size() - 12 + dataSize + (dataSize & 1);
+  if (tagSize > 0)
+    formSize += 12 + tagSize + (tagSize & 1);
+  for (int i = 0; i < 8; i++)
+    v[4 + i] = (formSize >> ((7 - i) * 8)) & 0xff;
+
+  uint64_t done = 0;
+  auto produce = [&](std::vector<unsigned char> &buf) {
+    const unsigned char *planes[MAX_CHANNELS];
+    for (unsigned int g = 0; g < GROUPS && done < perChannel; g++) {
+      if (!reader.next())
+	return false;
+      size_t n = std::min<uint64_t>(BLOCK_SIZE, perChannel - done);
+      for (unsigned int ch = 0; ch < channels; ch++)
+	planes[ch] = reader.channel(ch).data;
+      size_t at = buf.size();
+      buf.resize(at + n * channels);
+      interleave(planes, channels, &buf[at], n);
+      done += n;
+    }
+    return true;
+  };
+
+  bool ok = _i->create(dffFile, [&](int out) {
+      bool readError = false;
+      if (!writeAll(out, &v[0], v.size()) || !pump(produce, out, readError)) {
+	if (readError)
+	  err << dsfFile << ": error reading audio data." << std::endl;
+	else
+	  err << dffFile << ": error writing file." << std::endl;
+	return false;
+      }
+
+      // Chunks are padded to an even size
+      const unsigned char pad = 0;
+      v.clear();
+      if (dataSize & 1)
+	v.push_back(pad);
+      if (tagSize > 0) {
+	putID(v, "ID3 ");
+	putBE(v, tagSize, 8);
+      }
+      if (!writeAll(out, v.data(), v.size()) ||
+	  !copyRange(in, tagOffset, tagSize, out) ||
+	  ((tagSize & 1) && !writeAll(out, &pad, 1))) {
+	err << dffFile << ": error copying the ID3v2 tag." << std::endl;
+	return false;
+      }
+      return true;
+    }, err);
+
+  close(in);
+  _i->_elapsedSeconds = std::chrono::duration<double>
+    (std::chrono::steady_clock::now() - start).count();
+  return ok;
+}
+
+bool DSDIFFConverter::toDSF(const char *dffFile, const char *dsfFile,
+			    std::ostream &err)
+{
+  auto start = std::chrono::steady_clock::now();
+  _i->_bytesWritten = 0;
+  _i->_elapsedSeconds = 0;
+
+  int in = open(dffFile, O_RDONLY);
+  struct stat st;
+  if (in < 0 || fstat(in, &st) != 0) {
+    if (in >= 0)
+      close(in);
+    err << dffFile << ": can't open file." << std::endl;
+    return false;
+  }
+
+  // Walk the chunks of the form, and those of the property chunk
+  unsigned char c[16];
+  if (!readAll(in, c, 16, 0) || memcmp(c, "FRM8", 4) != 0 || 
+      memcmp(c + 12, "DSD ", 4) != 0) {
+    close(in);
+    err << dffFile << ": not a DSDIFF file." << std::endl;
+    return false;
+  }
+  uint64_t end = std::min<uint64_t>(12 + getBE(c + 4, 8), st.st_size);
+
+  unsigned int rate = 0;
+  std::vector<std::string> ids;
+  std::string compression = "DSD ";
+  bool hasData = false;
+  uint64_t dataOffset = 0, dataSize = 0, tagOffset = 0, tagSize = 0;
+  const char *error = nullptr;
+
+  for (uint64_t pos = 16; !error && pos + 12 <= end; ) {
+    if (!readAll(in, c, 12, pos)) {
+      error = "error reading file";
+      break;
+    }
+    std::string id(c, c + 4);
+    uint64_t size = getBE(c + 4, 8);
+    if (size > end - pos - 12) {
+      error = "truncated chunk";
+      break;
+    }
+
+    if (id == "PROP") {
+      if (size < 4 || size > 65536) {
+	error = "bad property chunk";
+	break;
+      }
+      std::vector<unsigned char> p(size);
+      if (!readAll(in, &p[0], size, pos + 12) || 
+	  memcmp(&p[0], "SND ", 4) != 0) {
+	error = "bad property chunk";
+	break;
+      }
+      for (size_t q = 4; q + 12 <= size; ) {
+	std::string sub(&p[q], &p[q] + 4);
+	uint64_t n = getBE(&p[q + 4], 8);
+	const unsigned char *data = &p[q + 12];
+	if (n > size - q - 12) {
+	  error = "bad property chunk";
+	  break;
+	}
+	if (sub == "FS  " && n >= 4) {
+	  rate = getBE(data, 4);
+	} else if (sub == "CHNL" && n >= 2) {
+	  unsigned int count = getBE(data, 2);
+	  if (n < 2 + 4 * count) {
+	    error = "bad channel chunk";
+	    break;
+	  }
+	  ids.clear();
+	  for (unsigned int i = 0; i < count; i++)
+	    ids.push_back(std::string(data + 2 + 4 * i, data + 6 + 4 * i));
+	} else if (sub == "CMPR" && n >= 4) {
+	  compression.assign(data, data + 4);
+	}
+	q += 12 + n + (n & 1);
+      }
+    } else if (id == "DSD ") {
+      hasData = true;
+      dataOffset = pos + 12;
+      dataSize = size;
+    } else if (id == "DST ") {
+      compression = "DST ";
+    } else if (id == "ID3 " || id == "id3 ") {
+      tagOffset = pos + 12;
+      tagSize = size;
+    }
+    pos += 12 + size + (size & 1);
+  }
+
+  unsigned int channels = ids.size();
+  if (!error && compression != "DSD ")
+    error = "compressed (DST) files can't be converted";
+  else if (!error && (!hasData || rate == 0 || channels == 0))
+    error = "no audio data or no sound properties";
+  else if (!error && dataSize % channels != 0)
+    error = "audio data of a partial frame";
+
+  // Find the DSF channel type with the same channels, and where they
+  // are in DSDIFF frames
+  const Layout *layout = nullptr;
+  unsigned int order[MAX_CHANNELS];
+  for (auto &l : LAYOUTS) {
+    if (error || l.channels != channels)
+      continue;
+    unsigned int found = 0;
+    for (unsigned int k = 0; k < channels; k++)
+      for (unsigned int j = 0; j < channels; j++)
+	if (ids[j] == l.ids[k] || channels == 1) {
+	  order[k] = j;
+	  found++;
+	  break;
+	}
+    if (found == channels) {
+      layout = &l;
+      break;
+    }
+  }
+  if (!error && !layout)
+    error = "channel layout not supported by DSF";
+
+  if (error) {
+    close(in);
+    err << dffFile << ": " << error << "." << std::endl;
+    return false;
+  }
+
+  uint64_t perChannel = dataSize / channels;
+  uint64_t blocks = (perChannel + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint64_t dataChunk = 12 + blocks * BLOCK_SIZE * channels;
+
+  std::vector<unsigned char> v;
+  putID(v, "DSD ");
+  putLE(v, 28, 8);
+  putLE(v, 28 + 52 + dataChunk + tagSize, 8);
+  putLE(v, tagSize > 0 ? 28 + 52 + dataChunk : 0, 8);
+  putID(v, "fmt ");
+  putLE(v, 52, 8);
+  putLE(v, 1, 4);                         // format version
+  putLE(v, 0, 4);                         // raw DSD
+  putLE(v, layout->type, 4);
+  putLE(v, channels, 4);
+  putLE(v, rate, 4);
+  putLE(v, 1, 4);                         // bits per sample
+  putLE(v, perChannel * 8, 8);            // sample count
+  putLE(v, BLOCK_SIZE, 4);
+  putLE(v, 0, 4);
+  putID(v, "data");
+  putLE(v, dataChunk, 8);
+
+  std::vector<unsigned char> frames(GROUPS * BLOCK_SIZE * channels);
+  uint64_t done = 0;
+  auto produce = [&](std::vector<unsigned char> &buf) {
+    if (done == perChannel)
+      return true;
+    size_t n = std::min<uint64_t>(GROUPS * BLOCK_SIZE, perChannel - done);
+    if (!readAll(in, &frames[0], n * channels, dataOffset + done * channels))
+      return false;
+
+    // The last block of each channel is zero padded
+    size_t groups = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    buf.resize(groups * BLOCK_SIZE * channels);
+    unsigned char *planes[MAX_CHANNELS];
+    for (size_t g = 0; g < groups; g++) {
+      size_t count = std::min<size_t>(BLOCK_SIZE, n - g * BLOCK_SIZE);
+      for (unsigned int k = 0; k < channels; k++) {
+	planes[k] = &buf[(g * channels + k) * BLOCK_SIZE];
+	memset(planes[k] + count, 0, BLOCK_SIZE - count);
+      }
+      deinterleave(&frames[g * BLOCK_SIZE * channels], channels, order, 
+		   planes, count);
+    }
+    done += n;
+    return true;
+  };
+
+  bool ok = _i->create(dsfFile, [&](int out) {
+      bool readError = false;
+      if (!writeAll(out, &v[0], v.size()) || !pump(produce, out, readError)) {
+	if (readError)
+	  err << dffFile << ": error reading audio data." << std::endl;
+	else
+	  err << dsfFile << ": error writing file." << std::endl;
+	return false;
+      }
+      if (!copyRange(in, tagOffset, tagSize, out)) {
+	err << dsfFile << ": error copying the ID3v2 tag." << std::endl;
+	return false;
+      }
+      return true;
+    }, err);
+
+  close(in);
+  _i->_elapsedSeconds = std::chrono::duration<double>
+    (std::chrono::steady_clock::now() - start).count();
+  return ok;
+}
+
+uint64_t DSDIFFConverter::bytesWritten() const
+{
+  return _i->_bytesWritten;
+}
+
+double DSDIFFConverter::elapsedSeconds() const
+{
+  return _i->_elapsedSeconds;
+}
+
+const char *DSDIFFConverter::kernel()
+{
+  return kernels().name;
+}
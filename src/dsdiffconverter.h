@@ -0,0 +1,73 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _DSDIFFCONVERTER_H_
+#define _DSDIFFCONVERTER_H_
+
+#include <stdint.h>
+#include <ostream>
+
+//
+// Converts DSF files to DSDIFF (DFF) files and back, without changing
+// a bit of the audio (--to-dff, --to-dsf).
+//
+// DSF stores each channel in blocks of 4096 bytes, LSB first; DSDIFF
+// interleaves channels byte by byte, MSB first. Bits are reversed and
+// channels transposed by AVX2 or NEON kernels where the CPU has them.
+// Audio is converted on one thread and written on another, through a
+// few buffers of fixed size, so memory use doesn't depend on the
+// length of the file. The ID3v2 tag is carried over as is, between the
+// end of a DSF file and the ID3 chunk DSDIFF players read, copied with
+// copy_file_range() where the kernel can.
+//
+// Only uncompressed DSDIFF files (not DST) with the channel layouts of
+// DSF can be converted. Other DSDIFF chunks (comments, markers, the
+// DIIN chunk) are not carried over. DSDIFF counts samples in whole
+// bytes, so the padding of the last byte of a DSF file becomes audio.
+//
+class DSDIFFConverter {
+ public:
+  DSDIFFConverter();
+  ~DSDIFFConverter();
+
+  // Convert dsfFile into a new DSDIFF file dffFile
+  bool toDSDIFF(const char *dsfFile, const char *dffFile, std::ostream &err);
+
+  // Convert dffFile into a new DSF file dsfFile
+  bool toDSF(const char *dffFile, const char *dsfFile, std::ostream &err);
+
+  // About the last conversion: bytes written, and seconds it took
+  uint64_t bytesWritten() const;
+  double elapsedSeconds() const;
+
+  // Name of the instruction set of the kernels: "AVX2", "NEON" or
+  // "scalar"
+  static const char *kernel();
+
+ private:
+  DSDIFFConverter(const DSDIFFConverter &);
+  DSDIFFConverter &operator=(const DSDIFFConverter &);
+
+  class DSDIFFConverterImpl;
+  DSDIFFConverterImpl *_i;
+};
+
+#endif
@@ -0,0 +1,260 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "dsfdatareader.h"
+#include "batch.h"
+
+class DSFDataReader::ReaderPrivate
+{
+public:
+  ReaderPrivate(const char *file) :
+    name(file),
+    header(0),
+    isValid(false),
+    fd(-1),
+    bufferFirst(0),
+    bufferGroups(0),
+    dataOffset(0),
+    dataSize(0),
+    groups(0),
+    group(-1),
+    samplesPerBlock(0),
+    current(0)
+  {}
+
+  ~ReaderPrivate()
+  {
+    if (fd >= 0)
+      close(fd);
+    if (header)
+      delete header;
+  }
+
+  // Validate the data chunk header that follows the fmt chunk
+  bool checkDataChunk(uint64_t fileLength);
+
+  // Groups of blocks read at once
+  static const unsigned int GROUPS_PER_READ = 32;
+
+  std::string name;
+  DSFHeader *header;
+  bool isValid;
+  int fd;
+  std::vector<unsigned char> buffer; // GROUPS_PER_READ groups of blocks
+  int64_t bufferFirst;     // first group in buffer
+  int64_t bufferGroups;    // number of groups in buffer
+  uint64_t dataOffset;     // first block
+  uint64_t dataSize;       // all blocks
+  uint64_t groups;         // groups of blocks that hold samples
+  int64_t group;           // current group, -1 before the first
+  unsigned int samplesPerBlock;
+  const unsigned char *current; // current group
+};
+
+bool DSFDataReader::ReaderPrivate::checkDataChunk(uint64_t fileLength)
+{
+  const uint64_t offset = DSFHeader::DSD_HEADER_SIZE + 
+    DSFHeader::FMT_HEADER_SIZE;
+  unsigned char h[DSFHeader::DATA_HEADER_SIZE];
+  if (pread(fd, h, sizeof(h), offset) != sizeof(h))
+    return false;
+
+  if (h[0] != 'd' || h[1] != 'a' || h[2] != 't' || h[3] != 'a') {
+    BatchProcessor::err() << name << ": data chunk not found" << std::endl;
+    return false;
+  }
+  uint64_t chunkSize = 0;
+  for (int i = 7; i >= 0; i--)
+    chunkSize = (chunkSize << 8) | h[4 + i];
+
+  unsigned int channels = header->channelNum();
+  uint64_t groupSize = static_cast<uint64_t>(BLOCK_SIZE) * channels;
+  uint64_t size = chunkSize - DSFHeader::DATA_HEADER_SIZE;
+  if (chunkSize < DSFHeader::DATA_HEADER_SIZE || channels == 0 ||
+      size % groupSize != 0 || 
+      offset + chunkSize > fileLength) {
+    BatchProcessor::err() << name << ": data chunk size is incorrect" 
+			  << std::endl;
+    return false;
+  }
+
+  samplesPerBlock = BLOCK_SIZE * 8 / header->bitsPerSample();
+  uint64_t needed = (header->sampleCount() + samplesPerBlock - 1) / 
+    samplesPerBlock;
+  if (needed > size / groupSize) {
+    BatchProcessor::err() << name 
+			  << ": data chunk is shorter than the sample count"
+			  << std::endl;
+    return false;
+  }
+
+  dataOffset = offset + DSFHeader::DATA_HEADER_SIZE;
+  dataSize = size;
+  groups = needed;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public members
+////////////////////////////////////////////////////////////////////////////////
+
+DSFDataReader::DSFDataReader(const char *file)
+{
+  d = new ReaderPrivate(file);
+
+  d->fd = open(file, O_RDONLY);
+  if (d->fd < 0)
+    return;
+
+  TagLib::ByteVector v(DSFHeader::DSD_HEADER_SIZE + 
+		       DSFHeader::FMT_HEADER_SIZE, 0);
+  struct stat st;
+  if (fstat(d->fd, &st) != 0 || 
+      pread(d->fd, v.data(), v.size(), 0) != static_cast<ssize_t>(v.size()))
+    return;
+
+  d->header = new DSFHeader(v);
+  if (!d->header->isValid() || !d->checkDataChunk(st.st_size))
+    return;
+
+  // Not memory mapped: a file truncated while it's read would raise
+  // SIGBUS, which kills the whole process and not just this reader
+  d->buffer.resize(ReaderPrivate::GROUPS_PER_READ * BLOCK_SIZE * 
+		   d->header->channelNum());
+  posix_fadvise(d->fd, d->dataOffset, d->dataSize, POSIX_FADV_SEQUENTIAL);
+  d->isValid = true;
+}
+
+DSFDataReader::~DSFDataReader()
+{
+  delete d;
+}
+
+bool DSFDataReader::isValid() const
+{
+  return d->isValid;
+}
+
+const DSFHeader &DSFDataReader::header() const
+{
+  return *d->header;
+}
+
+uint64_t DSFDataReader::dataOffset() const
+{
+  return d->dataOffset;
+}
+
+uint64_t DSFDataReader::dataSize() const
+{
+  return d->dataSize;
+}
+
+bool DSFDataReader::next()
+{
+  if (!d->isValid || d->group + 1 >= static_cast<int64_t>(d->groups))
+    return false;
+
+  d->group++;
+  size_t groupSize = BLOCK_SIZE * d->header->channelNum();
+
+  if (d->group < d->bufferFirst || 
+      d->group >= d->bufferFirst + d->bufferGroups) {
+    int64_t count = d->groups - d->group;
+    if (count > ReaderPrivate::GROUPS_PER_READ)
+      count = ReaderPrivate::GROUPS_PER_READ;
+    uint64_t offset = d->dataOffset + d->group * groupSize;
+    size_t size = count * groupSize;
+
+    size_t n = 0;
+    while (n < size) {
+      ssize_t r = pread(d->fd, &d->buffer[n], size - n, offset + n);
+      if (r <= 0) {
+	d->group = d->groups; // don't go on after a read error
+	d->bufferGroups = 0;
+	return false;
+      }
+      n += r;
+    }
+    d->bufferFirst = d->group;
+    d->bufferGroups = count;
+  }
+  d->current = &d->buffer[(d->group - d->bufferFirst) * groupSize];
+  return true;
+}
+
+DSFDataReader::Span DSFDataReader::channel(unsigned int ch) const
+{
+  Span s = { 0, 0 };
+  if (d->group < 0 || ch >= d->header->channelNum())
+    return s;
+
+  s.data = d->current + ch * BLOCK_SIZE;
+  s.size = BLOCK_SIZE;
+  return s;
+}
+
+unsigned int DSFDataReader::samples() const
+{
+  if (d->group < 0)
+    return 0;
+
+  uint64_t left = d->header->sampleCount() - position();
+  return left < d->samplesPerBlock ? left : d->samplesPerBlock;
+}
+
+uint64_t DSFDataReader::position() const
+{
+  return d->group < 0 ? 0 : d->group * d->samplesPerBlock;
+}
+
+void DSFDataReader::rewind()
+{
+  d->group = -1;
+  d->current = 0;
+}
+
+void DSFDataReader::reverseBits(unsigned char *data, size_t size)
+{
+  struct Table {
+    Table() {
+      for (int i = 0; i < 256; i++) {
+	unsigned char r = 0;
+	for (int b = 0; b < 8; b++)
+	  if (i & (1 << b))
+	    r |= 0x80 >> b;
+	reversed[i] = r;
+      }
+    }
+    unsigned char reversed[256];
+  };
+  static const Table table;
+
+  for (size_t i = 0; i < size; i++)
+    data[i] = table.reversed[data[i]];
+}
@@ -0,0 +1,130 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_DSFDATAREADER_H
+#define TAGLIB_DSFDATAREADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dsfheader.h"
+
+//! Sequential access to the audio data of a DSF file
+
+/*!
+ * The data chunk stores the channels block interleaved: 4096 bytes of
+ * channel 0, 4096 bytes of channel 1 and so on, then the next block of
+ * every channel. Each call to next() moves to the next group of blocks
+ * and channel() returns the block of one channel, so callers see planar
+ * data without anything being copied: the spans point into a buffer
+ * that is filled by one read of several groups at a time.
+ *
+ * With 1 bit per sample, samples are packed LSB first: sample n of a
+ * block is bit (n % 8) of byte n / 8. The last block of a channel is
+ * zero padded; samples() tells how much of it is audio.
+ */
+
+class DSFDataReader
+{
+ public:
+  static const unsigned int BLOCK_SIZE = 4096; // bytes per channel
+
+  //! A block of one channel
+  struct Span {
+    const unsigned char *data;
+    size_t size;
+  };
+
+  /*!
+   * Opens \a file and checks the DSD, fmt and data chunk headers.
+   */
+  DSFDataReader(const char *file);
+
+  /*!
+   * Destroys this instance.
+   */
+  ~DSFDataReader();
+
+  /*!
+   * Returns true if the headers are valid and the data chunk is complete.
+   */
+  bool isValid() const;
+
+  /*!
+   * Returns the DSD and fmt chunks. Must only be called if isValid()
+   * is true.
+   */
+  const DSFHeader &header() const;
+
+  /*!
+   * Returns the offset of the audio data in the file, right after the
+   * data chunk header.
+   */
+  uint64_t dataOffset() const;
+
+  /*!
+   * Returns the size of the audio data, padding included, i.e. up to
+   * the ID3v2 tag if there is one.
+   */
+  uint64_t dataSize() const;
+
+  /*!
+   * Moves to the next group of blocks. Returns false at the end of the
+   * data or on a read error.
+   */
+  bool next();
+
+  /*!
+   * Returns the current block of channel \a ch, valid until the next
+   * call to next() or rewind().
+   */
+  Span channel(unsigned int ch) const;
+
+  /*!
+   * Returns the number of samples per channel in the current block.
+   */
+  unsigned int samples() const;
+
+  /*!
+   * Returns the index of the first sample of the current block.
+   */
+  uint64_t position() const;
+
+  /*!
+   * Goes back to before the first block.
+   */
+  void rewind();
+
+  /*!
+   * Reverses the bit order of \a size bytes at \a data, e.g. to turn LSB
+   * first 1-bit samples into the MSB first order DSDIFF uses.
+   */
+  static void reverseBits(unsigned char *data, size_t size);
+
+ private:
+  DSFDataReader(const DSFDataReader &);
+  DSFDataReader &operator=(const DSFDataReader &);
+
+  class ReaderPrivate;
+  ReaderPrivate *d;
+};
+
+#endif
@@ -23,12 +23,24 @@
 
 #include <taglib/id3v2tag.h>
 #include <taglib/id3v2header.h>
+#include <taglib/id3v2frame.h>
+#include <taglib/id3v2framefactory.h>
 #include <taglib/tpropertymap.h>
 
 #include <bitset>
+#include <algorithm>
+#include <list>
+#include <set>
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "dsffile.h"
 #include "dsfheader.h"
+#include "sharedframes.h"
+#include "batch.h"
 
 //using namespace TagLib;
 
@@ -43,6 +55,10 @@ public:
     fileSize(0),
     tag(0),
     hasID3v2(false),
+    written(false),
+    bytesWritten(0),
+    safeSave(false),
+    durability(DSFFile::NoSync),
     properties(0)
   {}
 
@@ -64,8 +80,56 @@ public:
 
   bool hasID3v2;
 
+  bool written; // whether the last save() wrote anything
+  uint64_t bytesWritten; // by the last save()
+  bool safeSave;
+  DSFFile::Durability durability;
+
   DSFProperties *properties;
 
+  // A frame of the tag on disk. Once parsed it's in tag as well, and
+  // the entry only keeps its place among the frames that aren't.
+  struct RawFrame {
+    TagLib::ByteVector id;
+    uint64_t offset;   // position in the file
+    unsigned int size; // frame header included
+    TagLib::ID3v2::Frame *frame; // 0 until parsed
+    uint64_t position; // in the tag being saved, see renderTag()
+  };
+
+  // In disk order, empty once every frame has been parsed. The frames
+  // of tag are kept in the same order, followed by those that were
+  // added since the file was read.
+  std::list<RawFrame> rawFrames;
+
+  //
+  // Parse the raw frames with ID frameID (all of them if frameID is
+  // empty) and put them into tag, in disk order ahead of the frames
+  // that were added.
+  //
+  void materialize(TagLib::File *file, const TagLib::ByteVector &frameID);
+
+  // Drop the entry of frame. Returns false if it has none.
+  bool forget(const TagLib::ID3v2::Frame *frame);
+
+  // Drop the entries once they are all parsed, tag has every frame in
+  // order then
+  void dropParsed();
+
+  // Raw frames moved to the places renderTag() gave them
+  void relocateRawFrames();
+
+  // Bytes of frame f as it goes into the tag, empty if it's left out
+  TagLib::ByteVector renderFrame(const TagLib::ID3v2::Frame *f, 
+				 int version,
+				 const PrerenderedFrames *prerendered) const;
+
+  static void appendData(TagPieces &pieces, const TagLib::ByteVector &data);
+  static void appendCopy(TagPieces &pieces, uint64_t source, uint64_t size);
+
+  // Size of the tag made of pieces
+  static uint64_t sizeOf(const TagPieces &pieces);
+
   static inline TagLib::ByteVector& uint64ToVector(uint64_t num, 
 						   TagLib::ByteVector &v) 
   {
@@ -89,6 +153,17 @@ public:
   // the old ID3v2::Tag object with a new one to free up that space.
   //
   void shrinkTag();
+
+  //
+  // Same as tag->render(version), except that the bytes of the frames
+  // in prerendered are copied instead of rendering those frames again.
+  // Raw frames are left where they are, to be copied from the file.
+  //
+  TagPieces renderTag(TagLib::File *file, int version, 
+		      const PrerenderedFrames *prerendered);
+
+  // Same as TagLib
+  static const unsigned int PADDING_SIZE = 1024;
 };
 
 void DSFFile::FilePrivate::shrinkTag() {
@@ -111,6 +186,209 @@ void DSFFile::FilePrivate::shrinkTag() {
 }
 
 
+void DSFFile::FilePrivate::materialize(TagLib::File *file,
+				       const TagLib::ByteVector &frameID)
+{
+  bool parsed = false;
+  std::list<RawFrame>::iterator it = rawFrames.begin();
+
+  while (it != rawFrames.end()) {
+    if (it->frame || (!frameID.isEmpty() && it->id != frameID)) {
+      it++;
+      continue;
+    }
+
+    file->seek(it->offset);
+    it->frame = ID3v2FrameFactory->createFrame(file->readBlock(it->size), 
+					       tag->header());
+    if (!it->frame) {
+      it = rawFrames.erase(it);
+      continue;
+    }
+    parsed = true;
+    it++;
+  }
+
+  if (!parsed) {
+    dropParsed();
+    return;
+  }
+
+  // Put the frames back in order
+  std::set<const TagLib::ID3v2::Frame *> fromDisk;
+  TagLib::ID3v2::FrameList l = tag->frameList();
+  TagLib::ID3v2::FrameList::ConstIterator f;
+
+  for (f = l.begin(); f != l.end(); f++)
+    tag->removeFrame(*f, false);
+  for (it = rawFrames.begin(); it != rawFrames.end(); it++) {
+    if (it->frame) {
+      tag->addFrame(it->frame);
+      fromDisk.insert(it->frame);
+    }
+  }
+  for (f = l.begin(); f != l.end(); f++)
+    if (fromDisk.find(*f) == fromDisk.end())
+      tag->addFrame(*f);
+
+  dropParsed();
+}
+
+bool DSFFile::FilePrivate::forget(const TagLib::ID3v2::Frame *frame)
+{
+  std::list<RawFrame>::iterator it;
+  for (it = rawFrames.begin(); it != rawFrames.end(); it++) {
+    if (it->frame == frame) {
+      rawFrames.erase(it);
+      dropParsed();
+      return true;
+    }
+  }
+  return false;
+}
+
+void DSFFile::FilePrivate::dropParsed()
+{
+  std::list<RawFrame>::const_iterator it;
+  for (it = rawFrames.begin(); it != rawFrames.end(); it++)
+    if (!it->frame)
+      return;
+  rawFrames.clear();
+}
+
+void DSFFile::FilePrivate::relocateRawFrames()
+{
+  std::list<RawFrame>::iterator it;
+  for (it = rawFrames.begin(); it != rawFrames.end(); it++)
+    it->offset = ID3v2Location + it->position;
+}
+
+TagLib::ByteVector 
+DSFFile::FilePrivate::renderFrame(const TagLib::ID3v2::Frame *f, int version,
+				  const PrerenderedFrames *prerendered) const
+{
+  if (prerendered) {
+    PrerenderedFrames::const_iterator p = prerendered->find(f);
+    if (p != prerendered->end())
+      return p->second;
+  }
+
+  // Same rules as ID3v2::Tag::render()
+  f->header()->setVersion(version);
+  if (f->header()->frameID().size() != 4 ||
+      f->header()->tagAlterPreservation())
+    return TagLib::ByteVector();
+
+  TagLib::ByteVector data = f->render();
+  if (data.size() <= TagLib::ID3v2::Frame::headerSize(version))
+    return TagLib::ByteVector();
+  return data;
+}
+
+void DSFFile::FilePrivate::appendData(TagPieces &pieces, 
+				      const TagLib::ByteVector &data)
+{
+  if (data.isEmpty())
+    return;
+  if (pieces.empty() || pieces.back().data.isEmpty())
+    pieces.push_back(TagPiece());
+  pieces.back().data.append(data);
+  pieces.back().size = pieces.back().data.size();
+}
+
+void DSFFile::FilePrivate::appendCopy(TagPieces &pieces, uint64_t source,
+				      uint64_t size)
+{
+  // Adjacent frames are copied in one go
+  if (!pieces.empty() && pieces.back().data.isEmpty() &&
+      pieces.back().source + pieces.back().size == source) {
+    pieces.back().size += size;
+    return;
+  }
+  TagPiece p;
+  p.source = source;
+  p.size = size;
+  pieces.push_back(p);
+}
+
+uint64_t DSFFile::FilePrivate::sizeOf(const TagPieces &pieces)
+{
+  uint64_t size = 0;
+  TagPieces::const_iterator it;
+  for (it = pieces.begin(); it != pieces.end(); it++)
+    size += it->size;
+  return size;
+}
+
+DSFFile::TagPieces
+DSFFile::FilePrivate::renderTag(TagLib::File *file, int version, 
+				const PrerenderedFrames *prerendered)
+{
+  TagPieces pieces;
+
+  // Raw frames are version 4, anything else means parsing them
+  if (version != 4)
+    materialize(file, TagLib::ByteVector());
+
+  TagLib::ID3v2::FrameList l = tag->frameList();
+  TagLib::ID3v2::FrameList::ConstIterator f;
+  bool convert = false;
+  for (f = l.begin(); f != l.end() && version == 3; f++)
+    if (!SharedFrames::isID3v23Frame((*f)->frameID()) &&
+	!(prerendered && prerendered->count(*f)))
+      convert = true;
+
+  // TagLib has to convert some frames to version 3, let it render the
+  // whole tag then
+  if (convert || 
+      (rawFrames.empty() && (!prerendered || prerendered->empty()))) {
+    appendData(pieces, tag->render(version));
+    return pieces;
+  }
+
+  // The header goes first, once the size is known
+  pieces.push_back(TagPiece());
+  uint64_t size = TagLib::ID3v2::Header::size();
+  TagLib::ByteVector data;
+
+  // Frames from disk in their order, parsed or not, then the others
+  std::set<const TagLib::ID3v2::Frame *> fromDisk;
+  std::list<RawFrame>::iterator it;
+  for (it = rawFrames.begin(); it != rawFrames.end(); it++) {
+    if (!it->frame) {
+      it->position = size;
+      appendCopy(pieces, it->offset, it->size);
+      size += it->size;
+      continue;
+    }
+    fromDisk.insert(it->frame);
+    data = renderFrame(it->frame, version, prerendered);
+    appendData(pieces, data);
+    size += data.size();
+  }
+
+  for (f = l.begin(); f != l.end(); f++) {
+    if (fromDisk.find(*f) != fromDisk.end())
+      continue;
+    data = renderFrame(*f, version, prerendered);
+    appendData(pieces, data);
+    size += data.size();
+  }
+
+  uint64_t frameSize = size - TagLib::ID3v2::Header::size();
+  unsigned int originalSize = tag->header()->tagSize();
+  unsigned int paddingSize = PADDING_SIZE;
+  if (frameSize < originalSize)
+    paddingSize = originalSize - frameSize;
+  appendData(pieces, TagLib::ByteVector(paddingSize, 0));
+
+  tag->header()->setMajorVersion(version);
+  tag->header()->setTagSize(frameSize + paddingSize);
+  pieces[0].data = tag->header()->render();
+  pieces[0].size = pieces[0].data.size();
+  return pieces;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // public members
 ////////////////////////////////////////////////////////////////////////////////
@@ -156,25 +434,25 @@ DSFFile::~DSFFile()
 
 TagLib::Tag *DSFFile::tag() const
 {
-  return d->tag;
+  return ID3v2Tag();
 }
 
 TagLib::PropertyMap DSFFile::properties() const
 {
   if(d->hasID3v2)
-    return d->tag->properties();
+    return ID3v2Tag()->properties();
   return TagLib::PropertyMap();
 }
 
 void DSFFile::removeUnsupportedProperties(const TagLib::StringList &properties)
 {
   if(d->hasID3v2)
-    d->tag->removeUnsupportedProperties(properties);
+    ID3v2Tag()->removeUnsupportedProperties(properties);
 }
 
 TagLib::PropertyMap DSFFile::setProperties(const TagLib::PropertyMap &properties)
 {
-  return d->tag->setProperties(properties);
+  return ID3v2Tag()->setProperties(properties);
 }
 
 TagLib::AudioProperties *DSFFile::audioProperties() const
@@ -188,55 +466,68 @@ bool DSFFile::save()
 }
 
 bool DSFFile::save(int id3v2Version, bool shrink)
+{
+  return save(id3v2Version, shrink, 0);
+}
+
+bool DSFFile::save(int id3v2Version, bool shrink,
+		   const PrerenderedFrames *prerendered)
 {
   if(readOnly()) {
-    std::cerr << "DSFFile::save() -- File is read only." << std::endl;
+    BatchProcessor::err() << "DSFFile::save() -- File is read only." << std::endl;
     return false;
   }
 
   bool success = true;
+  d->written = false;
+  d->bytesWritten = 0;
 
-  if(ID3v2Tag() && !ID3v2Tag()->isEmpty()) {
+  if(!isTagEmpty()) {
     if (shrink) // remove padding 0's
       d->shrinkTag();
 
-    TagLib::ByteVector id3v2_v = ID3v2Tag()->render(id3v2Version);
-    uint64_t fileSize = d->fileSize + id3v2_v.size() - d->ID3v2OriginalSize;
-    TagLib::ByteVector fileSize_v;
+    TagPieces tag = d->renderTag(this, id3v2Version, prerendered);
+    uint64_t tagSize = FilePrivate::sizeOf(tag);
 
-    // Write new file size to DSD header 
-    DSFFile::FilePrivate::uint64ToVector(fileSize, fileSize_v);
-    insert(fileSize_v, 12, DSFHeader::LONG_INT_SIZE);
+    // Nothing would change, leave the file alone
+    if (d->ID3v2Location > 0 && isTagOnDisk(tag))
+      return success;
 
-    // The file didn't have an ID3v2 metadata block
-    // Make the offset point to the end of file
-    if (d->ID3v2Location == 0) {
+    // The file didn't have an ID3v2 metadata block, append one
+    if (d->ID3v2Location == 0)
       d->ID3v2Location = d->fileSize;
 
-      TagLib::ByteVector offset_v;
-      DSFFile::FilePrivate::uint64ToVector(d->fileSize, offset_v);
-      insert(offset_v, 20, DSFHeader::LONG_INT_SIZE);
-    }
-
-    // Write ID3v2 to the end of the file
-    insert(id3v2_v, d->ID3v2Location, d->ID3v2OriginalSize);
+    if (d->safeSave) {
+      // Also closes any gap left by an interrupted save
+      uint64_t dataEnd = dataChunkEnd();
+      if (dataEnd > 0 && dataEnd <= d->ID3v2Location)
+	d->ID3v2Location = dataEnd;
+      if (!safeWriteTail(d->ID3v2Location, tag))
+	return false;
+    } else if (!writeTail(d->ID3v2Location, tag))
+      return false;
+    d->relocateRawFrames();
     
     // Reset header info
-    d->fileSize = fileSize;
-    d->ID3v2OriginalSize = id3v2_v.size();
+    d->fileSize = d->ID3v2Location + tagSize;
+    d->ID3v2OriginalSize = tagSize;
     d->hasID3v2 = true;
   } else {
+    // No tag in the file either
+    if (d->ID3v2Location == 0)
+      return success;
+
     //
     // All frames have been deleted. Remove ID3v2 block
     //
-
-    TagLib::ByteVector nulls_v(DSFHeader::LONG_INT_SIZE, 0);
-    TagLib::ByteVector fileSize_v;
-
-    DSFFile::FilePrivate::uint64ToVector(d->ID3v2Location, fileSize_v);
-    insert(fileSize_v, 12, DSFHeader::LONG_INT_SIZE); // new file size
-    insert(nulls_v, 20, DSFHeader::LONG_INT_SIZE); // set metadata offset to 0
-    removeBlock(d->ID3v2Location, d->ID3v2OriginalSize);
+    if (d->safeSave) {
+      uint64_t dataEnd = dataChunkEnd();
+      if (dataEnd > 0 && dataEnd <= d->ID3v2Location)
+	d->ID3v2Location = dataEnd;
+      if (!safeWriteTail(d->ID3v2Location, TagPieces()))
+	return false;
+    } else if (!writeTail(d->ID3v2Location, TagPieces()))
+      return false;
 
     // Reset header info
     d->ID3v2OriginalSize = 0;
@@ -245,6 +536,11 @@ bool DSFFile::save(int id3v2Version, bool shrink)
     d->hasID3v2 = false;
   }
 
+  d->written = true;
+
+  if (d->durability == SyncFile && !d->safeSave)
+    success = sync();
+
   // Reinitialize properties because DSD header may have been changed
   delete d->properties;
   d->properties = new DSFProperties(this, 
@@ -255,9 +551,66 @@ bool DSFFile::save(int id3v2Version, bool shrink)
 
 TagLib::ID3v2::Tag *DSFFile::ID3v2Tag() const
 {
+  d->materialize(const_cast<DSFFile *>(this), TagLib::ByteVector());
   return d->tag;
 }
 
+TagLib::ID3v2::FrameList 
+DSFFile::frameList(const TagLib::ByteVector &frameID) const
+{
+  d->materialize(const_cast<DSFFile *>(this), frameID);
+  if (frameID.isEmpty())
+    return d->tag->frameList();
+  return d->tag->frameList(frameID);
+}
+
+void DSFFile::addFrame(TagLib::ID3v2::Frame *frame)
+{
+  d->tag->addFrame(frame);
+}
+
+void DSFFile::removeFrame(TagLib::ID3v2::Frame *frame)
+{
+  d->forget(frame);
+  d->tag->removeFrame(frame);
+}
+
+unsigned int DSFFile::removeFrames(const TagLib::ByteVector &frameID)
+{
+  unsigned int n = 0;
+  std::list<FilePrivate::RawFrame>::iterator it = d->rawFrames.begin();
+
+  // Parsed ones are counted below
+  while (it != d->rawFrames.end()) {
+    if (frameID.isEmpty() || it->id == frameID) {
+      if (!it->frame)
+	n++;
+      it = d->rawFrames.erase(it);
+    } else
+      it++;
+  }
+  d->dropParsed();
+
+  // Copy, the tag's list changes as frames are removed
+  TagLib::ID3v2::FrameList l = frameID.isEmpty() ? 
+    d->tag->frameList() : d->tag->frameList(frameID);
+  TagLib::ID3v2::FrameList::ConstIterator f;
+  for (f = l.begin(); f != l.end(); f++)
+    d->tag->removeFrame(*f);
+
+  return n + l.size();
+}
+
+bool DSFFile::isTagEmpty() const
+{
+  return d->rawFrames.empty() && d->tag->frameList().isEmpty();
+}
+
+TagLib::ID3v2::Header *DSFFile::ID3v2Header() const
+{
+  return d->tag->header();
+}
+
 void DSFFile::setID3v2FrameFactory(const TagLib::ID3v2::FrameFactory *factory)
 {
   d->ID3v2FrameFactory = factory;
@@ -268,6 +621,26 @@ bool DSFFile::hasID3v2Tag() const
   return d->hasID3v2;
 }
 
+bool DSFFile::lastSaveWritten() const
+{
+  return d->written;
+}
+
+uint64_t DSFFile::lastSaveBytesWritten() const
+{
+  return d->bytesWritten;
+}
+
+void DSFFile::setSafeSave(bool safe)
+{
+  d->safeSave = safe;
+}
+
+void DSFFile::setDurability(Durability durability)
+{
+  d->durability = durability;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // private members
 ////////////////////////////////////////////////////////////////////////////////
@@ -280,6 +653,259 @@ bool DSFFile::secondSynchByte(char byte)
   return b.test(7) && b.test(6) && b.test(5);
 }
 
+bool DSFFile::isTagOnDisk(const TagPieces &tag)
+{
+  if (FilePrivate::sizeOf(tag) != d->ID3v2OriginalSize)
+    return false;
+
+  uint64_t offset = d->ID3v2Location;
+  TagPieces::const_iterator it;
+  for (it = tag.begin(); it != tag.end(); offset += it->size, it++) {
+    // Frames copied from the file must stay where they are
+    if (it->data.isEmpty()) {
+      if (it->source != offset)
+	return false;
+      continue;
+    }
+
+    // Compare chunk by chunk, the tag may hold large pictures
+    const unsigned long chunkSize = 65536;
+    seek(offset);
+    for (unsigned long pos = 0; pos < it->data.size(); pos += chunkSize) {
+      unsigned long n = std::min(chunkSize, it->data.size() - pos);
+      TagLib::ByteVector v = readBlock(n);
+      if (v.size() != n || memcmp(v.data(), it->data.data() + pos, n) != 0)
+	return false;
+    }
+  }
+  return true;
+}
+
+bool DSFFile::writeTail(uint64_t location, const TagPieces &tag)
+{
+  uint64_t end = location + FilePrivate::sizeOf(tag);
+
+  // The ID3v2 chunk is always the last one, nothing after it has to move
+  if (!tag.empty() && !writePieces(location, tag))
+    return false;
+
+  if (!writeHeader(end, tag.empty() ? 0 : location))
+    return false;
+
+  if (end < static_cast<uint64_t>(length()))
+    return truncateTo(end);
+  return true;
+}
+
+bool DSFFile::safeWriteTail(uint64_t location, const TagPieces &tag)
+{
+  uint64_t size = FilePrivate::sizeOf(tag);
+  uint64_t end = location + size;
+
+  if (!tag.empty()) {
+    // Writing over the tag the header points to isn't safe. Put a copy
+    // after everything in use first, where it doesn't overlap with its
+    // final place either, and point the header there. The final tag
+    // is then copied from there.
+    TagPieces copy(tag);
+    if (location < d->fileSize) {
+      uint64_t tmp = std::max(static_cast<uint64_t>(length()), 
+			      std::max(d->fileSize, end));
+      if (!writePieces(tmp, tag) || !sync())
+	return false;
+      if (!writeHeader(tmp + size, tmp) || !sync())
+	return false;
+      copy.assign(1, TagPiece());
+      copy[0].source = tmp;
+      copy[0].size = size;
+    }
+
+    if (!writePieces(location, copy) || !sync())
+      return false;
+  }
+
+  if (!writeHeader(end, tag.empty() ? 0 : location) || !sync())
+    return false;
+
+  // Whatever is left past the end is garbage now
+  if (end < static_cast<uint64_t>(length()))
+    return truncateTo(end) && sync();
+  return true;
+}
+
+bool DSFFile::writePieces(uint64_t location, const TagPieces &tag)
+{
+  std::vector<uint64_t> dest(tag.size());
+  uint64_t pos = location;
+  uint64_t sourceEnd = 0;
+  for (size_t i = 0; i < tag.size(); i++) {
+    dest[i] = pos;
+    pos += tag[i].size;
+
+    // The copies below only work if the blocks keep their order, which
+    // renderTag() guarantees by walking the raw frames in disk order
+    if (tag[i].data.isEmpty()) {
+      if (tag[i].source < sourceEnd) {
+	BatchProcessor::err() << name() 
+			      << ": frames to copy are out of order" 
+			      << std::endl;
+	return false;
+      }
+      sourceEnd = tag[i].source + tag[i].size;
+    }
+  }
+
+  // Copies may overlap with where they come from and with each other,
+  // like memmove(): those moving down go first, front to back, then
+  // those moving up, back to front. The bytes in memory go last, when
+  // nothing has to be read any more.
+  for (size_t i = 0; i < tag.size(); i++)
+    if (tag[i].data.isEmpty() && dest[i] < tag[i].source &&
+	!copyBlock(tag[i].source, dest[i], tag[i].size))
+      return false;
+  for (size_t i = tag.size(); i-- > 0; )
+    if (tag[i].data.isEmpty() && dest[i] > tag[i].source &&
+	!copyBlock(tag[i].source, dest[i], tag[i].size))
+      return false;
+  for (size_t i = 0; i < tag.size(); i++)
+    if (!tag[i].data.isEmpty() && !writeAt(dest[i], tag[i].data))
+      return false;
+  return true;
+}
+
+bool DSFFile::copyBlock(uint64_t from, uint64_t to, uint64_t size)
+{
+  // A chunk at a time, from the end if the block moves up, so that
+  // nothing is overwritten before it's read
+  const uint64_t chunkSize = 65536;
+  for (uint64_t done = 0; done < size; ) {
+    uint64_t n = std::min(chunkSize, size - done);
+    uint64_t pos = to > from ? size - done - n : done;
+    seek(from + pos);
+    TagLib::ByteVector v = readBlock(n);
+    if (v.size() != n || !writeAt(to + pos, v))
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+bool DSFFile::writeHeader(uint64_t fileSize, uint64_t ID3v2Offset)
+{
+  // File size (offset 12) and metadata pointer (offset 20) are adjacent
+  TagLib::ByteVector header, v;
+  header.append(FilePrivate::uint64ToVector(fileSize, v));
+  header.append(FilePrivate::uint64ToVector(ID3v2Offset, v));
+  return writeAt(12, header);
+}
+
+bool DSFFile::writeAt(uint64_t offset, const TagLib::ByteVector &data)
+{
+  seek(offset);
+  writeBlock(data);
+  if (static_cast<uint64_t>(tell()) != offset + data.size())
+    return false;
+  d->bytesWritten += data.size();
+  return true;
+}
+
+bool DSFFile::truncateTo(uint64_t length)
+{
+  // Neither does truncate() report errors, ask the file system
+  struct stat st;
+  truncate(length);
+  return stat(name(), &st) == 0 && 
+    static_cast<uint64_t>(st.st_size) == length;
+}
+
+bool DSFFile::sync()
+{
+  // Seeking flushes the stream's own buffers. The page cache is shared
+  // by all descriptors of the file, so syncing a new one is enough.
+  seek(0);
+  int fd = open(name(), O_RDONLY);
+  if (fd < 0 || fdatasync(fd) != 0) {
+    BatchProcessor::err() << name() << ": sync failed" << std::endl;
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+uint64_t DSFFile::dataChunkEnd()
+{
+  const uint64_t offset = DSFHeader::DSD_HEADER_SIZE + DSFHeader::FMT_HEADER_SIZE;
+
+  seek(offset);
+  TagLib::ByteVector v = readBlock(DSFHeader::DATA_HEADER_SIZE);
+  if (v.size() != DSFHeader::DATA_HEADER_SIZE || !v.startsWith("data"))
+    return 0;
+  return offset + v.toLongLong(4, false);
+}
+
+// Frame IDs are made of capital letters and digits only
+static bool isFrameID(const TagLib::ByteVector &id)
+{
+  if (id.size() != 4)
+    return false;
+  for (TagLib::ByteVector::ConstIterator it = id.begin(); it != id.end(); it++)
+    if (!((*it >= 'A' && *it <= 'Z') || (*it >= '0' && *it <= '9')))
+      return false;
+  return true;
+}
+
+bool DSFFile::indexTag()
+{
+  const unsigned int frameHeaderSize = TagLib::ID3v2::Frame::headerSize(4);
+
+  seek(d->ID3v2Location);
+  TagLib::ByteVector data = readBlock(TagLib::ID3v2::Header::size());
+  if (data.size() != TagLib::ID3v2::Header::size() ||
+      !data.startsWith(TagLib::ID3v2::Header::fileIdentifier()))
+    return false;
+
+  // Leave older versions and anything unusual to TagLib
+  TagLib::ID3v2::Header header(data);
+  if (header.majorVersion() != 4 || header.unsynchronisation() ||
+      header.extendedHeader() || header.footerPresent())
+    return false;
+
+  uint64_t pos = d->ID3v2Location + data.size();
+  uint64_t end = pos + header.tagSize();
+  if (end > static_cast<uint64_t>(length()))
+    return false;
+
+  std::list<FilePrivate::RawFrame> frames;
+  while (pos + frameHeaderSize <= end) {
+    seek(pos);
+    TagLib::ByteVector v = readBlock(frameHeaderSize);
+    if (v.size() != frameHeaderSize || v[0] == 0) // padding
+      break;
+
+    TagLib::ID3v2::Frame::Header h(v, 4);
+    if (h.frameSize() == 0) // TagLib stops there too
+      break;
+    if (!isFrameID(h.frameID()) || pos + frameHeaderSize + h.frameSize() > end)
+      return false;
+
+    FilePrivate::RawFrame f;
+    f.id = h.frameID();
+    f.offset = pos;
+    f.size = frameHeaderSize + h.frameSize();
+    f.frame = 0;
+    f.position = 0;
+    frames.push_back(f);
+    pos += f.size;
+  }
+
+  d->tag = new TagLib::ID3v2::Tag();
+  d->tag->header()->setData(data);
+  d->rawFrames.swap(frames);
+  return true;
+}
+
 void DSFFile::read(bool readProperties, 
 		   TagLib::AudioProperties::ReadStyle propertiesStyle)
 {
@@ -290,7 +916,9 @@ void DSFFile::read(bool readProperties,
   d->fileSize = d->properties->fileSize();
 
   if(d->ID3v2Location > 0) {
-    d->tag = new TagLib::ID3v2::Tag(this, d->ID3v2Location, d->ID3v2FrameFactory);
+    if (!indexTag())
+      d->tag = new TagLib::ID3v2::Tag(this, d->ID3v2Location, 
+				      d->ID3v2FrameFactory);
     d->ID3v2OriginalSize = d->tag->header()->completeTagSize();
 
     if(d->tag->header()->tagSize() > 0)
@@ -22,8 +22,14 @@
 #ifndef TAGLIB_DSFFILE_H
 #define TAGLIB_DSFFILE_H
 
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
 #include <taglib/tfile.h>
 #include <taglib/tag.h>
+#include <taglib/id3v2tag.h>
 
 #include "dsfproperties.h"
 
@@ -39,11 +45,30 @@
  * to the different ID3 tags.
  */
 
-namespace TagLib { namespace ID3v2 { class Tag; class FrameFactory; } }
+namespace TagLib { namespace ID3v2 { class Header; } }
+
+/*!
+ * Frames that have already been rendered, keyed by the frame objects in
+ * the tag. See DSFFile::save().
+ */
+typedef std::map<const TagLib::ID3v2::Frame *, TagLib::ByteVector> 
+  PrerenderedFrames;
 
 class DSFFile : public TagLib::File
 {
  public:
+  /*!
+   * When the changes made by save() reach the disk.
+   */
+  enum Durability {
+    //! Whenever the OS writes them back
+    NoSync,
+    //! Before save() returns
+    SyncFile,
+    //! Not synced by save(), the caller syncs many files at once
+    SyncGroup
+  };
+
   /*!
    * Constructs an DSF file from \a file.  If \a readProperties is true the
    * file's audio properties will also be read.
@@ -157,9 +182,69 @@ class DSFFile : public TagLib::File
    */
   virtual bool save(int id3v2Version, bool shrink = true);
 
+  /*!
+   * Same as above, but frames found in \a prerendered are not rendered
+   * again: their cached bytes are spliced into the tag as they are.
+   * They must have been rendered for \a id3v2Version.
+   *
+   * This is used when the same frames are added to many files.
+   */
+  bool save(int id3v2Version, bool shrink, 
+	    const PrerenderedFrames *prerendered);
+
+  /*!
+   * Returns the frames with ID \a frameID, or all frames if \a frameID
+   * is empty.
+   *
+   * Frames of an ID3v2.4 tag are only indexed when the file is opened.
+   * Their bodies are read and parsed the first time they are asked for,
+   * so this is much cheaper than ID3v2Tag() when only a few frames are
+   * needed.  The frames are owned by the tag.
+   *
+   * \note Only ID3v2.4 tags without unsynchronisation, an extended
+   * header or a footer are indexed.  Other tags, ID3v2.3 ones included,
+   * are parsed in full by TagLib when the file is opened.
+   *
+   * Frames are saved in the order they have in the file, whether they
+   * were parsed or not, followed by the ones that were added.  Frames
+   * that were never parsed are copied within the file on save.
+   */
+  TagLib::ID3v2::FrameList frameList(const TagLib::ByteVector &frameID 
+				     = TagLib::ByteVector()) const;
+
+  /*!
+   * Adds \a frame to the tag, which takes ownership of it.
+   */
+  void addFrame(TagLib::ID3v2::Frame *frame);
+
+  /*!
+   * Removes \a frame from the tag and deletes it.
+   */
+  void removeFrame(TagLib::ID3v2::Frame *frame);
+
+  /*!
+   * Removes all frames with ID \a frameID, or every frame if \a frameID
+   * is empty.  Frames that were never read are dropped without being
+   * parsed.  Returns the number of frames removed.
+   */
+  unsigned int removeFrames(const TagLib::ByteVector &frameID);
+
+  /*!
+   * Returns true if the tag has no frames, read or not.
+   */
+  bool isTagEmpty() const;
+
+  /*!
+   * Returns the header of the ID3v2 tag.  Unlike ID3v2Tag() this doesn't
+   * read any frame.
+   */
+  TagLib::ID3v2::Header *ID3v2Header() const;
+
   /*!
    * Returns a pointer to the ID3v2 tag of the file.
    *
+   * \note This reads and parses all frames that haven't been read yet.
+   *
    * If \a create is false (the default) this may return a null pointer
    * if there is no valid ID3v2 tag.  If \a create is true it will create
    * an ID3v2 tag if one does not exist and returns a valid pointer.
@@ -226,10 +311,53 @@ class DSFFile : public TagLib::File
    */
   bool hasID3v2Tag() const;
 
+  /*!
+   * Returns true if the last call to save() actually wrote to the file.
+   * save() does not touch the file if the rendered tag is identical to
+   * the one on disk.
+   */
+  bool lastSaveWritten() const;
+
+  /*!
+   * Returns the number of bytes the last call to save() wrote.
+   */
+  uint64_t lastSaveBytesWritten() const;
+
+  /*!
+   * If \a safe is true, save() never leaves the file in a state where
+   * the DSD header doesn't match its contents, even if it's interrupted
+   * by a crash or a power loss.  The new tag is first written past the
+   * end of the file and synced, then published with a single 16 byte
+   * write of the header, before it's moved to its final place the same
+   * way.  This costs one extra copy of the tag and a few syncs, the
+   * audio data is never copied.
+   */
+  void setSafeSave(bool safe);
+
+  /*!
+   * Sets when the changes made by save() reach the disk.  The default
+   * is NoSync.  A safe save syncs as it goes, see setSafeSave().
+   */
+  void setDurability(Durability durability);
+
  private:
   DSFFile(const DSFFile &);
   DSFFile &operator=(const DSFFile &);
 
+  /*!
+   * A part of a tag to be written: either bytes rendered in memory, or,
+   * if \a data is empty, \a size bytes copied from \a source in the file.
+   * Frames that were never parsed are copied, so they are never read
+   * into memory as a whole.
+   */
+  struct TagPiece {
+    TagPiece() : source(0), size(0) {}
+    TagLib::ByteVector data;
+    uint64_t source;
+    uint64_t size;
+  };
+  typedef std::vector<TagPiece> TagPieces;
+
   // Read the actual audio file for tags
   void read(bool readProperties, 
 	    TagLib::AudioProperties::ReadStyle propertiesStyle);
@@ -241,6 +369,74 @@ class DSFFile : public TagLib::File
    */
   static bool secondSynchByte(char byte);
 
+  /*!
+   * Returns true if \a tag is byte for byte the same as the ID3v2 tag
+   * currently stored in the file.
+   */
+  bool isTagOnDisk(const TagPieces &tag);
+
+  /*!
+   * Writes \a tag at \a location, which must be at or past the start
+   * of the current ID3v2 chunk, then the file size and metadata pointer
+   * of the DSD header in a single write.  The file is truncated if it
+   * got shorter.  An empty \a tag removes the ID3v2 chunk.  Returns
+   * false if a write or the truncation failed.
+   */
+  bool writeTail(uint64_t location, const TagPieces &tag);
+
+  /*!
+   * Same as writeTail(), but the header only ever points to a complete
+   * tag that has been synced to disk.  See setSafeSave().
+   */
+  bool safeWriteTail(uint64_t location, const TagPieces &tag);
+
+  /*!
+   * Writes the pieces of \a tag one after the other from \a location.
+   * Pieces copied within the file may overlap with their source.
+   */
+  bool writePieces(uint64_t location, const TagPieces &tag);
+
+  /*!
+   * Copies \a size bytes from \a from to \a to, in chunks.  The two
+   * ranges may overlap.
+   */
+  bool copyBlock(uint64_t from, uint64_t to, uint64_t size);
+
+  /*!
+   * Writes the file size and metadata pointer of the DSD header.
+   * Returns false on a short write.
+   */
+  bool writeHeader(uint64_t fileSize, uint64_t ID3v2Offset);
+
+  /*!
+   * Writes \a data at \a offset.  IOStream doesn't report errors, so a
+   * short write is told by the position it leaves.  Returns false then.
+   */
+  bool writeAt(uint64_t offset, const TagLib::ByteVector &data);
+
+  /*!
+   * Truncates the file to \a length.  Returns false if the file on disk
+   * didn't end up that long.
+   */
+  bool truncateTo(uint64_t length);
+
+  /*!
+   * Flushes everything written so far to disk.
+   */
+  bool sync();
+
+  /*!
+   * Returns the end of the data chunk, where the ID3v2 chunk should
+   * start, or 0 if the data chunk header is not valid.
+   */
+  uint64_t dataChunkEnd();
+
+  /*!
+   * Builds the frame index of an ID3v2.4 tag without reading any frame
+   * body.  Returns false if the tag has to be parsed by TagLib instead.
+   */
+  bool indexTag();
+
   class FilePrivate;
   FilePrivate *d;
 };
@@ -0,0 +1,235 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+//
+// Tags saved around frames that are never parsed: edits keep the frame
+// order and the bytes of every other frame, whichever way the frames
+// that are copied within the file move. Run by "make check" from the
+// build directory.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char *dsfFile = "dsffiletest.dsf";
+const uint64_t audioEnd = 8284; // size of a file made by mkdsf
+int failures = 0;
+
+typedef std::pair<std::string, std::string> Frame; // ID, whole frame
+typedef std::vector<Frame> FrameVector;
+
+void fail(const std::string &what)
+{
+  std::cerr << "FAIL: " << what << std::endl;
+  failures++;
+}
+
+std::string synchsafe(uint32_t n)
+{
+  std::string s(4, 0);
+  for (int i = 3; i >= 0; i--, n >>= 7)
+    s[i] = n & 0x7f;
+  return s;
+}
+
+uint32_t unsynchsafe(const std::string &s, size_t pos)
+{
+  uint32_t n = 0;
+  for (int i = 0; i < 4; i++)
+    n = (n << 7) | (s[pos + i] & 0x7f);
+  return n;
+}
+
+std::string u64raw(uint64_t n)
+{
+  std::string s(8, 0);
+  for (int i = 0; i < 8; i++, n >>= 8)
+    s[i] = n & 0xff;
+  return s;
+}
+
+uint64_t rawu64(const std::string &s, size_t pos)
+{
+  uint64_t n = 0;
+  for (int i = 7; i >= 0; i--)
+    n = (n << 8) | static_cast<unsigned char>(s[pos + i]);
+  return n;
+}
+
+// An ID3v2.4 frame, flags are the status flags
+std::string frame(const std::string &id, char flags, const std::string &body)
+{
+  return id + synchsafe(body.size()) + flags + '\0' + body;
+}
+
+std::string textFrame(const std::string &id, const std::string &text)
+{
+  return frame(id, 0, "\x03" + text); // UTF-8
+}
+
+std::string readFile(const char *path)
+{
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+bool run(const std::string &what, const std::string &cmd)
+{
+  if (system(cmd.c_str()) != 0) {
+    fail(what + ": command failed");
+    return false;
+  }
+  return true;
+}
+
+// A file made by mkdsf with frames as its tag
+bool makeFile(const FrameVector &frames)
+{
+  if (!run("mkdsf", std::string("./mkdsf ") + dsfFile + " > /dev/null"))
+    return false;
+
+  std::string tag;
+  for (auto &f : frames)
+    tag += f.second;
+  tag.append(100, 0); // padding
+  tag = std::string("ID3\x04\x00\x00", 6) + synchsafe(tag.size()) + tag;
+
+  std::string data = readFile(dsfFile);
+  data.replace(12, 16, u64raw(audioEnd + tag.size()) + u64raw(audioEnd));
+  std::ofstream out(dsfFile, std::ios::binary | std::ios::trunc);
+  out << data << tag;
+  return out.good();
+}
+
+// The frames of the tag in the file, in their order
+bool readFrames(const std::string &data, FrameVector &frames)
+{
+  frames.clear();
+  if (data.size() < audioEnd + 10 || rawu64(data, 12) != data.size() ||
+      rawu64(data, 20) != audioEnd)
+    return false;
+  if (data.compare(audioEnd, 4, std::string("ID3\x04", 4)) != 0)
+    return false;
+
+  size_t pos = audioEnd + 10;
+  size_t end = pos + unsynchsafe(data, audioEnd + 6);
+  if (end != data.size())
+    return false;
+  while (pos + 10 <= end && data[pos] != 0) {
+    size_t size = 10 + unsynchsafe(data, pos + 4);
+    if (pos + size > end)
+      return false;
+    frames.push_back(Frame(data.substr(pos, 4), data.substr(pos, size)));
+    pos += size;
+  }
+  return true;
+}
+
+// Set TIT2 and TPE1 of the file and check the frames against expected
+void setTags(const std::string &what, const std::string &options, 
+	     const std::string &title, const std::string &artist, 
+	     FrameVector expected, const std::string &audio)
+{
+  std::string cmd = "./metadsf " + options;
+  if (!title.empty())
+    cmd += " --set-tag=TIT2='" + title + "'";
+  cmd += " --set-tag=TPE1='" + artist + "' " + dsfFile;
+  if (!run(what, cmd))
+    return;
+
+  std::string data = readFile(dsfFile);
+  FrameVector frames;
+  if (!readFrames(data, frames)) {
+    fail(what + ": tag or header damaged");
+    return;
+  }
+  if (data.compare(0, 12, audio, 0, 12) != 0 || 
+      data.compare(28, audioEnd - 28, audio, 28, audioEnd - 28) != 0)
+    fail(what + ": audio data changed");
+
+  if (!title.empty())
+    expected[0].second = textFrame("TIT2", title);
+  expected[2].second = textFrame("TPE1", artist);
+  if (frames.size() != expected.size()) {
+    fail(what + ": frames added or lost");
+    return;
+  }
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (frames[i].first != expected[i].first)
+      fail(what + ": " + expected[i].first + " moved");
+    else if (frames[i].second != expected[i].second)
+      fail(what + ": " + expected[i].first + " changed");
+  }
+}
+
+} // namespace
+
+int main()
+{
+  // The picture has the "tag alter preservation" flag, which makes TagLib
+  // drop it from the tag if it's ever parsed. It's large enough to be
+  // copied in several chunks.
+  std::string picture = std::string("\x00image/png\x00\x03\x00", 13);
+  for (int i = 0; i < 150000; i++)
+    picture += static_cast<char>(i * 31 + 7);
+
+  FrameVector frames;
+  frames.push_back(Frame("TIT2", textFrame("TIT2", "So What")));
+  frames.push_back(Frame("APIC", frame("APIC", 0x40, picture)));
+  frames.push_back(Frame("TPE1", textFrame("TPE1", "Miles Davis")));
+  frames.push_back(Frame("TALB", textFrame("TALB", "Kind of Blue")));
+  frames.push_back(Frame("TRCK", textFrame("TRCK", "1")));
+
+  const char *modes[] = { "", "--safe-save" };
+  for (auto &mode : modes) {
+    std::string m = *mode ? std::string(" ") + mode : "";
+    if (!makeFile(frames))
+      return 1;
+    std::string audio = readFile(dsfFile);
+
+    // One frame, the others keep their place and bytes
+    setTags("edit" + m, mode, "", "John Coltrane", frames, audio);
+
+    // Both text frames grow: the picture moves up over TPE1, and TALB
+    // and TRCK have to move out of its way first
+    std::string title(300, 't'), artist(500, 'a');
+    setTags("grow" + m, mode, title, artist, frames, audio);
+
+    // And shrink, everything moves down again
+    setTags("shrink" + m, mode, "Blue in Green", "Bill Evans", frames, 
+	    audio);
+  }
+
+  remove(dsfFile);
+  if (failures)
+    std::cerr << failures << " failed" << std::endl;
+  return failures ? 1 : 0;
+}
@@ -28,6 +28,7 @@
 #include <taglib/trefcounter.h>
 
 #include "dsfheader.h"
+#include "batch.h"
 
 class DSFHeader::HeaderPrivate : public TagLib::RefCounter
 {
@@ -141,7 +142,7 @@ DSFHeader &DSFHeader::operator=(const DSFHeader &h)
 void DSFHeader::parse(const TagLib::ByteVector &data)
 {
   if (data.size() < DSD_HEADER_SIZE + FMT_HEADER_SIZE) {
-    std::cerr <<"DSFHeader::parse(): header size incorrect" << std::endl;
+    BatchProcessor::err() <<"DSFHeader::parse(): header size incorrect" << std::endl;
     return;
   }
 
@@ -154,7 +155,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   //
   if (hdr[0] != 'D' || hdr[1] != 'S' || hdr[2] != 'D' || hdr[3] != ' ') 
   {
-    std::cerr <<"DSD::Header::parse(): DSD header's first 4 bytes != 'DSD '" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): DSD header's first 4 bytes != 'DSD '" << std::endl;
     return;
   }
   offset += 4;
@@ -163,7 +164,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   // (numerical data is stored in little endian)
   if (data.toLongLong(offset, false) != DSD_HEADER_SIZE)
   {
-    std::cerr <<"DSD::Header::parse(): DSD header size is incorrect" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): DSD header size is incorrect" << std::endl;
     return;
   }
   offset += LONG_INT_SIZE;
@@ -184,7 +185,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   if (hdr[offset] != 'f' || hdr[offset + 1] != 'm' || 
       hdr[offset + 2] != 't' || hdr[offset + 3] != ' ') 
   {
-    std::cerr <<"DSD::Header::parse(): FMT header's first 4 bytes != 'fmt '" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): FMT header's first 4 bytes != 'fmt '" << std::endl;
     return;
   }
   offset += 4;
@@ -192,7 +193,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   // The next 8 bytes contain the size of FMT header, which should be 52
   if (data.toLongLong(offset, false) != FMT_HEADER_SIZE)
   {
-    std::cerr <<"DSD::Header::parse(): FMT header size is incorrect" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): FMT header size is incorrect" << std::endl;
     return;
   }
   offset += LONG_INT_SIZE;
@@ -201,7 +202,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   // There's only version 1 for now...
   unsigned int ver = data.toUInt(offset, false);
   if (ver != 1) {
-    std::cerr <<"DSD::Header::parse(): format version != 1" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): format version != 1" << std::endl;
     return;
   }
   d->version = static_cast<Version>(ver);
@@ -209,7 +210,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
 
   // Format ID
   if (data.toUInt(offset, false) != 0) {
-    std::cerr <<"DSD::Header::parse(): format ID != 0" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): format ID != 0" << std::endl;
     return;
   }
   offset += INT_SIZE;
@@ -217,7 +218,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   // Channel Type
   unsigned int ct = data.toUInt(offset, false);
   if (ct < 1 || ct > 7) {
-    std::cerr <<"DSD::Header::parse(): channel type out of range" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): channel type out of range" << std::endl;
     return;
   }
   d->channelType = static_cast<ChannelType>(ct);
@@ -226,15 +227,17 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   // Channel Num
   d->channelNum = data.toUInt(offset, false);
   if (d->channelNum < MinType || d->channelNum > MaxType) {
-    std::cerr <<"DSD::Header::parse(): channel num out of range" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): channel num out of range" << std::endl;
     return;
   }
   offset += INT_SIZE;
 
   // Sampling frequency
   d->sampleRate = data.toUInt(offset, false);
-  if (d->sampleRate != 2822400 && d->sampleRate != 5644800) {
-    std::cerr <<"DSD::Header::parse(): invalid sampling frequency" << std::endl;
+  // DSD64 and DSD128 per the spec, DSD256 and DSD512 in the wild
+  if (d->sampleRate != 2822400 && d->sampleRate != 5644800 &&
+      d->sampleRate != 11289600 && d->sampleRate != 22579200) {
+    BatchProcessor::err() <<"DSD::Header::parse(): invalid sampling frequency" << std::endl;
     return;
   }
   offset += INT_SIZE;
@@ -242,7 +245,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
   // Bits per sample
   d->bitsPerSample = data.toUInt(offset, false);
   if (d->bitsPerSample != 1 && d->bitsPerSample != 8) {
-    std::cerr <<"DSD::Header::parse(): bits per sample invalid" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): bits per sample invalid" << std::endl;
     return;
   }
   offset += INT_SIZE;
@@ -253,7 +256,7 @@ void DSFHeader::parse(const TagLib::ByteVector &data)
 
   // Block size per channel
   if (data.toUInt(offset, false) != 4096) {
-    std::cerr <<"DSD::Header::parse(): block size != 4096" << std::endl;
+    BatchProcessor::err() <<"DSD::Header::parse(): block size != 4096" << std::endl;
     return;
   }
     //offset += 4;
@@ -39,6 +39,7 @@ class DSFHeader
  public:
   static const int DSD_HEADER_SIZE = 28;
   static const int FMT_HEADER_SIZE = 52;
+  static const int DATA_HEADER_SIZE = 12; // "data" + chunk size
   static const int LONG_INT_SIZE = 8;    // width of a long integer
   static const int INT_SIZE = 4;         // width of an integer
 
@@ -0,0 +1,288 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <vector>
+
+#include <taglib/tbytevector.h>
+#include <taglib/tbytevectorstream.h>
+#include <taglib/tfile.h>
+#include <taglib/id3v2header.h>
+#include <taglib/id3v2framefactory.h>
+
+#include "dsfprobe.h"
+#include "dsfheader.h"
+#include "utils.h"
+
+// A tag held in memory, for TagLib::ID3v2::Tag to parse
+class MemoryFile : public TagLib::File
+{
+public:
+  MemoryFile(TagLib::ByteVectorStream *stream) : TagLib::File(stream) {}
+
+  virtual TagLib::Tag *tag() const { return 0; }
+  virtual TagLib::AudioProperties *audioProperties() const { return 0; }
+  virtual bool save() { return false; }
+};
+
+class DSFProbe::ProbePrivate
+{
+public:
+  ProbePrivate() :
+    isValid(false),
+    hasID3v2(false),
+    properties(0),
+    stream(0),
+    file(0),
+    tag(0),
+    partial(0),
+    indexed(false)
+  {}
+
+  ~ProbePrivate()
+  {
+    if (properties) delete properties;
+    if (tag) delete tag;
+    if (partial) delete partial;
+    if (file) delete file;
+    if (stream) delete stream;
+  }
+
+  bool isValid;
+  bool hasID3v2;
+  DSFProperties *properties;
+  TagLib::ID3v2::Header header;
+  TagLib::ByteVector headerData;      // DSD + fmt chunks
+  TagLib::ByteVector ID3v2HeaderData;
+  TagLib::ByteVector tagData;
+  // The tag, parsed from tagData on demand
+  TagLib::ByteVectorStream *stream;
+  MemoryFile *file;
+  TagLib::ID3v2::Tag *tag;
+
+  // Frames of tagData, for frameList(frameID)
+  struct RawFrame {
+    TagLib::ByteVector id;
+    unsigned int offset;
+    unsigned int size;
+  };
+  std::vector<RawFrame> rawFrames;
+  // Owns the frames parsed so far. They are listed by the ID they had
+  // on disk, TagLib may have updated it.
+  TagLib::ID3v2::Tag *partial;
+  std::map<TagLib::ByteVector, TagLib::ID3v2::FrameList> parsed;
+  bool indexed;
+
+  // Locate the frames in tagData. Returns false if the tag has to be
+  // left to TagLib.
+  bool index();
+};
+
+bool DSFProbe::ProbePrivate::index()
+{
+  if (tagData.size() < TagLib::ID3v2::Header::size())
+    return false;
+
+  // TagLib upgrades ID3v2.3 frames as it reads them, e.g. TYER and
+  // TDAT become TDRC, so those are only found by a full parse
+  TagLib::ID3v2::Header h(tagData.mid(0, TagLib::ID3v2::Header::size()));
+  unsigned int version = h.majorVersion();
+  if (version != 4 || h.unsynchronisation() || h.extendedHeader() || 
+      h.footerPresent())
+    return false;
+
+  const unsigned int frameHeaderSize = 
+    TagLib::ID3v2::Frame::headerSize(version);
+  unsigned int pos = TagLib::ID3v2::Header::size();
+  unsigned int end = std::min(tagData.size(), pos + h.tagSize());
+
+  while (pos + frameHeaderSize <= end) {
+    if (tagData[pos] == 0) // padding
+      break;
+
+    TagLib::ID3v2::Frame::Header fh(tagData.mid(pos, frameHeaderSize), 
+				    version);
+    if (fh.frameSize() == 0)
+      break;
+    if (pos + frameHeaderSize + fh.frameSize() > end)
+      return false;
+
+    RawFrame f;
+    f.id = fh.frameID();
+    f.offset = pos;
+    f.size = frameHeaderSize + fh.frameSize();
+    rawFrames.push_back(f);
+    pos += f.size;
+  }
+
+  partial = new TagLib::ID3v2::Tag();
+  partial->header()->setData(tagData.mid(0, TagLib::ID3v2::Header::size()));
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public members
+////////////////////////////////////////////////////////////////////////////////
+
+DSFProbe::DSFProbe(const char *file, bool readTag)
+{
+  d = new ProbePrivate;
+
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  // DSD + fmt chunks
+  if (setDSFHeader(readAt(fd, 0, DSFHeader::DSD_HEADER_SIZE + 
+			  DSFHeader::FMT_HEADER_SIZE))) {
+    // ID3v2 header, frames only if asked for
+    uint64_t offset = d->properties->ID3v2Offset();
+    if (offset > 0) {
+      setID3v2Header(readAt(fd, offset, TagLib::ID3v2::Header::size()));
+      // Sizes past the end of the file are bogus, don't allocate them
+      struct stat st;
+      if (readTag && d->hasID3v2 && fstat(fd, &st) == 0 &&
+	  offset + d->header.completeTagSize() <= 
+	  static_cast<uint64_t>(st.st_size))
+	setTagData(readAt(fd, offset, d->header.completeTagSize()));
+    }
+  }
+
+  close(fd);
+}
+
+DSFProbe::DSFProbe()
+{
+  d = new ProbePrivate;
+}
+
+DSFProbe::~DSFProbe()
+{
+  delete d;
+}
+
+bool DSFProbe::isValid() const
+{
+  return d->isValid;
+}
+
+const DSFProperties *DSFProbe::audioProperties() const
+{
+  return d->properties;
+}
+
+const TagLib::ID3v2::Header *DSFProbe::ID3v2Header() const
+{
+  return &d->header;
+}
+
+bool DSFProbe::hasID3v2Tag() const
+{
+  return d->hasID3v2;
+}
+
+TagLib::ID3v2::FrameList DSFProbe::frameList() const
+{
+  if (!d->tag && !d->tagData.isEmpty()) {
+    d->stream = new TagLib::ByteVectorStream(d->tagData);
+    d->file = new MemoryFile(d->stream);
+    d->tag = new TagLib::ID3v2::Tag(d->file, 0, 
+				    TagLib::ID3v2::FrameFactory::instance());
+  }
+  if (!d->tag)
+    return TagLib::ID3v2::FrameList();
+  return d->tag->frameList();
+}
+
+TagLib::ID3v2::FrameList 
+DSFProbe::frameList(const TagLib::ByteVector &frameID) const
+{
+  if (!d->indexed) {
+    d->indexed = true;
+    if (!d->tag)
+      d->index();
+  }
+
+  // Everything parsed already, or the tag is beyond index()
+  if (d->tag || !d->partial) {
+    frameList();
+    if (!d->tag)
+      return TagLib::ID3v2::FrameList();
+    return d->tag->frameList(frameID);
+  }
+
+  auto it = d->parsed.find(frameID);
+  if (it != d->parsed.end())
+    return it->second;
+
+  TagLib::ID3v2::FrameList &l = d->parsed[frameID];
+  for (auto &r : d->rawFrames) {
+    if (r.id != frameID)
+      continue;
+    TagLib::ID3v2::Frame *f = TagLib::ID3v2::FrameFactory::instance()->
+      createFrame(d->tagData.mid(r.offset, r.size), d->partial->header());
+    if (f) {
+      d->partial->addFrame(f);
+      l.append(f);
+    }
+  }
+  return l;
+}
+
+const TagLib::ByteVector &DSFProbe::DSFHeaderData() const
+{
+  return d->headerData;
+}
+
+const TagLib::ByteVector &DSFProbe::ID3v2HeaderData() const
+{
+  return d->ID3v2HeaderData;
+}
+
+bool DSFProbe::setDSFHeader(const TagLib::ByteVector &data)
+{
+  d->headerData = data;
+  DSFHeader h(data);
+  if (h.isValid()) {
+    d->isValid = true;
+    d->properties = new DSFProperties(h);
+  }
+  return d->isValid;
+}
+
+void DSFProbe::setID3v2Header(const TagLib::ByteVector &data)
+{
+  if (!data.isEmpty()) {
+    d->ID3v2HeaderData = data;
+    d->header.setData(data);
+    d->hasID3v2 = d->header.tagSize() > 0;
+  }
+}
+
+void DSFProbe::setTagData(const TagLib::ByteVector &data)
+{
+  d->tagData = data;
+}
@@ -0,0 +1,127 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_DSFPROBE_H
+#define TAGLIB_DSFPROBE_H
+
+#include <taglib/id3v2header.h>
+#include <taglib/id3v2tag.h>
+
+#include "dsfproperties.h"
+
+//! Fast, read-only access to the fixed size headers of a DSF file
+
+/*!
+ * This reads the DSD and fmt chunks (DSFHeader::DSD_HEADER_SIZE +
+ * DSFHeader::FMT_HEADER_SIZE bytes) and the 10-byte ID3v2 header that
+ * the DSD chunk points to, with one positional read each. Unlike DSFFile,
+ * no ID3v2 frame is read unless asked for, so the cost doesn't depend on
+ * the size of the tag.
+ *
+ * A probe can also be fed with data read by someone else, see DSFScanner.
+ */
+
+class DSFProbe
+{
+ public:
+  /*!
+   * Probes \a file. If \a readTag is true the whole ID3v2 tag is read
+   * too, with one more positional read.
+   */
+  DSFProbe(const char *file, bool readTag = false);
+
+  /*!
+   * Constructs an empty probe, to be filled with the set*() methods.
+   */
+  DSFProbe();
+
+  /*!
+   * Destroys this instance.
+   */
+  ~DSFProbe();
+
+  /*!
+   * Returns true if the file could be read and has a valid DSF header.
+   */
+  bool isValid() const;
+
+  /*!
+   * Returns the audio properties. Only meaningful if isValid() is true.
+   */
+  const DSFProperties *audioProperties() const;
+
+  /*!
+   * Returns the header of the ID3v2 tag. If the file has no tag this
+   * is a default constructed header, the same as DSFFile would report.
+   */
+  const TagLib::ID3v2::Header *ID3v2Header() const;
+
+  /*!
+   * Returns whether the file has an ID3v2 tag.
+   */
+  bool hasID3v2Tag() const;
+
+  /*!
+   * Returns the frames of the ID3v2 tag, parsed the first time this is
+   * called. Empty if the tag wasn't read.
+   */
+  TagLib::ID3v2::FrameList frameList() const;
+
+  /*!
+   * Returns the frames with ID \a frameID. Only these frames are parsed
+   * if the tag is plain ID3v2.4 (no unsynchronisation, extended header
+   * or footer), the others are skipped over. Other tags are parsed in
+   * full, so that ID3v2.3 frames are found by their ID3v2.4 ID as with
+   * DSFFile.
+   */
+  TagLib::ID3v2::FrameList frameList(const TagLib::ByteVector &frameID) const;
+
+  /*!
+   * Returns the DSD and fmt chunks and the ID3v2 header as they were
+   * read from the file, empty if they weren't.
+   */
+  const TagLib::ByteVector &DSFHeaderData() const;
+  const TagLib::ByteVector &ID3v2HeaderData() const;
+
+  /*!
+   * Parses the DSD and fmt chunks in \a data. Returns isValid().
+   */
+  bool setDSFHeader(const TagLib::ByteVector &data);
+
+  /*!
+   * Parses the 10-byte ID3v2 header in \a data.
+   */
+  void setID3v2Header(const TagLib::ByteVector &data);
+
+  /*!
+   * Sets the complete ID3v2 tag, header included.
+   */
+  void setTagData(const TagLib::ByteVector &data);
+
+ private:
+  DSFProbe(const DSFProbe &);
+  DSFProbe &operator=(const DSFProbe &);
+
+  class ProbePrivate;
+  ProbePrivate *d;
+};
+
+#endif
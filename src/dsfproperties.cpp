@@ -25,6 +25,7 @@
 
 #include "dsfproperties.h"
 #include "dsffile.h"
+#include "batch.h"
 
 class DSFProperties::PropertiesPrivate
 {
@@ -72,6 +73,16 @@ DSFProperties::DSFProperties(DSFFile *file,
     read();
 }
 
+DSFProperties::DSFProperties(const DSFHeader &h,
+			     TagLib::AudioProperties::ReadStyle style) 
+  : TagLib::AudioProperties(style)
+{
+  d = new PropertiesPrivate(0, style);
+
+  if (h.isValid())
+    set(h);
+}
+
 DSFProperties::~DSFProperties()
 {
   delete d;
@@ -140,10 +151,15 @@ void DSFProperties::read()
 				 DSFHeader::FMT_HEADER_SIZE));
 
   if (!h.isValid()) {
-    std::cerr << "DSFProperties::read(): file header is not valid" << std::endl;
+    BatchProcessor::err() << "DSFProperties::read(): file header is not valid" << std::endl;
     return;
   }
 
+  set(h);
+}
+
+void DSFProperties::set(const DSFHeader &h)
+{
   d->sampleRate = h.sampleRate();
   d->sampleCount = h.sampleCount();
   d->bitsPerSample = h.bitsPerSample();
@@ -46,6 +46,13 @@ class DSFProperties : public TagLib::AudioProperties
   DSFProperties(DSFFile *file, 
 		TagLib::AudioProperties::ReadStyle style = Average);
 
+  /*!
+   * Create an instance of DSF::Properties from an already parsed
+   * header \a h. Nothing is read from disk.
+   */
+  DSFProperties(const DSFHeader &h, 
+		TagLib::AudioProperties::ReadStyle style = Average);
+
   /*!
    * Destroys this DSF Properties instance.
    */
@@ -93,6 +100,7 @@ class DSFProperties : public TagLib::AudioProperties
   DSFProperties &operator=(const DSFProperties &);
 
   void read();
+  void set(const DSFHeader &h);
 
   class PropertiesPrivate;
   PropertiesPrivate *d;
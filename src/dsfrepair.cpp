@@ -0,0 +1,271 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sstream>
+
+#include <taglib/tbytevector.h>
+#include <taglib/id3v2header.h>
+
+#include "dsfrepair.h"
+#include "dsfheader.h"
+#include "utils.h"
+
+class DSFRepair::RepairPrivate
+{
+public:
+  RepairPrivate(const char *file) :
+    name(file),
+    fd(-1),
+    isValid(false),
+    isRepairable(true),
+    moveTag(false),
+    length(0),
+    dataEnd(0),
+    fileSize(0),
+    ID3v2Offset(0),
+    tagSize(0),
+    newFileSize(0),
+    newID3v2Offset(0)
+  {}
+
+  ~RepairPrivate()
+  {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // Size of the complete ID3v2 tag at offset, 0 if there's none or
+  // it goes past the end of the file
+  uint64_t tagSizeAt(uint64_t offset) const;
+
+  // Write all of v at offset
+  bool writeAt(const TagLib::ByteVector &v, uint64_t offset) const;
+
+  bool sync() const;
+
+  void problem(const std::string &s) { problems.push_back(s.c_str()); }
+
+  std::string name;
+  int fd;
+  bool isValid;
+  bool isRepairable;
+  bool moveTag; // copy the tag from ID3v2Offset to newID3v2Offset
+  StringVector problems;
+
+  uint64_t length;      // actual file length
+  uint64_t dataEnd;     // end of the data chunk
+  uint64_t fileSize;    // as in the header
+  uint64_t ID3v2Offset; // as in the header
+  uint64_t tagSize;     // of the tag to keep
+
+  // What the header should say
+  uint64_t newFileSize;
+  uint64_t newID3v2Offset;
+};
+
+bool DSFRepair::RepairPrivate::writeAt(const TagLib::ByteVector &v,
+				       uint64_t offset) const
+{
+  unsigned int n = 0;
+
+  while (n < v.size()) {
+    ssize_t r = pwrite(fd, v.data() + n, v.size() - n, offset + n);
+    if (r <= 0)
+      return false;
+    n += r;
+  }
+  return true;
+}
+
+bool DSFRepair::RepairPrivate::sync() const
+{
+  return fdatasync(fd) == 0;
+}
+
+uint64_t DSFRepair::RepairPrivate::tagSizeAt(uint64_t offset) const
+{
+  if (offset + TagLib::ID3v2::Header::size() > length)
+    return 0;
+
+  TagLib::ByteVector v = readAt(fd, offset, TagLib::ID3v2::Header::size());
+  if (!v.startsWith(TagLib::ID3v2::Header::fileIdentifier()))
+    return 0;
+
+  TagLib::ID3v2::Header h(v);
+  if (offset + h.completeTagSize() > length)
+    return 0;
+  return h.completeTagSize();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public members
+////////////////////////////////////////////////////////////////////////////////
+
+DSFRepair::DSFRepair(const char *file)
+{
+  d = new RepairPrivate(file);
+
+  // Only reopened for writing if there's something to repair
+  d->fd = open(file, O_RDONLY);
+  if (d->fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(d->fd, &st) != 0)
+    return;
+  d->length = st.st_size;
+
+  // DSD + fmt chunks
+  const unsigned int hdrSize = 
+    DSFHeader::DSD_HEADER_SIZE + DSFHeader::FMT_HEADER_SIZE;
+  DSFHeader h(readAt(d->fd, 0, hdrSize));
+  if (!h.isValid())
+    return;
+  d->fileSize = h.fileSize();
+  d->ID3v2Offset = h.ID3v2Offset();
+
+  // data chunk, right after them
+  TagLib::ByteVector v = readAt(d->fd, hdrSize, DSFHeader::DATA_HEADER_SIZE);
+  if (v.isEmpty() || !v.startsWith("data"))
+    return;
+  d->dataEnd = hdrSize + v.toLongLong(4, false);
+  d->isValid = true;
+
+  std::ostringstream os;
+
+  if (d->dataEnd > d->length) {
+    os << "data chunk ends at " << d->dataEnd << ", past the end of file";
+    d->problem(os.str());
+    d->isRepairable = false;
+    return;
+  }
+
+  // Which ID3v2 tag to keep, if any
+  if (d->ID3v2Offset > 0) {
+    if (d->ID3v2Offset >= d->dataEnd)
+      d->tagSize = d->tagSizeAt(d->ID3v2Offset);
+
+    if (d->tagSize > 0) {
+      d->newID3v2Offset = d->ID3v2Offset;
+
+      // Left by an interrupted save. Only move the tag if the copy
+      // doesn't overlap with the original.
+      if (d->ID3v2Offset > d->dataEnd && 
+	  d->ID3v2Offset - d->dataEnd >= d->tagSize) {
+	os.str("");
+	os << "gap of " << d->ID3v2Offset - d->dataEnd;
+	os << " bytes before the ID3v2 chunk";
+	d->problem(os.str());
+	d->newID3v2Offset = d->dataEnd;
+	d->moveTag = true;
+      }
+    } else {
+      os.str("");
+      os << "metadata offset " << d->ID3v2Offset;
+      os << " doesn't point to a complete ID3v2 tag";
+      d->problem(os.str());
+
+      d->tagSize = d->tagSizeAt(d->dataEnd);
+      if (d->tagSize > 0)
+	d->newID3v2Offset = d->dataEnd;
+    }
+  }
+
+  d->newFileSize = d->newID3v2Offset > 0 ? 
+    d->newID3v2Offset + d->tagSize : d->dataEnd;
+
+  if (d->fileSize != d->newFileSize) {
+    os.str("");
+    os << "file size is " << d->fileSize << ", should be " << d->newFileSize;
+    d->problem(os.str());
+  }
+  if (d->length > d->newFileSize) {
+    os.str("");
+    os << d->length - d->newFileSize << " bytes past the last chunk";
+    d->problem(os.str());
+  }
+}
+
+DSFRepair::~DSFRepair()
+{
+  delete d;
+}
+
+bool DSFRepair::isValid() const
+{
+  return d->isValid;
+}
+
+const StringVector &DSFRepair::problems() const
+{
+  return d->problems;
+}
+
+bool DSFRepair::isRepairable() const
+{
+  return d->isValid && d->isRepairable;
+}
+
+bool DSFRepair::repair()
+{
+  if (!isRepairable())
+    return false;
+  if (d->problems.empty())
+    return true;
+
+  // Make sure it's still the file that was examined
+  struct stat before, after;
+  int fd = open(d->name.c_str(), O_RDWR);
+  if (fd < 0 || fstat(d->fd, &before) != 0 || fstat(fd, &after) != 0 ||
+      before.st_dev != after.st_dev || before.st_ino != after.st_ino) {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  close(d->fd);
+  d->fd = fd;
+
+  // Copy the tag first, the header still points to the original
+  if (d->moveTag) {
+    TagLib::ByteVector tag = readAt(d->fd, d->ID3v2Offset, d->tagSize);
+    if (tag.isEmpty() || !d->writeAt(tag, d->newID3v2Offset) || !d->sync())
+      return false;
+  }
+
+  if (d->fileSize != d->newFileSize || d->ID3v2Offset != d->newID3v2Offset) {
+    TagLib::ByteVector header;
+    header.append(TagLib::ByteVector::fromLongLong(d->newFileSize, false));
+    header.append(TagLib::ByteVector::fromLongLong(d->newID3v2Offset, false));
+    if (!d->writeAt(header, 12) || !d->sync())
+      return false;
+  }
+
+  if (d->length > d->newFileSize) {
+    if (ftruncate(d->fd, d->newFileSize) != 0 || !d->sync())
+      return false;
+  }
+  return true;
+}
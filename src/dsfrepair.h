@@ -0,0 +1,92 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_DSFREPAIR_H
+#define TAGLIB_DSFREPAIR_H
+
+#include <stdint.h>
+
+#include "typedefs.h"
+
+//! Detects and fixes DSF files left inconsistent by an interrupted save
+
+/*!
+ * The file size and metadata pointer of the DSD chunk are checked
+ * against the data chunk and the ID3v2 chunk actually found in the file:
+ *
+ * - a metadata pointer that doesn't lead to a complete ID3v2 tag is
+ *   pointed at the tag right after the data chunk if there is one,
+ *   otherwise the tag is dropped
+ * - an ID3v2 chunk separated from the data chunk by a gap is moved
+ *   back, if that can be done without overwriting it
+ * - a file size that doesn't match the last chunk is corrected
+ * - bytes past the last chunk are cut off
+ *
+ * The audio data itself is never touched.  A file whose data chunk is
+ * truncated can't be repaired.
+ */
+
+class DSFRepair
+{
+ public:
+  /*!
+   * Examines \a file.  It's opened read-only, repair() opens it again
+   * for writing.
+   */
+  DSFRepair(const char *file);
+
+  /*!
+   * Destroys this instance.
+   */
+  ~DSFRepair();
+
+  /*!
+   * Returns true if the file could be read and has valid DSD, fmt
+   * and data chunk headers.
+   */
+  bool isValid() const;
+
+  /*!
+   * Returns a description of every problem found, empty if the file
+   * is fine.
+   */
+  const StringVector &problems() const;
+
+  /*!
+   * Returns true if all problems can be fixed.
+   */
+  bool isRepairable() const;
+
+  /*!
+   * Fixes the problems and syncs the file.  Every step leaves the
+   * headers consistent with the contents.  Returns false on error.
+   */
+  bool repair();
+
+ private:
+  DSFRepair(const DSFRepair &);
+  DSFRepair &operator=(const DSFRepair &);
+
+  class RepairPrivate;
+  RepairPrivate *d;
+};
+
+#endif
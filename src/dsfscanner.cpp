@@ -0,0 +1,294 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <deque>
+#include <algorithm>
+
+#if defined(HAVE_LIBURING_H) && defined(HAVE_LIBURING)
+#define USE_IO_URING
+#include <liburing.h>
+#endif
+
+#include <taglib/id3v2header.h>
+
+#include "dsfscanner.h"
+#include "dsfprobe.h"
+#include "dsfheader.h"
+#include "batch.h"
+
+//////////////////////////// IMPL //////////////////////////////
+class DSFScanner::DSFScannerImpl {
+ public:
+  // One file being scanned
+  struct Slot {
+    Slot(const TagLib::String &f) : 
+      file(f), fd(-1), size(0), stage(0), done(false) {}
+    TagLib::String file;
+    int fd;
+    uint64_t size;         // of the file, bounds the tag read
+    int stage;             // 0: DSD header, 1: ID3v2 header, 2: tag
+    TagLib::ByteVector buf; // target of the read in flight
+    DSFProbe probe;
+    bool done;
+  };
+
+  DSFScannerImpl(unsigned int depth, bool readTags, const Handler &handler,
+		 std::ostream &out, std::ostream &err) :
+    _handler(handler),
+    _out(out),
+    _err(err),
+    _depth(depth > 0 ? depth : 1),
+    _readTags(readTags),
+    _async(false),
+    _inFlight(0),
+    _failed(0),
+    _batch(0)
+  {}
+  ~DSFScannerImpl() {}
+
+  // Call the handler for the finished slots at the head of _slots
+  void deliver();
+
+#ifdef USE_IO_URING
+  // Queue a read into s->buf
+  void submit(Slot *s, uint64_t offset, unsigned int length);
+
+  // Chain the next read of s, or mark it done
+  void complete(Slot *s, int res);
+
+  // Submit queued reads and process completions, waiting for at
+  // least one if wait is true
+  void reap(bool wait);
+
+  struct io_uring _ring;
+#endif
+
+  /////////////// Variables //////////////
+  Handler _handler;
+  std::ostream &_out;
+  std::ostream &_err;
+  unsigned int _depth;
+  bool _readTags;
+  bool _async;
+  unsigned int _inFlight;
+  unsigned int _failed;
+  std::deque<Slot *> _slots; // in input order
+
+  // Thread pool doing blocking reads when io_uring isn't available
+  BatchProcessor *_batch;
+};
+
+void DSFScanner::DSFScannerImpl::deliver()
+{
+  while (!_slots.empty() && _slots.front()->done) {
+    Slot *s = _slots.front();
+    _slots.pop_front();
+    if (!_handler(s->file, s->probe, _out, _err))
+      _failed++;
+    delete s;
+  }
+}
+
+#ifdef USE_IO_URING
+void DSFScanner::DSFScannerImpl::submit(Slot *s, uint64_t offset, 
+					unsigned int length)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&_ring);
+  if (!sqe) {
+    // Submission queue full, hand it over to the kernel and retry
+    io_uring_submit(&_ring);
+    sqe = io_uring_get_sqe(&_ring);
+  }
+
+  s->buf = TagLib::ByteVector(length, 0);
+  _inFlight++;
+  if (!sqe) {
+    // The kernel didn't take any (e.g. -EBUSY while completions pile
+    // up), so do this one read without the ring
+    ssize_t r = pread(s->fd, s->buf.data(), length, offset);
+    complete(s, r < 0 ? -errno : static_cast<int>(r));
+    return;
+  }
+
+  io_uring_prep_read(sqe, s->fd, s->buf.data(), length, offset);
+  io_uring_sqe_set_data(sqe, s);
+}
+
+void DSFScanner::DSFScannerImpl::complete(Slot *s, int res)
+{
+  _inFlight--;
+
+  // Short reads mean a truncated file, keep whatever was read before
+  if (res < 0 || static_cast<unsigned int>(res) != s->buf.size()) {
+    s->done = true;
+  } else if (s->stage == 0) {
+    s->stage = 1;
+    if (s->probe.setDSFHeader(s->buf) &&
+	s->probe.audioProperties()->ID3v2Offset() > 0)
+      submit(s, s->probe.audioProperties()->ID3v2Offset(), 
+	     TagLib::ID3v2::Header::size());
+    else
+      s->done = true;
+  } else if (s->stage == 1) {
+    s->stage = 2;
+    s->probe.setID3v2Header(s->buf);
+    // The tag size comes from the file, don't allocate more than the
+    // file could hold. A tag running past the end is truncated anyway.
+    uint64_t offset = s->probe.audioProperties()->ID3v2Offset();
+    if (_readTags && s->probe.hasID3v2Tag() && 
+	offset + s->probe.ID3v2Header()->completeTagSize() <= s->size)
+      submit(s, offset, s->probe.ID3v2Header()->completeTagSize());
+    else
+      s->done = true;
+  } else {
+    s->probe.setTagData(s->buf);
+    s->done = true;
+  }
+
+  // (already closed if submit() had to read the next part itself)
+  if (s->done && s->fd >= 0) {
+    s->buf.clear();
+    close(s->fd);
+    s->fd = -1;
+  }
+}
+
+void DSFScanner::DSFScannerImpl::reap(bool wait)
+{
+  struct io_uring_cqe *cqe;
+
+  io_uring_submit(&_ring);
+  if (wait && io_uring_wait_cqe(&_ring, &cqe) != 0)
+    return;
+
+  while (io_uring_peek_cqe(&_ring, &cqe) == 0) {
+    Slot *s = static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(&_ring, cqe);
+    complete(s, res);
+  }
+}
+#endif
+
+///////////////////////////// DSFSCANNER //////////////////////////
+DSFScanner::DSFScanner(unsigned int depth, bool readTags, 
+		       const Handler &handler, std::ostream &out,
+		       std::ostream &err)
+{
+  _i = new DSFScannerImpl(depth, readTags, handler, out, err);
+
+#ifdef USE_IO_URING
+  if (io_uring_queue_init(_i->_depth, &_i->_ring, 0) == 0) {
+    // Kernels before 5.6 set up the ring but fail every IORING_OP_READ
+    // with -EINVAL, so ask for it first
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&_i->_ring);
+    _i->_async = probe && io_uring_opcode_supported(probe, IORING_OP_READ);
+    if (probe)
+      io_uring_free_probe(probe);
+    if (!_i->_async)
+      io_uring_queue_exit(&_i->_ring);
+  }
+#endif
+
+  if (!_i->_async) {
+    // Blocking reads, so one thread per read in flight (within reason)
+    _i->_batch = new BatchProcessor(std::min(_i->_depth, 32u),
+      [readTags, handler](const TagLib::String &file, 
+			  std::ostream &out, std::ostream &err) {
+	DSFProbe probe(file.toCString(), readTags);
+	return handler(file, probe, out, err);
+      }, out, err);
+  }
+}
+
+DSFScanner::~DSFScanner()
+{
+  finish();
+#ifdef USE_IO_URING
+  if (_i->_async)
+    io_uring_queue_exit(&_i->_ring);
+#endif
+  delete _i->_batch;
+  delete _i;
+}
+
+void DSFScanner::add(const TagLib::String &file)
+{
+  if (!_i->_async) {
+    _i->_batch->add(file);
+    return;
+  }
+
+#ifdef USE_IO_URING
+  DSFScannerImpl::Slot *s = new DSFScannerImpl::Slot(file);
+  _i->_slots.push_back(s);
+
+  struct stat st;
+  s->fd = open(file.toCString(), O_RDONLY);
+  if (s->fd >= 0 && fstat(s->fd, &st) != 0) {
+    close(s->fd);
+    s->fd = -1;
+  }
+  if (s->fd < 0) {
+    s->done = true;
+  } else {
+    s->size = st.st_size;
+    _i->submit(s, 0, DSFHeader::DSD_HEADER_SIZE + DSFHeader::FMT_HEADER_SIZE);
+  }
+
+  // Keep the queue full, but the number of results waiting for slow
+  // files ahead of them bounded
+  _i->reap(false);
+  _i->deliver();
+  while (_i->_inFlight >= _i->_depth ||
+	 (_i->_inFlight > 0 && _i->_slots.size() >= 4 * _i->_depth)) {
+    _i->reap(true);
+    _i->deliver();
+  }
+#endif
+}
+
+unsigned int DSFScanner::finish()
+{
+  if (!_i->_async)
+    return _i->_batch->finish();
+
+#ifdef USE_IO_URING
+  while (_i->_inFlight > 0) {
+    _i->reap(true);
+    _i->deliver();
+  }
+#endif
+  _i->deliver();
+  return _i->_failed;
+}
+
+bool DSFScanner::isAsync() const
+{
+  return _i->_async;
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _DSFSCANNER_H_
+#define _DSFSCANNER_H_
+
+#include <functional>
+#include <iostream>
+
+#include <taglib/tstring.h>
+
+class DSFProbe;
+
+//
+// Reads the headers (and optionally the ID3v2 tags) of many files with
+// lots of reads in flight, for read-only runs over whole libraries.
+//
+// With io_uring every file gets its 80-byte DSD + fmt chunk read queued
+// as soon as it is added. Each completion queues the next read of that
+// file: the ID3v2 header at the metadata offset, then the whole tag.
+// Up to depth reads are kept in flight from a single thread.
+//
+// Without io_uring (not compiled in, or refused by the kernel) the same
+// chain of reads is done by DSFProbe on a pool of threads.
+//
+// Either way the results are handed to the handler in the order the
+// files were added, as DSFProbe objects.
+//
+class DSFScanner {
+ public:
+  // Called once per file. Return false on error.
+  typedef std::function<bool (const TagLib::String &file,
+			      DSFProbe &probe,
+			      std::ostream &out,
+			      std::ostream &err)> Handler;
+
+  // If readTags is true the whole tag of every file is read as well.
+  // The handler writes to out and err.
+  DSFScanner(unsigned int depth, bool readTags, const Handler &handler,
+	     std::ostream &out = std::cout, std::ostream &err = std::cerr);
+  ~DSFScanner();
+
+  // Queue a file. Blocks while too many files are in flight.
+  void add(const TagLib::String &file);
+
+  // Wait for all queued files. Return the number of failed files.
+  unsigned int finish();
+
+  // Whether io_uring is used
+  bool isAsync() const;
+
+  // Reads in flight by default
+  static const unsigned int DEFAULT_DEPTH = 256;
+
+ private:
+  DSFScanner(const DSFScanner &);
+  DSFScanner &operator=(const DSFScanner &);
+
+  class DSFScannerImpl;
+  DSFScannerImpl *_i;
+};
+
+#endif
@@ -0,0 +1,318 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include <taglib/id3v2header.h>
+
+#include "dsfheader.h"
+#include "dsfverifier.h"
+
+namespace {
+  uint32_t le32(const unsigned char *p)
+  {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | 
+      (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  uint64_t le64(const unsigned char *p)
+  {
+    return le32(p) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+  }
+
+  // Channels of each channel type
+  const unsigned int CHANNELS[] = { 0, 1, 2, 3, 4, 4, 5, 6 };
+
+  const uint32_t BLOCK_SIZE = 4096; // bytes per channel
+}
+
+class DSFVerifier::VerifierPrivate
+{
+public:
+  VerifierPrivate() :
+    isOpen(false),
+    fd(-1),
+    length(0)
+  {}
+
+  ~VerifierPrivate()
+  {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  void add(uint64_t offset, const char *check, const std::string &detail)
+  {
+    Violation v = { offset, check, detail };
+    violations.push_back(v);
+  }
+
+  // Check the DSD, fmt and data chunk headers in h and the ID3v2 tag
+  void checkHeaders(const unsigned char *h);
+
+  // Read the whole file. Bytes in the ranges of padding must be zero.
+  void readAll();
+
+  bool isOpen;
+  int fd;
+  uint64_t length;
+  std::vector<std::pair<uint64_t, uint64_t> > padding; // must be zero
+  std::vector<Violation> violations;
+};
+
+void DSFVerifier::VerifierPrivate::checkHeaders(const unsigned char *h)
+{
+  std::ostringstream os;
+  auto detail = [&]() {
+    std::string s = os.str();
+    os.str("");
+    return s;
+  };
+
+  // DSD chunk
+  if (memcmp(h, "DSD ", 4) != 0)
+    add(0, "dsd-id", "DSD chunk doesn't start with 'DSD '");
+  if (le64(h + 4) != DSFHeader::DSD_HEADER_SIZE) {
+    os << "DSD chunk size is " << le64(h + 4) << ", not 28";
+    add(4, "dsd-size", detail());
+  }
+  uint64_t fileSize = le64(h + 12);
+  if (fileSize != length) {
+    os << "file size is " << fileSize << ", the file is " << length;
+    os << " bytes long";
+    add(12, "file-size", detail());
+  }
+  uint64_t ID3v2Offset = le64(h + 20);
+
+  // fmt chunk
+  const unsigned char *f = h + DSFHeader::DSD_HEADER_SIZE;
+  uint64_t at = DSFHeader::DSD_HEADER_SIZE;
+  bool sane = true; // whether the data chunk size can be worked out
+  if (memcmp(f, "fmt ", 4) != 0)
+    add(at, "fmt-id", "fmt chunk doesn't start with 'fmt '");
+  if (le64(f + 4) != DSFHeader::FMT_HEADER_SIZE) {
+    os << "fmt chunk size is " << le64(f + 4) << ", not 52";
+    add(at + 4, "fmt-size", detail());
+  }
+  if (le32(f + 12) != 1) {
+    os << "format version is " << le32(f + 12) << ", not 1";
+    add(at + 12, "format-version", detail());
+  }
+  if (le32(f + 16) != 0) {
+    os << "format ID is " << le32(f + 16) << ", not 0 (DSD raw)";
+    add(at + 16, "format-id", detail());
+  }
+  uint32_t channelType = le32(f + 20);
+  uint32_t channels = le32(f + 24);
+  if (channelType < 1 || channelType > 7) {
+    os << "channel type " << channelType << " is out of range";
+    add(at + 20, "channel-type", detail());
+    if (channels < 1 || channels > 6)
+      sane = false;
+  } else if (channels != CHANNELS[channelType]) {
+    os << channels << " channels, channel type " << channelType;
+    os << " has " << CHANNELS[channelType];
+    add(at + 24, "channel-num", detail());
+    sane = channels >= 1 && channels <= 6;
+  }
+  uint32_t sampleRate = le32(f + 28);
+  if (sampleRate != 2822400 && sampleRate != 5644800 &&
+      sampleRate != 11289600 && sampleRate != 22579200) {
+    os << "sampling frequency " << sampleRate << " Hz isn't a DSD rate";
+    add(at + 28, "sample-rate", detail());
+  }
+  uint32_t bitsPerSample = le32(f + 32);
+  if (bitsPerSample != 1 && bitsPerSample != 8) {
+    os << bitsPerSample << " bits per sample, not 1 or 8";
+    add(at + 32, "bits-per-sample", detail());
+    sane = false;
+  }
+  uint64_t sampleCount = le64(f + 36);
+  if (sampleCount == 0)
+    add(at + 36, "sample-count", "no samples");
+  if (le32(f + 44) != BLOCK_SIZE) {
+    os << "block size per channel is " << le32(f + 44) << ", not 4096";
+    add(at + 44, "block-size", detail());
+  }
+  if (le32(f + 48) != 0)
+    add(at + 48, "reserved", "reserved field isn't zero");
+
+  // data chunk: the blocks needed for the samples, nothing more
+  const unsigned char *c = f + DSFHeader::FMT_HEADER_SIZE;
+  at += DSFHeader::FMT_HEADER_SIZE;
+  if (memcmp(c, "data", 4) != 0)
+    add(at, "data-id", "data chunk doesn't start with 'data'");
+  uint64_t chunkSize = le64(c + 4);
+  uint64_t dataStart = at + DSFHeader::DATA_HEADER_SIZE;
+  uint64_t dataEnd = at + chunkSize;
+  if (chunkSize < DSFHeader::DATA_HEADER_SIZE) {
+    os << "data chunk size " << chunkSize << " is less than its header";
+    add(at + 4, "data-size", detail());
+    dataEnd = dataStart;
+    sane = false;
+  }
+  if (sane) {
+    uint64_t perBlock = BLOCK_SIZE * 8 / bitsPerSample;
+    uint64_t blocks = (sampleCount + perBlock - 1) / perBlock;
+    uint64_t expected = blocks * BLOCK_SIZE * channels;
+    if (chunkSize - DSFHeader::DATA_HEADER_SIZE != expected) {
+      os << "data chunk holds " << chunkSize - DSFHeader::DATA_HEADER_SIZE;
+      os << " bytes of audio, " << sampleCount << " samples of ";
+      os << channels << " channels take " << expected;
+      add(at + 4, "data-size", detail());
+    }
+
+    // Unused end of the last blocks
+    uint64_t used = (sampleCount % perBlock * bitsPerSample + 7) / 8;
+    if (blocks > 0 && used > 0 && dataStart + expected <= dataEnd) {
+      uint64_t last = dataStart + (blocks - 1) * BLOCK_SIZE * 
+	channels;
+      for (unsigned int ch = 0; ch < channels; ch++) {
+	uint64_t block = last + ch * BLOCK_SIZE;
+	padding.push_back(std::make_pair(block + used, 
+					 block + BLOCK_SIZE));
+      }
+    }
+  }
+  if (dataEnd > length) {
+    os << "data chunk ends at " << dataEnd << ", past the end of the file";
+    add(at + 4, "data-size", detail());
+  }
+
+  // ID3v2 chunk, right after the data chunk and inside the file
+  uint64_t end = dataEnd;
+  if (ID3v2Offset != 0) {
+    if (ID3v2Offset != dataEnd) {
+      os << "metadata pointer is " << ID3v2Offset << ", the data chunk ";
+      os << "ends at " << dataEnd;
+      add(20, "metadata-offset", detail());
+    }
+
+    unsigned char t[10];
+    if (ID3v2Offset + sizeof(t) > length ||
+	pread(fd, t, sizeof(t), ID3v2Offset) != sizeof(t)) {
+      os << "metadata pointer " << ID3v2Offset;
+      os << " is past the end of the file";
+      add(20, "metadata-offset", detail());
+    } else if (memcmp(t, "ID3", 3) != 0) {
+      add(ID3v2Offset, "id3v2-id", "no ID3v2 tag at the metadata pointer");
+    } else {
+      TagLib::ID3v2::Header th(TagLib::ByteVector(
+				 reinterpret_cast<const char *>(t), sizeof(t)));
+      end = ID3v2Offset + th.completeTagSize();
+      if (end > length) {
+	os << "ID3v2 tag ends at " << end << ", past the end of the file";
+	add(ID3v2Offset, "id3v2-size", detail());
+      }
+    }
+  }
+  if (end < length) {
+    os << length - end << " bytes after the last chunk";
+    add(end, "trailing-data", detail());
+  }
+}
+
+void DSFVerifier::VerifierPrivate::readAll()
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  std::vector<unsigned char> buf(READ_SIZE);
+  for (uint64_t pos = 0; pos < length; ) {
+    ssize_t n = pread(fd, &buf[0], READ_SIZE, pos);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      // Go on after the part that can't be read
+      add(pos, "read-error", n < 0 ? strerror(errno) : "unexpected end");
+      pos += READ_SIZE - pos % READ_SIZE;
+      continue;
+    }
+
+    for (auto &z : padding) {
+      uint64_t from = std::max(z.first, pos);
+      uint64_t to = std::min(z.second, pos + n);
+      for (uint64_t i = from; i < to; i++) {
+	if (buf[i - pos] != 0) {
+	  add(i, "padding", "unused end of a block isn't zero");
+	  break;
+	}
+      }
+    }
+    pos += n;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public members
+////////////////////////////////////////////////////////////////////////////////
+
+DSFVerifier::DSFVerifier(const char *file)
+{
+  d = new VerifierPrivate;
+
+  d->fd = open(file, O_RDONLY);
+  struct stat st;
+  if (d->fd < 0 || fstat(d->fd, &st) != 0)
+    return;
+  d->isOpen = true;
+  d->length = st.st_size;
+
+  const unsigned int size = DSFHeader::DSD_HEADER_SIZE + 
+    DSFHeader::FMT_HEADER_SIZE + DSFHeader::DATA_HEADER_SIZE;
+  unsigned char h[size];
+  if (d->length < size || pread(d->fd, h, size, 0) != size) {
+    std::ostringstream os;
+    os << "file is " << d->length << " bytes long, the headers take " << size;
+    d->add(0, "truncated", os.str());
+  } else {
+    d->checkHeaders(h);
+  }
+
+  d->readAll();
+  std::stable_sort(d->violations.begin(), d->violations.end(), 
+		   [](const Violation &a, const Violation &b) {
+		     return a.offset < b.offset;
+		   });
+}
+
+DSFVerifier::~DSFVerifier()
+{
+  delete d;
+}
+
+bool DSFVerifier::isOpen() const
+{
+  return d->isOpen;
+}
+
+const std::vector<DSFVerifier::Violation> &DSFVerifier::violations() const
+{
+  return d->violations;
+}
@@ -0,0 +1,94 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_DSFVERIFIER_H
+#define TAGLIB_DSFVERIFIER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+//! Checks the structure of a DSF file and that all of it can be read
+
+/*!
+ * Every field of the DSD, fmt and data chunk headers is checked, then
+ * the sizes they give against each other and against the file:
+ *
+ * - the data chunk holds exactly the blocks needed for the sample
+ *   count, 4096 bytes per channel each, and lies within the file
+ * - the file size in the DSD chunk is the length of the file
+ * - the metadata pointer leads to an ID3v2 tag right after the data
+ *   chunk, which lies fully inside the file
+ * - nothing follows the last chunk
+ * - the unused end of the last block of every channel is zero
+ *
+ * The whole file is then read from start to end, in large sequential
+ * reads, so that unreadable parts are found too.  Unlike DSFHeader,
+ * nothing stops at the first problem: all of them are reported, each
+ * with the offset of the bytes concerned.
+ */
+
+class DSFVerifier
+{
+ public:
+  //! One problem found
+  struct Violation {
+    uint64_t offset;     // in the file
+    std::string check;   // short name of the check, e.g. "file-size"
+    std::string detail;  // what's wrong, for humans
+  };
+
+  /*!
+   * Examines \a file.
+   */
+  DSFVerifier(const char *file);
+
+  /*!
+   * Destroys this instance.
+   */
+  ~DSFVerifier();
+
+  /*!
+   * Returns true if the file could be opened.
+   */
+  bool isOpen() const;
+
+  /*!
+   * Returns the problems found, in the order of their offsets, empty if
+   * the file is fine.
+   */
+  const std::vector<Violation> &violations() const;
+
+  /*!
+   * Size of the reads of the whole file.
+   */
+  static const unsigned int READ_SIZE = 1 << 20;
+
+ private:
+  DSFVerifier(const DSFVerifier &);
+  DSFVerifier &operator=(const DSFVerifier &);
+
+  class VerifierPrivate;
+  VerifierPrivate *d;
+};
+
+#endif
@@ -0,0 +1,186 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+#include "groupcommit.h"
+#include "batch.h"
+
+//////////////////////////// IMPL //////////////////////////////
+class GroupCommit::GroupCommitImpl {
+ public:
+  struct Entry {
+    std::string file;
+    int fd;
+    dev_t dev;
+    bool synced; // set by sync()
+  };
+
+  GroupCommitImpl(unsigned int waveSize) :
+    _waveSize(waveSize > 0 ? waveSize : 1),
+    _waves(0),
+    _failures(0),
+    _syncMicros(0)
+  {}
+  ~GroupCommitImpl() {}
+
+  // Sync and close all files of a wave, reporting every file that
+  // failed. Returns their number.
+  static unsigned int sync(std::vector<Entry> &wave);
+
+  /////////////// Variables //////////////
+  unsigned int _waveSize;
+  unsigned int _waves;
+  unsigned int _failures;
+  uint64_t _syncMicros;
+
+  std::vector<Entry> _queued;
+  std::mutex _lock;      // protects everything above
+  std::mutex _syncLock;  // one wave at a time
+};
+
+unsigned int GroupCommit::GroupCommitImpl::sync(std::vector<Entry> &wave)
+{
+  unsigned int failed = 0;
+
+#ifdef __linux__
+  // One syncfs() per file system
+  std::map<dev_t, bool> synced; // => success
+  for (auto &e : wave) {
+    auto it = synced.find(e.dev);
+    if (it == synced.end())
+      it = synced.insert(std::make_pair(e.dev, syncfs(e.fd) == 0)).first;
+    e.synced = it->second;
+  }
+#else
+  for (auto &e : wave)
+    e.synced = fsync(e.fd) == 0;
+#endif
+
+  // Whoever completes the wave reports the files of the others too,
+  // hence the names
+  for (auto &e : wave) {
+    if (!e.synced) {
+      BatchProcessor::err() << e.file << ": sync failed" << std::endl;
+      failed++;
+    }
+    close(e.fd);
+  }
+  wave.clear();
+  return failed;
+}
+
+///////////////////////////// GROUPCOMMIT //////////////////////////
+GroupCommit::GroupCommit(unsigned int waveSize)
+{
+  _i = new GroupCommitImpl(waveSize);
+}
+
+GroupCommit::~GroupCommit()
+{
+  flush();
+  delete _i;
+}
+
+bool GroupCommit::add(const char *file)
+{
+  GroupCommitImpl::Entry e;
+  struct stat st;
+
+  e.file = file;
+  e.fd = open(file, O_RDONLY);
+  if (e.fd >= 0 && fstat(e.fd, &st) != 0) {
+    close(e.fd);
+    e.fd = -1;
+  }
+  if (e.fd < 0) {
+    BatchProcessor::err() << file << ": can't be queued for sync" 
+			  << std::endl;
+    return false;
+  }
+  e.dev = st.st_dev;
+  e.synced = false;
+
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(_i->_lock);
+    _i->_queued.push_back(e);
+    full = _i->_queued.size() >= _i->_waveSize;
+  }
+
+  // The thread completing a wave pays for it, which also keeps the
+  // others from running too far ahead. Its failures are counted by
+  // failures(), not held against this file.
+  if (full)
+    flush();
+  return true;
+}
+
+bool GroupCommit::flush()
+{
+  std::lock_guard<std::mutex> syncLock(_i->_syncLock);
+  std::vector<GroupCommitImpl::Entry> wave;
+
+  {
+    std::lock_guard<std::mutex> lock(_i->_lock);
+    wave.swap(_i->_queued);
+  }
+  if (wave.empty())
+    return true;
+
+  auto start = std::chrono::steady_clock::now();
+  unsigned int failed = GroupCommitImpl::sync(wave);
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>
+    (std::chrono::steady_clock::now() - start).count();
+
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  _i->_waves++;
+  _i->_failures += failed;
+  _i->_syncMicros += us;
+  return failed == 0;
+}
+
+unsigned int GroupCommit::waves() const
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  return _i->_waves;
+}
+
+unsigned int GroupCommit::failures() const
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  return _i->_failures;
+}
+
+uint64_t GroupCommit::syncMicros() const
+{
+  std::lock_guard<std::mutex> lock(_i->_lock);
+  return _i->_syncMicros;
+}
@@ -0,0 +1,71 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _GROUPCOMMIT_H_
+#define _GROUPCOMMIT_H_
+
+#include <stdint.h>
+
+//
+// Makes saved files durable in waves instead of one at a time.
+//
+// Saved files are queued with add(). Once a wave is full, one syncfs()
+// is issued per file system the queued files live on, which lets the
+// disk write everything back in one go rather than seeking back and
+// forth for every single fdatasync(). Where syncfs() isn't available
+// every file is fsync()'ed, still in one burst.
+//
+// Can be shared by worker threads.
+//
+class GroupCommit {
+ public:
+  // Sync whenever waveSize files are queued
+  GroupCommit(unsigned int waveSize = 64);
+
+  // Syncs whatever is still queued
+  ~GroupCommit();
+
+  // Queue a file that has been saved. Returns false if it can't be
+  // opened, in which case nothing is queued. Whether it gets synced is
+  // only known from failures() and the error reported with its name.
+  bool add(const char *file);
+
+  // Sync all queued files now. Returns false if any sync failed.
+  bool flush();
+
+  // Number of waves synced so far
+  unsigned int waves() const;
+
+  // Number of files whose sync failed
+  unsigned int failures() const;
+
+  // Total time spent syncing, in microseconds
+  uint64_t syncMicros() const;
+
+ private:
+  GroupCommit(const GroupCommit &);
+  GroupCommit &operator=(const GroupCommit &);
+
+  class GroupCommitImpl;
+  GroupCommitImpl *_i;
+};
+
+#endif
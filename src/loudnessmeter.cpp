@@ -0,0 +1,349 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define METER_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define METER_NEON
+#endif
+
+#include "loudnessmeter.h"
+
+namespace
+{
+  const unsigned int LANES = 4;   // channels filtered together
+  const size_t CHUNK = 1024;      // frames moved into lanes at a time
+  const unsigned int STEPS = 4;   // of 100 ms in a block
+
+  // Blocks below -70 LUFS, as mean squares
+  const double ABSOLUTE_GATE = pow(10, (-70 + 0.691) / 10);
+
+  // The two biquads of the K-weighting, direct form II transposed
+  struct Filter {
+    double b[2][3];
+    double a[2][2];
+  };
+
+  // Filter state of a group of channels: z1 and z2 of both biquads, and
+  // the sum of squares of the output since the last step
+  struct State {
+    double z[4][LANES];
+    double sum[LANES];
+  };
+
+  // The filters of BS.1770 are given for 48 kHz. These are the analog
+  // prototypes they come from, so that any rate works.
+  Filter kWeighting(double rate)
+  {
+    Filter f;
+
+    // High shelf, +4 dB above 1.5 kHz, the head
+    double K = tan(M_PI * 1681.974450955533 / rate);
+    double Q = 0.7071752369554196;
+    double Vh = pow(10, 3.999843853973347 / 20);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1 + K / Q + K * K;
+    f.b[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+    f.b[0][1] = 2 * (K * K - Vh) / a0;
+    f.b[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+    f.a[0][0] = 2 * (K * K - 1) / a0;
+    f.a[0][1] = (1 - K / Q + K * K) / a0;
+
+    // High pass at 38 Hz
+    K = tan(M_PI * 38.13547087602444 / rate);
+    Q = 0.5003270373238773;
+    a0 = 1 + K / Q + K * K;
+    f.b[1][0] = 1;
+    f.b[1][1] = -2;
+    f.b[1][2] = 1;
+    f.a[1][0] = 2 * (K * K - 1) / a0;
+    f.a[1][1] = (1 - K / Q + K * K) / a0;
+    return f;
+  }
+
+  ////////////////////////////// kernels //////////////////////////////
+
+  // n frames of LANES samples at x
+  void filterScalar(const Filter &f, State &s, const double *x, size_t n)
+  {
+    for (size_t i = 0; i < n; i++, x += LANES) {
+      for (unsigned int l = 0; l < LANES; l++) {
+	double y = f.b[0][0] * x[l] + s.z[0][l];
+	s.z[0][l] = f.b[0][1] * x[l] - f.a[0][0] * y + s.z[1][l];
+	s.z[1][l] = f.b[0][2] * x[l] - f.a[0][1] * y;
+	double k = f.b[1][0] * y + s.z[2][l];
+	s.z[2][l] = f.b[1][1] * y - f.a[1][0] * k + s.z[3][l];
+	s.z[3][l] = f.b[1][2] * y - f.a[1][1] * k;
+	s.sum[l] += k * k;
+      }
+    }
+  }
+
+#ifdef METER_X86
+  __attribute__((target("avx2,fma")))
+  void filterAVX2(const Filter &f, State &s, const double *x, size_t n)
+  {
+    const __m256d b00 = _mm256_set1_pd(f.b[0][0]);
+    const __m256d b01 = _mm256_set1_pd(f.b[0][1]);
+    const __m256d b02 = _mm256_set1_pd(f.b[0][2]);
+    const __m256d a00 = _mm256_set1_pd(f.a[0][0]);
+    const __m256d a01 = _mm256_set1_pd(f.a[0][1]);
+    const __m256d b10 = _mm256_set1_pd(f.b[1][0]);
+    const __m256d b11 = _mm256_set1_pd(f.b[1][1]);
+    const __m256d b12 = _mm256_set1_pd(f.b[1][2]);
+    const __m256d a10 = _mm256_set1_pd(f.a[1][0]);
+    const __m256d a11 = _mm256_set1_pd(f.a[1][1]);
+
+    __m256d z0 = _mm256_loadu_pd(s.z[0]);
+    __m256d z1 = _mm256_loadu_pd(s.z[1]);
+    __m256d z2 = _mm256_loadu_pd(s.z[2]);
+    __m256d z3 = _mm256_loadu_pd(s.z[3]);
+    __m256d sum = _mm256_loadu_pd(s.sum);
+    for (size_t i = 0; i < n; i++) {
+      __m256d in = _mm256_loadu_pd(x + i * LANES);
+      __m256d y = _mm256_fmadd_pd(b00, in, z0);
+      z0 = _mm256_fnmadd_pd(a00, y, _mm256_fmadd_pd(b01, in, z1));
+      z1 = _mm256_fnmadd_pd(a01, y, _mm256_mul_pd(b02, in));
+      __m256d k = _mm256_fmadd_pd(b10, y, z2);
+      z2 = _mm256_fnmadd_pd(a10, k, _mm256_fmadd_pd(b11, y, z3));
+      z3 = _mm256_fnmadd_pd(a11, k, _mm256_mul_pd(b12, y));
+      sum = _mm256_fmadd_pd(k, k, sum);
+    }
+    _mm256_storeu_pd(s.z[0], z0);
+    _mm256_storeu_pd(s.z[1], z1);
+    _mm256_storeu_pd(s.z[2], z2);
+    _mm256_storeu_pd(s.z[3], z3);
+    _mm256_storeu_pd(s.sum, sum);
+  }
+#endif
+
+#ifdef METER_NEON
+  // Two registers of two lanes each
+  void filterNEON(const Filter &f, State &s, const double *x, size_t n)
+  {
+    for (unsigned int h = 0; h < LANES; h += 2) {
+      float64x2_t z0 = vld1q_f64(s.z[0] + h);
+      float64x2_t z1 = vld1q_f64(s.z[1] + h);
+      float64x2_t z2 = vld1q_f64(s.z[2] + h);
+      float64x2_t z3 = vld1q_f64(s.z[3] + h);
+      float64x2_t sum = vld1q_f64(s.sum + h);
+      for (size_t i = 0; i < n; i++) {
+	float64x2_t in = vld1q_f64(x + i * LANES + h);
+	float64x2_t y = vfmaq_n_f64(z0, in, f.b[0][0]);
+	z0 = vfmsq_n_f64(vfmaq_n_f64(z1, in, f.b[0][1]), y, f.a[0][0]);
+	z1 = vfmsq_n_f64(vmulq_n_f64(in, f.b[0][2]), y, f.a[0][1]);
+	float64x2_t k = vfmaq_n_f64(z2, y, f.b[1][0]);
+	z2 = vfmsq_n_f64(vfmaq_n_f64(z3, y, f.b[1][1]), k, f.a[1][0]);
+	z3 = vfmsq_n_f64(vmulq_n_f64(y, f.b[1][2]), k, f.a[1][1]);
+	sum = vfmaq_f64(sum, k, k);
+      }
+      vst1q_f64(s.z[0] + h, z0);
+      vst1q_f64(s.z[1] + h, z1);
+      vst1q_f64(s.z[2] + h, z2);
+      vst1q_f64(s.z[3] + h, z3);
+      vst1q_f64(s.sum + h, sum);
+    }
+  }
+#endif
+
+  // The best kernel this CPU can run, picked once
+  struct Kernels {
+    Kernels() : filter(filterScalar), name("scalar") {
+#ifdef METER_X86
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+	filter = filterAVX2;
+	name = "AVX2";
+      }
+#elif defined(METER_NEON)
+      filter = filterNEON;
+      name = "NEON";
+#endif
+    }
+
+    void (*filter)(const Filter &, State &, const double *, size_t);
+    const char *name;
+  };
+
+  const Kernels &kernels()
+  {
+    static const Kernels k;
+    return k;
+  }
+
+  // Integrated loudness of the blocks of all the lists, in LUFS
+  double gate(const std::vector<const std::vector<double> *> &lists)
+  {
+    double sum = 0;
+    size_t n = 0;
+    for (auto l : lists)
+      for (double z : *l)
+	if (z > ABSOLUTE_GATE) {
+	  sum += z;
+	  n++;
+	}
+    if (n == 0)
+      return -HUGE_VAL;
+
+    // 10 LU below what's left
+    double relative = sum / n / 10;
+    sum = 0;
+    n = 0;
+    for (auto l : lists)
+      for (double z : *l)
+	if (z > ABSOLUTE_GATE && z > relative) {
+	  sum += z;
+	  n++;
+	}
+    return -0.691 + 10 * log10(sum / n);
+  }
+}
+
+class LoudnessMeter::MeterPrivate
+{
+public:
+  MeterPrivate(unsigned int sampleRate, unsigned int channels) :
+    channels(channels),
+    weights(channels, 1.0),
+    filter(kWeighting(sampleRate)),
+    states((channels + LANES - 1) / LANES),
+    lanes(CHUNK * LANES),
+    stepSize(sampleRate / 10),
+    filled(0),
+    steps(0),
+    peak(0)
+  {
+    memset(&states[0], 0, states.size() * sizeof(State));
+    if (stepSize == 0)
+      stepSize = 1;
+  }
+
+  // Sum up the step that just ended, and the block ending with it
+  void closeStep();
+
+  unsigned int channels;
+  std::vector<double> weights;
+  Filter filter;
+  std::vector<State> states;   // one per LANES channels
+  std::vector<double> lanes;   // input of the filters
+  size_t stepSize;             // frames in 100 ms
+  size_t filled;               // of the current step
+  double last[STEPS];          // weighted mean squares of the last steps
+  uint64_t steps;
+  std::vector<double> blocks;  // weighted mean square of every block
+  double peak;
+};
+
+void LoudnessMeter::MeterPrivate::closeStep()
+{
+  double energy = 0;
+  for (unsigned int ch = 0; ch < channels; ch++)
+    energy += weights[ch] * states[ch / LANES].sum[ch % LANES];
+  for (size_t g = 0; g < states.size(); g++)
+    memset(states[g].sum, 0, sizeof(states[g].sum));
+
+  last[steps++ % STEPS] = energy / stepSize;
+  if (steps >= STEPS) {
+    double block = 0;
+    for (unsigned int i = 0; i < STEPS; i++)
+      block += last[i];
+    blocks.push_back(block / STEPS);
+  }
+  filled = 0;
+}
+
+//////////////////////////// PUBLIC //////////////////////////////
+
+LoudnessMeter::LoudnessMeter(unsigned int sampleRate, unsigned int channels) :
+  d(new MeterPrivate(sampleRate, channels))
+{
+}
+
+LoudnessMeter::~LoudnessMeter()
+{
+  delete d;
+}
+
+void LoudnessMeter::setWeight(unsigned int ch, double weight)
+{
+  if (ch < d->channels)
+    d->weights[ch] = weight;
+}
+
+void LoudnessMeter::process(const float *frames, size_t count)
+{
+  const unsigned int channels = d->channels;
+  for (size_t i = 0; i < count * channels; i++)
+    if (fabs(frames[i]) > d->peak)
+      d->peak = fabs(frames[i]);
+
+  while (count > 0) {
+    size_t n = d->stepSize - d->filled;
+    if (n > CHUNK)
+      n = CHUNK;
+    if (n > count)
+      n = count;
+
+    for (size_t g = 0; g < d->states.size(); g++) {
+      for (unsigned int l = 0; l < LANES; l++) {
+	unsigned int ch = g * LANES + l;
+	for (size_t i = 0; i < n; i++)
+	  d->lanes[i * LANES + l] = 
+	    ch < channels ? frames[i * channels + ch] : 0;
+      }
+      kernels().filter(d->filter, d->states[g], &d->lanes[0], n);
+    }
+
+    frames += n * channels;
+    count -= n;
+    d->filled += n;
+    if (d->filled == d->stepSize)
+      d->closeStep();
+  }
+}
+
+double LoudnessMeter::loudness() const
+{
+  return gate(std::vector<const std::vector<double> *>(1, &d->blocks));
+}
+
+double LoudnessMeter::peak() const
+{
+  return d->peak;
+}
+
+double LoudnessMeter::loudness(const std::vector<const LoudnessMeter *> &meters)
+{
+  std::vector<const std::vector<double> *> lists;
+  for (auto m : meters)
+    lists.push_back(&m->d->blocks);
+  return gate(lists);
+}
+
+const char *LoudnessMeter::kernel()
+{
+  return kernels().name;
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef TAGLIB_LOUDNESSMETER_H
+#define TAGLIB_LOUDNESSMETER_H
+
+#include <stddef.h>
+#include <vector>
+
+//! Integrated loudness of PCM audio, after ITU-R BS.1770 / EBU R128
+
+/*!
+ * Every channel goes through the K-weighting filters, a high shelf and
+ * a high pass, and its mean square is taken over blocks of 400 ms
+ * overlapping by 75%. Blocks quieter than -70 LUFS, then those 10 LU
+ * below the mean of the rest, are gated out and the integrated loudness
+ * is the mean of the blocks left.
+ *
+ * Channels are filtered four at a time, one per lane of an AVX2 or two
+ * NEON registers where the CPU has them, in double precision.
+ *
+ * The sample peak is measured too, so that ReplayGain values can be
+ * worked out of it.
+ */
+
+class LoudnessMeter
+{
+ public:
+  /*!
+   * Measures \a channels channels at \a sampleRate, all of weight 1.
+   */
+  LoudnessMeter(unsigned int sampleRate, unsigned int channels);
+
+  /*!
+   * Destroys this instance.
+   */
+  ~LoudnessMeter();
+
+  /*!
+   * Sets the weight of channel \a ch: 1.41 for surround channels, 0 to
+   * leave out the LFE.
+   */
+  void setWeight(unsigned int ch, double weight);
+
+  /*!
+   * Goes on with \a count frames at \a frames, channels interleaved.
+   */
+  void process(const float *frames, size_t count);
+
+  /*!
+   * Returns the integrated loudness in LUFS, or -HUGE_VAL if there
+   * isn't a single block above the gates, e.g. for less than 400 ms of
+   * audio.
+   */
+  double loudness() const;
+
+  /*!
+   * Returns the highest absolute sample value, 1 being full scale.
+   */
+  double peak() const;
+
+  /*!
+   * Returns the integrated loudness of all the audio measured by
+   * \a meters, as if it were a single stream: the loudness of an album.
+   */
+  static double loudness(const std::vector<const LoudnessMeter *> &meters);
+
+  /*!
+   * Returns the name of the instruction set of the filters: "AVX2",
+   * "NEON" or "scalar".
+   */
+  static const char *kernel();
+
+ private:
+  LoudnessMeter(const LoudnessMeter &);
+  LoudnessMeter &operator=(const LoudnessMeter &);
+
+  class MeterPrivate;
+  MeterPrivate *d;
+};
+
+#endif
@@ -20,26 +20,118 @@
  ***************************************************************************/
 
 #include <tuple>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <iomanip>
+#include <sstream>
+#include <mutex>
+#include <set>
+#include <cmath>
 #include "metadsf.h"
 #include "utils.h"
 #include "options.h"
+#include "batch.h"
+#include "sharedframes.h"
+#include "dsfprobe.h"
+#include "dsfscanner.h"
+#include "dsfrepair.h"
+#include "groupcommit.h"
+#include "catalog.h"
+#include "tagquery.h"
+#include "dirwalker.h"
+#include "manifest.h"
+#include "cli.h"
+#include "catalogwatcher.h"
+#include "pcmconverter.h"
+#include "dsddecimator.h"
+#include "audiohash.h"
+#include "dsfverifier.h"
+#include "dsdanalyzer.h"
+#include "dsfdatareader.h"
+#include "loudnessmeter.h"
+#include "dsdiffconverter.h"
 
 typedef std::tuple<const TagLib::String, 
 		   TagLib::ID3v2::AttachedPictureFrame::Type, 
 		   const TagLib::String> PicTuple;
 typedef std::list<PicTuple> PicTupleList; 
 
+// Pictures to be imported, loaded once per run and keyed by path. 
+// Every frame created from an entry shares the same ByteVector payload.
+typedef std::map<TagLib::String, TagLib::ByteVector> PictureCache;
+
+// Counters shared by all worker threads
+struct RunStats {
+  RunStats() : saved(0), skipped(0), bytes(0), saveMicros(0) {}
+
+  std::atomic<unsigned int> saved;   // files written to disk
+  std::atomic<unsigned int> skipped; // edited files left untouched
+  std::atomic<uint64_t> bytes;       // bytes written by all saves
+  std::atomic<uint64_t> saveMicros;  // time spent in save()
+};
+
+// Integrated loudness in LUFS and sample peak, of a track or an album
+struct Loudness {
+  double lufs;
+  double peak;
+};
+
 bool doDelete(MetaDSF &, OptionObj &);
-bool doAdd(MetaDSF &, OptionObj &);
-bool validatePictures(OptionObj &, PicTupleList &);
-bool importPictures(MetaDSF &, PicTupleList &);
+bool isEditing(OptionObj &, SharedFrames &);
+bool isReadOnly(OptionObj &, SharedFrames &);
+bool validatePictures(OptionObj &, PicTupleList &, std::ostream &);
+bool loadPictures(PicTupleList &, PictureCache &, std::ostream &);
+void buildSharedFrames(OptionObj &, PicTupleList &, PictureCache &, 
+		       SharedFrames &);
+bool processFile(const TagLib::String &, OptionObj &, SharedFrames &,
+		 const Manifest &, RunStats &, DSFFile::Durability, 
+		 GroupCommit *, std::ostream &, std::ostream &);
+bool printProbe(const TagLib::String &, OptionObj &, TagQuery *,
+		DSFProbe &, std::ostream &, std::ostream &);
+bool printCataloged(const TagLib::String &, OptionObj &, TagQuery *,
+		    Catalog &, std::ostream &, std::ostream &);
+std::string filePrefix(const TagLib::String &, OptionObj &);
+unsigned int addFiles(OptionObj &, const std::string &, std::ostream &,
+		      const std::function<void (const TagLib::String &)> &);
+void printStats(RunStats &, const TagLib::String &, GroupCommit *, 
+		uint64_t, std::ostream &);
+bool repairFile(const TagLib::String &, const std::string &, 
+		std::ostream &, std::ostream &);
+bool convertFile(const TagLib::String &, OptionObj &, unsigned int,
+		 PCMConverter::Format, std::ostream &, std::ostream &);
+bool convertDSDIFF(const TagLib::String &, OptionObj &, std::ostream &, 
+		   std::ostream &);
+std::string replaceExtension(const TagLib::String &, const char *);
+bool hashFile(const TagLib::String &, OptionObj &, AudioHash::Algorithm,
+	      unsigned int, DSFFile::Durability, GroupCommit *, 
+	      std::ostream &, std::ostream &);
+bool verifyFile(const TagLib::String &, std::ostream &, std::ostream &);
+bool analyzeFile(const TagLib::String &, OptionObj &, unsigned int,
+		 DSFFile::Durability, GroupCommit *, 
+		 std::ostream &, std::ostream &);
+void prepareSave(MetaDSF &, OptionObj &, DSFFile::Durability, 
+		 GroupCommit *);
+std::unique_ptr<LoudnessMeter> measureLoudness(const TagLib::String &,
+					       std::ostream &);
+bool saveReplayGain(const TagLib::String &, OptionObj &, const Loudness &,
+		    const Loudness *, DSFFile::Durability, GroupCommit *, 
+		    std::ostream &, std::ostream &);
 
-void displayVersion() {
-  std::cout << PROG << " version " << VERSION << std::endl;
+void displayVersion(std::ostream &out) {
+  out << PROG << " version " << VERSION << std::endl;
 }
 
-int main(int argc, char *argv[])
+int run(int argc, char *argv[], const RunContext *context)
 {
+  // metadsfd hands over the client's streams. Diagnostics of code
+  // that isn't handed them go there too.
+  std::ostream &out = context && context->out ? *context->out : std::cout;
+  std::ostream &err = context && context->err ? *context->err : std::cerr;
+  BatchProcessor::ErrScope errScope(err);
+
   // Command line parsing using a wrapper around 
   // "The Lean Mean C++ Option Parser"
   // http://optionparser.sourceforge.net/
@@ -48,20 +140,66 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  // The paths of a metadsfd client are relative to its directory, not
+  // to the daemon's
+  std::string cwd = context ? context->cwd : "";
+  if (!cwd.empty()) {
+    auto resolve = [&](TagLib::String &path) {
+      if (!path.isEmpty())
+	path = resolvePath(path.toCString(), cwd);
+    };
+    for (auto &fileName : opt.fileList)
+      resolve(fileName);
+    if (opt.filesFrom != "-")
+      resolve(opt.filesFrom);
+    resolve(opt.manifest);
+    resolve(opt.catalog);
+    resolve(opt.setTagsFile);
+    resolve(opt.addTagsFile);
+    // PATH|type|comment, PATH comes first
+    for (auto &p : opt.addPicList)
+      resolve(p);
+  }
+
   if (opt.showHelp) {
-    displayVersion();
-    opt.printUsage();
+    displayVersion(out);
+    opt.printUsage(out);
     return 0;
   }
 
   if (opt.showVersion) {
-    displayVersion();
+    displayVersion(out);
+    return 0;
+  }
+
+  // Nothing else happens in watch mode
+  if (opt.watch) {
+    // It never returns, and takes over the signals
+    if (context) {
+      err << "--watch can't be run by metadsfd" << std::endl;
+      return 1;
+    }
+    if (opt.catalog.isEmpty()) {
+      err << "--watch needs a --catalog" << std::endl;
+      return 1;
+    }
+    if (!CatalogWatcher::isSupported()) {
+      err << "--watch is not supported on this system" << std::endl;
+      return 1;
+    }
+
+    Catalog catalog(opt.catalog.toCString());
+    CatalogWatcher watcher(catalog);
+    for (auto &dir : opt.fileList)
+      if (!watcher.add(absolutePath(dir.toCString()), out))
+	return 1;
+    watcher.run(out);
     return 0;
   }
 
   // Validate encoding if supplied
   if (!opt.encoding.isEmpty() && !MetaDSF::isValidEncoding(opt.encoding)) {
-    std::cerr << "Invalid encoding: " << opt.encoding << std::endl;
+    err << "Invalid encoding: " << opt.encoding << std::endl;
     return 1;
   }
 
@@ -69,19 +207,99 @@ int main(int argc, char *argv[])
   if (!opt.version.isEmpty() && opt.version.toInt() != 3 && 
       opt.version.toInt() != 4) 
   {
-    std::cerr << "Invalid ID3v2 version: " << opt.version << std::endl;
+    err << "Invalid ID3v2 version: " << opt.version << std::endl;
+    return 1;
+  }
+
+
+  // Validate number of jobs if supplied
+  long jobs = context ? context->jobs : 1;
+  if (!opt.jobs.isEmpty() && 
+      (!stringToLong(opt.jobs.toCString(), jobs) || jobs < 0))
+  {
+    err << "Invalid number of jobs: " << opt.jobs << std::endl;
+    return 1;
+  }
+
+  // Past a few threads per core they only contend for the disk
+  const long maxJobs = 4 * BatchProcessor::defaultJobs();
+  if (jobs > maxJobs) {
+    err << "Too many jobs, using " << maxJobs << std::endl;
+    jobs = maxJobs;
+  }
+
+  // Validate durability policy
+  DSFFile::Durability durability = DSFFile::NoSync;
+  if (opt.durability == "file") {
+    durability = DSFFile::SyncFile;
+  } else if (opt.durability == "group") {
+    durability = DSFFile::SyncGroup;
+  } else if (!opt.durability.isEmpty() && opt.durability != "none") {
+    err << "Invalid durability: " << opt.durability << std::endl;
+    return 1;
+  }
+
+  // Validate the output of --to-wav
+  long pcmRate = 88200;
+  if (!opt.pcmRate.isEmpty() && 
+      (!stringToLong(opt.pcmRate.toCString(), pcmRate) || pcmRate <= 0))
+  {
+    err << "Invalid PCM rate: " << opt.pcmRate << std::endl;
+    return 1;
+  }
+
+  PCMConverter::Format pcmFormat = PCMConverter::Int24;
+  if (opt.pcmFormat == "float") {
+    pcmFormat = PCMConverter::Float32;
+  } else if (!opt.pcmFormat.isEmpty() && opt.pcmFormat != "24") {
+    err << "Invalid PCM format: " << opt.pcmFormat << std::endl;
+    return 1;
+  }
+
+  // Validate the algorithm of --audio-hash
+  AudioHash::Algorithm hashAlgorithm = AudioHash::XXH64;
+  if (!opt.hashAlgorithm.isEmpty() && 
+      !AudioHash::algorithmByName(opt.hashAlgorithm.toCString(), 
+				  hashAlgorithm))
+  {
+    err << "Invalid hash algorithm: " << opt.hashAlgorithm << std::endl;
+    return 1;
+  }
+  if (opt.storeAudioHash && !opt.audioHash) {
+    err << "--store-audio-hash needs --audio-hash" << std::endl;
     return 1;
   }
 
+  // Validate the window of --analyze
+  long analysisWindow = 4096;
+  if (!opt.analysisWindow.isEmpty() && 
+      (!stringToLong(opt.analysisWindow.toCString(), analysisWindow) || 
+       analysisWindow <= 0))
+  {
+    err << "Invalid analysis window: " << opt.analysisWindow;
+    err << std::endl;
+    return 1;
+  }
+  bool albumGain = opt.replayGainMode == "album";
+  if (!opt.replayGainMode.isEmpty() && !albumGain && 
+      opt.replayGainMode != "track")
+  {
+    err << "Invalid ReplayGain mode: " << opt.replayGainMode;
+    err << std::endl;
+    return 1;
+  }
+  if (opt.storeAnalysis && !opt.analyze) {
+    err << "--store-analysis needs --analyze" << std::endl;
+    return 1;
+  }
 
   // Load tag data from files
   StringMap tmp;
   if (!opt.setTagsFile.isEmpty()) {
     if (!readPairsFromFile(opt.setTagsFile.toCString(), tmp))
       return 1;
-    if (!opt.removeEverything)
-      for (auto &p: tmp)
-	opt.removeTagList.push_back(p.first);
+    for (auto &p: tmp)
+      opt.replaceTagList.push_back(p.first);
     opt.addTagMap.insert(tmp.begin(), tmp.end()); 
   }
   
@@ -101,7 +319,7 @@ int main(int argc, char *argv[])
   for (auto &p : opt.removePicList) {
     long t;
     if (!stringToLong(p.toCString(), t) || !MetaDSF::isValidPicType(t)) {
-      std::cerr << "Picture type '" << p << "' invalid'" << std::endl;
+      err << "Picture type '" << p << "' invalid'" << std::endl;
       return 1;
     }
   }
@@ -111,56 +329,883 @@ int main(int argc, char *argv[])
   //    (jpeg, tiff, gif...)
   // Check if types are correct
   PicTupleList picTupleList;
-  if (!validatePictures(opt, picTupleList)) {
+  if (!validatePictures(opt, picTupleList, err)) {
     return 1;
   }
 
+  // Read the pictures into memory once for the whole run
+  PictureCache picCache;
+  if (!loadPictures(picTupleList, picCache, err)) {
+    return 1;
+  }
+
+  // Only files whose tags match are printed
+  TagQuery query;
+  TagQuery *pQuery = 0;
+  if (!opt.find.isEmpty()) {
+    if (!query.parse(opt.find))
+      return 1;
+    pQuery = &query;
+  }
+
+  // Per-file tags, parsed once for all files
+  Manifest manifest;
+  if (!opt.manifest.isEmpty() && 
+      !manifest.load(opt.manifest.toCString(), cwd))
+    return 1;
+
+  // Tags and pictures to be added are the same for every file. Render
+  // them once and let each file splice in the result.
+  SharedFrames shared;
+  buildSharedFrames(opt, picTupleList, picCache, shared);
+  shared.render(opt.version.isEmpty() ? 4 : opt.version.toInt());
+
   //if (opt.dryRun) {
   //  opt.print();
   //}
 
-  for (auto &fileName : opt.fileList) {
-    MetaDSF dsf(fileName.toCString());
+  RunStats stats;
+  GroupCommit group;
+  GroupCommit *pGroup = durability == DSFFile::SyncGroup ? &group : 0;
+  auto start = std::chrono::steady_clock::now();
+
+  // These only read the audio data, or store what they find
+  int audioModes = opt.toWav + opt.toDSDIFF + opt.toDSF + opt.audioHash +
+    opt.verify + opt.analyze + opt.replayGain;
+  if (audioModes > 0 &&
+      (audioModes > 1 || opt.showInfo || opt.showTags || pQuery || 
+       opt.exportPics || opt.repair || isEditing(opt, shared))) {
+    err << "--to-wav, --to-dff, --to-dsf, --audio-hash, --verify, ";
+    err << "--analyze and --replaygain can't be combined with each ";
+    err << "other or with options reading or editing tags";
+    err << std::endl;
+    return 1;
+  }
+
+  if (pQuery && !isReadOnly(opt, shared)) {
+    err << "--find can only be combined with --show-info, ";
+    err << "--show-tags and --catalog" << std::endl;
+    return 1;
+  }
 
-    if (!opt.encoding.isEmpty())
-      dsf.setEncoding(MetaDSF::getEncTypeByName(opt.encoding));
-    if (!opt.version.isEmpty())
-      dsf.setID3v2Version(opt.version.toInt());
+  // The daemon's catalog, unless another one is given
+  if (opt.catalog.isEmpty() && context && isReadOnly(opt, shared))
+    opt.catalog = context->catalog;
 
-    if (!dsf.isOK()) {
-      std::cerr << fileName << ": error reading file." << std::endl;
-      continue;
+  unsigned int failed;
+  if (!opt.catalog.isEmpty() && !isReadOnly(opt, shared))
+    err << "--catalog ignored, files are not only read" << std::endl;
+
+  if (opt.toWav) {
+    // Channels are decoded in parallel within a file, --jobs files at
+    // a time
+    BatchProcessor batch(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return convertFile(fileName, opt, pcmRate, pcmFormat, out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	batch.add(fileName);
+      });
+    failed += batch.finish();
+  } else if (opt.toDSDIFF || opt.toDSF) {
+    BatchProcessor batch(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return convertDSDIFF(fileName, opt, out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	batch.add(fileName);
+      });
+    failed += batch.finish();
+  } else if (opt.audioHash) {
+    // The cores are shared by the files hashed at the same time
+    unsigned int cores = BatchProcessor::defaultJobs();
+    unsigned int threads = jobs > 0 ? cores / jobs : 1;
+    BatchProcessor batch(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return hashFile(fileName, opt, hashAlgorithm, threads, durability,
+			pGroup, out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	batch.add(fileName);
+      });
+    failed += batch.finish();
+  } else if (opt.verify) {
+    // Reads whole files, so use all cores unless told otherwise
+    if (opt.jobs.isEmpty() && !context)
+      jobs = 0;
+    BatchProcessor batch(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return verifyFile(fileName, out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	batch.add(fileName);
+      });
+    failed += batch.finish();
+  } else if (opt.analyze) {
+    BatchProcessor batch(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return analyzeFile(fileName, opt, analysisWindow, durability, pGroup,
+			   out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	batch.add(fileName);
+      });
+    failed += batch.finish();
+  } else if (opt.replayGain) {
+    // Files are measured in parallel. Track gain is saved right away,
+    // album gain once every file has been measured.
+    std::vector<TagLib::String> files;
+    std::map<std::string, std::shared_ptr<LoudnessMeter> > meters;
+    std::mutex lock;
+    BatchProcessor measure(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	std::shared_ptr<LoudnessMeter> meter(measureLoudness(fileName, err));
+	if (!meter)
+	  return false;
+	if (!albumGain) {
+	  Loudness track = { meter->loudness(), meter->peak() };
+	  return saveReplayGain(fileName, opt, track, nullptr, durability, 
+				pGroup, out, err);
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	meters[fileName.toCString()] = meter;
+	return true;
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	files.push_back(fileName);
+	measure.add(fileName);
+      });
+    failed += measure.finish();
+
+    if (albumGain && failed > 0) {
+      err << "Album gain not saved, not all files could be measured";
+      err << std::endl;
+    } else if (albumGain && !meters.empty()) {
+      std::vector<const LoudnessMeter *> all;
+      Loudness album = { 0, 0 };
+      for (auto &m : meters) {
+	all.push_back(m.second.get());
+	album.peak = std::max(album.peak, m.second->peak());
+      }
+      album.lufs = LoudnessMeter::loudness(all);
+
+      BatchProcessor save(jobs, 
+        [&](const TagLib::String &fileName, std::ostream &out, 
+	    std::ostream &err) {
+	  const LoudnessMeter &meter = *meters.at(fileName.toCString());
+	  Loudness track = { meter.loudness(), meter.peak() };
+	  return saveReplayGain(fileName, opt, track, &album, durability, 
+				pGroup, out, err);
+	}, out, err);
+      for (auto &fileName : files)
+	save.add(fileName);
+      failed += save.finish();
     }
-    if (!doDelete(dsf, opt)) {
-      return 1;
+  } else if (!opt.catalog.isEmpty() && isReadOnly(opt, shared)) {
+    // Most files come straight out of the catalog. Only the few that
+    // changed are read, so a plain thread pool is enough.
+    Catalog catalog(opt.catalog.toCString());
+    BatchProcessor batch(32,
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return printCataloged(fileName, opt, pQuery, catalog, out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	batch.add(fileName);
+      });
+    failed += batch.finish();
+    if (!catalog.save())
+      failed++;
+  } else if (isReadOnly(opt, shared)) {
+    // Only headers and tags are needed, read them with lots of 
+    // requests in flight. --jobs N bounds them to N.
+    if (opt.useMmap)
+      err << "--mmap doesn't apply to read-only runs, ignored" 
+		<< std::endl;
+    DSFScanner scanner(!opt.jobs.isEmpty() && jobs > 0 ? 
+		       jobs : DSFScanner::DEFAULT_DEPTH, 
+		       opt.showTags || query.needsTag(),
+      [&](const TagLib::String &fileName, DSFProbe &probe, 
+	  std::ostream &out, std::ostream &err) {
+	return printProbe(fileName, opt, pQuery, probe, out, err);
+      }, out, err);
+
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	scanner.add(fileName);
+      });
+    failed += scanner.finish();
+  } else {
+    BatchProcessor batch(jobs, 
+      [&](const TagLib::String &fileName, std::ostream &out, 
+	  std::ostream &err) {
+	return processFile(fileName, opt, shared, manifest, stats, 
+			   durability, pGroup, out, err);
+      }, out, err);
+
+    // A file of the manifest may also be given on the command line, it
+    // must only be edited once. Only those names are remembered.
+    std::set<std::string> queued;
+    failed = addFiles(opt, cwd, err, [&](const TagLib::String &fileName) {
+	if (manifest.contains(fileName) && 
+	    !queued.insert(absolutePath(fileName.toCString())).second)
+	  return;
+	batch.add(fileName);
+      });
+    for (auto &fileName : manifest.files())
+      if (queued.insert(absolutePath(fileName.toCString())).second)
+	batch.add(fileName);
+    failed += batch.finish();
+  }
+
+  // The last wave. Files whose sync failed are only counted here, their
+  // jobs succeeded.
+  group.flush();
+  failed += group.failures();
+
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>
+    (std::chrono::steady_clock::now() - start).count();
+
+  if (stats.skipped > 0) {
+    err << stats.skipped << " of " << stats.saved + stats.skipped;
+    err << " file(s) unchanged, not saved" << std::endl;
+  }
+
+  if (opt.showStats)
+    printStats(stats, opt.durability.isEmpty() ? "none" : opt.durability,
+	       pGroup, elapsed, err);
+
+  if (failed > 0)
+    return 1;
+  return 0;
+} // run()
+
+//
+// Apply all edits to one file and print whatever is requested.
+// Runs on a worker thread when --jobs is given, so all output must go
+// to out/err instead of cout/cerr.
+//
+bool processFile(const TagLib::String &fileName, OptionObj &opt, 
+		 SharedFrames &shared, const Manifest &manifest, 
+		 RunStats &stats,
+		 DSFFile::Durability durability, GroupCommit *group,
+		 std::ostream &out, std::ostream &err) 
+{
+  std::string prefix = filePrefix(fileName, opt);
+
+  // Before anything else reads the file
+  if (opt.repair) {
+    if (!repairFile(fileName, prefix, out, err))
+      return false;
+    if (!opt.showInfo && !opt.showTags && !opt.exportPics && 
+	!isEditing(opt, shared))
+      return true;
+  }
+
+  MetaDSF dsf(fileName.toCString(), opt.useMmap);
+
+  prepareSave(dsf, opt, durability, group);
+
+  if (!dsf.isOK()) {
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+  if (!doDelete(dsf, opt)) {
+    return false;
+  }
+  dsf.attachSharedFrames(shared);
+  manifest.apply(fileName, dsf);
+  if (!opt.dryRun) {
+    auto start = std::chrono::steady_clock::now();
+    if (!dsf.save()) {
+      err << fileName << ": error saving file." << std::endl;
+      return false;
     }
-    if (!doAdd(dsf, opt)) {
-      return 1;
+    if (dsf.lastSaveWritten()) {
+      stats.saved++;
+      stats.bytes += dsf.lastSaveBytesWritten();
+      stats.saveMicros += 
+	std::chrono::duration_cast<std::chrono::microseconds>
+	(std::chrono::steady_clock::now() - start).count();
     }
-    if (!importPictures(dsf, picTupleList)) {
-      return 1;
+    else if (isEditing(opt, shared))
+      stats.skipped++;
+  }
+
+  if (opt.exportPics) {
+    std::string basename = 
+      std::string(fileName.toCString()).substr(0, fileName.rfind("."));
+    dsf.exportPictures(basename.c_str());
+  }
+
+  if (opt.showInfo)
+    dsf.printInfo(prefix.c_str(), out);
+   
+  if (opt.showTags)
+    dsf.printTags(prefix.c_str(), out);
+
+  return true;
+}
+
+// Totals for --stats. Latency is the average time spent in save(),
+// which includes syncing with --durability=file.
+void printStats(RunStats &stats, const TagLib::String &durability,
+		GroupCommit *group, uint64_t elapsed, std::ostream &err)
+{
+  double secs = elapsed / 1e6;
+
+  err << stats.saved << " file(s) saved, " << stats.bytes;
+  err << " bytes written";
+  if (stats.saved > 0)
+    err << " (" << stats.bytes / stats.saved << " per file)";
+  err << std::endl;
+
+  err << "Durability: " << durability;
+  if (stats.saved > 0)
+    err << ", save latency " << stats.saveMicros / stats.saved / 1000.0
+	<< " ms";
+  if (group)
+    err << ", " << group->waves() << " sync wave(s) taking "
+	<< group->syncMicros() / 1000.0 << " ms";
+  err << std::endl;
+
+  if (secs > 0)
+    err << "Elapsed " << secs << " s, " << stats.saved / secs 
+	<< " files/s, " << stats.bytes / secs / (1024 * 1024) 
+	<< " MB/s" << std::endl;
+}
+
+// Check a file for the traces of an interrupted save and fix them.
+// Every problem found is reported on out.
+bool repairFile(const TagLib::String &fileName, const std::string &prefix,
+		std::ostream &out, std::ostream &err)
+{
+  DSFRepair r(fileName.toCString());
+  if (!r.isValid()) {
+    err << fileName << ": not a DSF file or can't be opened." << std::endl;
+    return false;
+  }
+
+  for (auto &p : r.problems())
+    out << prefix << "Repairing: " << p << std::endl;
+
+  if (!r.isRepairable()) {
+    err << fileName << ": can't be repaired." << std::endl;
+    return false;
+  }
+  if (!r.repair()) {
+    err << fileName << ": error repairing file." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Decode a file to a WAV file next to it (--to-wav) and tell how much
+// faster than real time it went
+bool convertFile(const TagLib::String &fileName, OptionObj &opt, 
+		 unsigned int rate, PCMConverter::Format format,
+		 std::ostream &out, std::ostream &err)
+{
+  std::string wavFile = replaceExtension(fileName, ".wav");
+
+  PCMConverter converter(rate);
+  if (!converter.convert(fileName.toCString(), wavFile.c_str(), format, err))
+    return false;
+
+  out << filePrefix(fileName, opt) << "Converted to " << wavFile << ", ";
+  out << converter.audioSeconds() << " s of audio";
+  if (converter.elapsedSeconds() > 0)
+    out << " at " << converter.audioSeconds() / converter.elapsedSeconds()
+	<< "x real time (" << DSDDecimator::kernel() << ")";
+  out << std::endl;
+  return true;
+}
+
+// Convert a DSF file to DSDIFF (--to-dff), or a DSDIFF file to DSF
+// (--to-dsf), next to it
+bool convertDSDIFF(const TagLib::String &fileName, OptionObj &opt,
+		   std::ostream &out, std::ostream &err)
+{
+  DSDIFFConverter converter;
+  std::string newFile = replaceExtension(fileName, opt.toDSF ? ".dsf" : 
+					 ".dff");
+  if (opt.toDSF ? 
+      !converter.toDSF(fileName.toCString(), newFile.c_str(), err) :
+      !converter.toDSDIFF(fileName.toCString(), newFile.c_str(), err))
+    return false;
+
+  out << filePrefix(fileName, opt) << "Converted to " << newFile;
+  if (converter.elapsedSeconds() > 0)
+    out << " at " << converter.bytesWritten() / 
+      converter.elapsedSeconds() / 1e6 << " MB/s (" 
+	<< DSDIFFConverter::kernel() << ")";
+  out << std::endl;
+  return true;
+}
+
+// fileName with its extension, if any, replaced by ext
+std::string replaceExtension(const TagLib::String &fileName, const char *ext)
+{
+  std::string s = fileName.toCString();
+  size_t dot = s.rfind('.');
+  if (dot != std::string::npos && s.find('/', dot) == std::string::npos)
+    s.erase(dot);
+  return s + ext;
+}
+
+// Hash the audio data of a file (--audio-hash). A hash of the same kind
+// found in its tags must be the same, otherwise the audio changed since
+// it was stored. With --store-audio-hash, the hash is saved unless
+// there was such a mismatch.
+bool hashFile(const TagLib::String &fileName, OptionObj &opt,
+	      AudioHash::Algorithm algorithm, unsigned int threads,
+	      DSFFile::Durability durability, GroupCommit *group,
+	      std::ostream &out, std::ostream &err)
+{
+  AudioHash hasher(algorithm, threads);
+  std::string digest;
+  if (!hasher.hash(fileName.toCString(), digest, err))
+    return false;
+  out << filePrefix(fileName, opt) << "AUDIO_HASH=" << digest << std::endl;
+
+  MetaDSF dsf(fileName.toCString(), opt.useMmap);
+  if (!dsf.isOK()) {
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+
+  std::string stored = dsf.getTagTXXX("AUDIO_HASH").toCString();
+  std::string kind = digest.substr(0, digest.find(':') + 1);
+  if (stored.compare(0, kind.size(), kind) == 0 && stored != digest) {
+    err << fileName << ": audio data changed, the stored hash is ";
+    err << stored << std::endl;
+    return false;
+  }
+  if (!opt.storeAudioHash || stored == digest)
+    return true;
+
+  prepareSave(dsf, opt, durability, group);
+
+  dsf.deleteTagTXXX("AUDIO_HASH");
+  dsf.setTagTXXX("AUDIO_HASH", digest);
+  if (!dsf.save()) {
+    err << fileName << ": error saving file." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Check the structure of a file and read all of it (--verify). Every
+// problem is a line of out: file name, offset, check and details,
+// separated by tabs.
+bool verifyFile(const TagLib::String &fileName, std::ostream &out, 
+		std::ostream &err)
+{
+  DSFVerifier verifier(fileName.toCString());
+  if (!verifier.isOpen()) {
+    err << fileName << ": can't open file." << std::endl;
+    return false;
+  }
+
+  for (auto &v : verifier.violations())
+    out << fileName << '\t' << v.offset << '\t' << v.check << '\t' 
+	<< v.detail << std::endl;
+  return verifier.violations().empty();
+}
+
+// Level statistics of every channel of a file (--analyze), computed on
+// the 1-bit stream. With --store-analysis they're saved in TXXX frames,
+// one value per channel separated by commas.
+bool analyzeFile(const TagLib::String &fileName, OptionObj &opt,
+		 unsigned int window, DSFFile::Durability durability,
+		 GroupCommit *group, std::ostream &out, std::ostream &err)
+{
+  std::vector<std::unique_ptr<DSDAnalyzer> > analyzers;
+  {
+    DSFDataReader reader(fileName.toCString());
+    if (!reader.isValid()) {
+      err << fileName << ": error reading audio data." << std::endl;
+      return false;
     }
-    if (!opt.dryRun)
-      dsf.save();
 
-    if (opt.exportPics) {
-      std::string basename = 
-	std::string(fileName.toCString()).substr(0, fileName.rfind("."));
-      dsf.exportPictures(basename.c_str());
+    const DSFHeader &h = reader.header();
+    for (unsigned int ch = 0; ch < h.channelNum(); ch++)
+      analyzers.emplace_back(new DSDAnalyzer(h.sampleRate(), window));
+
+    uint64_t samples = 0;
+    while (reader.next()) {
+      size_t size = (static_cast<uint64_t>(reader.samples()) * 
+		     h.bitsPerSample() + 7) / 8;
+      for (unsigned int ch = 0; ch < h.channelNum(); ch++)
+	analyzers[ch]->process(reader.channel(ch).data, size);
+      samples += reader.samples();
     }
-    std::string prefix = "";
-    if (opt.fileList.size() > 1) {
-      prefix += fileName.toCString();
-      prefix += ":";
+    if (samples != h.sampleCount()) {
+      err << fileName << ": error reading audio data." << std::endl;
+      return false;
     }
+  }
 
-    if (opt.showInfo)
-      dsf.printInfo(prefix.c_str());
-   
-    if (opt.showTags)
-      dsf.printTags(prefix.c_str());
-  } 
-} // main()
+  // TXXX frame descriptions and values
+  std::vector<std::pair<std::string, std::string> > tags = {
+    { "DSD_DC_OFFSET", "" },
+    { "DSD_PEAK_MODULATION", "" },
+    { "DSD_OVERLOAD_SECONDS", "" },
+    { "DSD_SILENCE_START", "" },
+    { "DSD_SILENCE_END", "" }
+  };
+
+  std::string prefix = filePrefix(fileName, opt);
+  for (size_t ch = 0; ch < analyzers.size(); ch++) {
+    DSDAnalyzer &a = *analyzers[ch];
+    a.finish();
+
+    std::ostringstream values[5];
+    values[0] << std::fixed << std::setprecision(3) 
+	      << (2 * a.density() - 1) * 100;
+    values[1] << std::fixed << std::setprecision(1) 
+	      << a.peakModulation() * 100;
+    for (int i = 2; i < 5; i++)
+      values[i] << std::fixed << std::setprecision(3);
+    values[2] << a.overloadSeconds();
+    values[3] << a.silenceAtStart();
+    values[4] << a.silenceAtEnd();
+
+    out << prefix << "Channel " << ch + 1 << ": DC offset " 
+	<< values[0].str() << "%, peak modulation " << values[1].str() 
+	<< "% at " << std::fixed << std::setprecision(3) << a.peakTime() 
+	<< " s, " << values[2].str() << " s over 50%, silence " 
+	<< values[3].str() << " s at start, " << values[4].str() 
+	<< " s at end" << std::endl;
+
+    for (int i = 0; i < 5; i++)
+      tags[i].second += (ch > 0 ? "," : "") + values[i].str();
+  }
+
+  if (!opt.storeAnalysis)
+    return true;
+
+  MetaDSF dsf(fileName.toCString(), opt.useMmap);
+  if (!dsf.isOK()) {
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+  prepareSave(dsf, opt, durability, group);
+  for (auto &t : tags) {
+    dsf.deleteTagTXXX(t.first);
+    dsf.setTagTXXX(t.first, t.second);
+  }
+  if (!dsf.save()) {
+    err << fileName << ": error saving file." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Decode the audio of a file and measure its loudness (--replaygain).
+// PCM at 44.1 kHz has all the band the K-weighting looks at; every
+// DSD rate is a multiple of it.
+std::unique_ptr<LoudnessMeter> measureLoudness(const TagLib::String &fileName,
+					       std::ostream &err)
+{
+  DSFDataReader reader(fileName.toCString());
+  if (!reader.isValid()) {
+    err << fileName << ": error reading audio data." << std::endl;
+    return nullptr;
+  }
+
+  const DSFHeader &h = reader.header();
+  const unsigned int rate = 44100;
+  std::unique_ptr<LoudnessMeter> meter(new LoudnessMeter(rate, 
+							 h.channelNum()));
+
+  // Channels in the order of the DSF specification. Surround channels
+  // weigh more, the LFE doesn't count.
+  switch (h.channelType()) {
+  case DSFHeader::Quad:
+    meter->setWeight(2, 1.41);
+    meter->setWeight(3, 1.41);
+    break;
+  case DSFHeader::FourChannels:
+    meter->setWeight(3, 0);
+    break;
+  case DSFHeader::FiveChannels:
+    meter->setWeight(3, 1.41);
+    meter->setWeight(4, 1.41);
+    break;
+  case DSFHeader::FiveOneChannels:
+    meter->setWeight(3, 0);
+    meter->setWeight(4, 1.41);
+    meter->setWeight(5, 1.41);
+    break;
+  default:
+    break;
+  }
+
+  PCMConverter converter(rate);
+  if (!converter.decode(reader, [&](const float *frames, size_t count) {
+	meter->process(frames, count);
+	return true;
+      }, err))
+    return nullptr;
+
+  if (std::isinf(meter->loudness())) {
+    err << fileName << ": too short or too quiet to measure its loudness.";
+    err << std::endl;
+    return nullptr;
+  }
+  return meter;
+}
+
+// Save the ReplayGain values of a track, and of its album if given, in
+// TXXX frames (--replaygain). Gains are relative to -18 LUFS, as in
+// ReplayGain 2.0.
+bool saveReplayGain(const TagLib::String &fileName, OptionObj &opt,
+		    const Loudness &track, const Loudness *album,
+		    DSFFile::Durability durability, GroupCommit *group,
+		    std::ostream &out, std::ostream &err)
+{
+  const double REFERENCE = -18;
+  std::vector<std::pair<std::string, const Loudness *> > levels = {
+    { "TRACK", &track }
+  };
+  if (album)
+    levels.push_back(std::make_pair("ALBUM", album));
+
+  std::vector<std::pair<std::string, std::string> > tags;
+  for (auto &l : levels) {
+    std::ostringstream gain, peak;
+    gain << std::fixed << std::setprecision(2) 
+	 << REFERENCE - l.second->lufs << " dB";
+    peak << std::fixed << std::setprecision(6) << l.second->peak;
+    tags.push_back(std::make_pair("REPLAYGAIN_" + l.first + "_GAIN", 
+				  gain.str()));
+    tags.push_back(std::make_pair("REPLAYGAIN_" + l.first + "_PEAK", 
+				  peak.str()));
+  }
+
+  std::string prefix = filePrefix(fileName, opt);
+  for (auto &t : tags)
+    out << prefix << t.first << "=" << t.second << std::endl;
+
+  MetaDSF dsf(fileName.toCString(), opt.useMmap);
+  if (!dsf.isOK()) {
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+  prepareSave(dsf, opt, durability, group);
+  for (auto &t : tags) {
+    dsf.deleteTagTXXX(t.first);
+    dsf.setTagTXXX(t.first, t.second);
+  }
+  if (!dsf.save()) {
+    err << fileName << ": error saving file." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// How files edited by any mode are saved: the ID3v2 version and 
+// encoding asked for, --safe-save and --durability
+void prepareSave(MetaDSF &dsf, OptionObj &opt, 
+		 DSFFile::Durability durability, GroupCommit *group)
+{
+  if (!opt.encoding.isEmpty())
+    dsf.setEncoding(MetaDSF::getEncTypeByName(opt.encoding));
+  if (!opt.version.isEmpty())
+    dsf.setID3v2Version(opt.version.toInt());
+  dsf.setSafeSave(opt.safeSave);
+  dsf.setDurability(durability, group);
+}
+
+// Whether any option modifying the files was given
+bool isEditing(OptionObj &opt, SharedFrames &shared) {
+  return opt.removeEverything || !opt.removeTagList.empty() ||
+    !opt.removePicList.empty() || shared.size() > 0 || 
+    !opt.manifest.isEmpty();
+}
+
+// Whether nothing but --show-info, --show-tags and --find was asked for
+bool isReadOnly(OptionObj &opt, SharedFrames &shared) {
+  return (opt.showInfo || opt.showTags || !opt.find.isEmpty()) && 
+    !opt.exportPics && 
+    !opt.repair && !isEditing(opt, shared);
+}
+
+// Output of a read-only run, from the data read by DSFScanner. Must
+// be the same as what processFile() prints. With --find, files that
+// don't match are skipped and the others listed.
+bool printProbe(const TagLib::String &fileName, OptionObj &opt, 
+		TagQuery *query, DSFProbe &probe, 
+		std::ostream &out, std::ostream &err)
+{
+  if (!probe.isValid()) {
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+
+  if (query) {
+    if (!query->matches(probe.audioProperties(), probe.ID3v2Header(),
+			[&](const TagLib::ByteVector &id) {
+			  return TagQuery::values(probe.frameList(id));
+			}))
+      return true;
+    out << fileName << std::endl;
+  }
+
+  std::string prefix = filePrefix(fileName, opt);
+  if (opt.showInfo)
+    MetaDSF::printInfo(probe.audioProperties(), probe.ID3v2Header(),
+		       prefix.c_str(), out);
+  if (opt.showTags)
+    MetaDSF::printTags(probe.frameList(), prefix.c_str(), out);
+  return true;
+}
+
+// Same as printProbe(), with headers and tags from the catalog if the
+// file hasn't changed since it was added. Otherwise the file is read and
+// its entry updated.
+bool printCataloged(const TagLib::String &fileName, OptionObj &opt,
+		    TagQuery *query, Catalog &catalog, 
+		    std::ostream &out, std::ostream &err)
+{
+  std::string path = absolutePath(fileName.toCString());
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    catalog.remove(path);
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+
+  Catalog::Entry e;
+  if (!catalog.find(path, st, e)) {
+    DSFProbe probe(fileName.toCString(), true);
+    if (!probe.isValid()) {
+      catalog.remove(path);
+      err << fileName << ": error reading file." << std::endl;
+      return false;
+    }
+    Catalog::makeEntry(path, st, probe, e);
+    catalog.update(e);
+  }
+
+  DSFProbe probe;
+  if (!probe.setDSFHeader(e.DSFHeader)) {
+    err << fileName << ": error reading file." << std::endl;
+    return false;
+  }
+  probe.setID3v2Header(e.ID3v2Header);
+
+  if (query) {
+    if (!query->matches(probe.audioProperties(), probe.ID3v2Header(),
+			[&](const TagLib::ByteVector &id) {
+			  TagLib::StringList l;
+			  for (auto &f : e.frames) {
+			    if (f.id != id)
+			      continue;
+			    if (f.pictureType != Catalog::NO_PICTURE)
+			      l.append(MetaDSF::getPicTypeDesc(f.pictureType));
+			    else
+			      l.append(TagLib::String(f.text, 
+						      TagLib::String::UTF8));
+			  }
+			  return l;
+			}))
+      return true;
+    out << fileName << std::endl;
+  }
+
+  std::string prefix = filePrefix(fileName, opt);
+  if (opt.showInfo)
+    MetaDSF::printInfo(probe.audioProperties(), probe.ID3v2Header(),
+		       prefix.c_str(), out);
+  if (opt.showTags) {
+    for (auto &f : e.frames) {
+      out << prefix;
+      out << f.id << "=" << TagLib::String(f.text, TagLib::String::UTF8);
+      out << std::endl;
+    }
+  }
+  return true;
+}
+
+// Hand the files to be processed to add(), as they are found with
+// --recursive or read from --files-from. Relative names read from the
+// list start at cwd, if given. Return the number of directories or
+// file lists that couldn't be read.
+unsigned int addFiles(OptionObj &opt, const std::string &cwd, 
+		      std::ostream &err,
+		      const std::function<void (const TagLib::String &)> &add)
+{
+  std::unique_ptr<DirWalker> walker;
+  if (opt.recursive)
+    walker.reset(new DirWalker(DirWalker::DEFAULT_THREADS, add,
+			       opt.toDSF ? "FRM8" : "DSD ", err));
+
+  auto addFile = [&](const TagLib::String &fileName) {
+    if (walker)
+      walker->add(fileName);
+    else
+      add(fileName);
+  };
+
+  for (auto &fileName : opt.fileList)
+    addFile(fileName);
+
+  // One name at a time, never the whole list in memory
+  unsigned int failed = 0;
+  if (!opt.filesFrom.isEmpty()) {
+    std::ifstream f;
+    std::istream *in = &std::cin;
+    if (opt.filesFrom != "-") {
+      f.open(opt.filesFrom.toCString());
+      in = &f;
+    }
+
+    if (!*in) {
+      err << opt.filesFrom << ": can't open file list" << std::endl;
+      failed++;
+    } else {
+      std::string line;
+      char delim = opt.nullSeparated ? '\0' : '\n';
+      while (std::getline(*in, line, delim)) {
+	if (!opt.nullSeparated && !line.empty() && 
+	    line[line.size() - 1] == '\r')
+	  line.erase(line.size() - 1);
+	if (!line.empty())
+	  addFile(TagLib::String(resolvePath(line.c_str(), cwd)));
+      }
+    }
+  }
+
+  if (walker)
+    failed += walker->finish();
+  return failed;
+}
+
+// Output lines are preceded by the file name if there's more than one
+std::string filePrefix(const TagLib::String &fileName, OptionObj &opt)
+{
+  std::string prefix = "";
+  if (opt.fileList.size() > 1 || opt.recursive || 
+      !opt.filesFrom.isEmpty() || !opt.manifest.isEmpty()) {
+    prefix += fileName.toCString();
+    prefix += ":";
+  }
+  return prefix;
+}
 
 bool doDelete(MetaDSF &dsf, OptionObj &opt) {
   if (opt.removeEverything) {
@@ -176,18 +1221,9 @@ bool doDelete(MetaDSF &dsf, OptionObj &opt) {
   return true;
 }
 
-bool doAdd(MetaDSF &dsf, OptionObj &opt) {
-  for (auto &i : opt.addTagMap) {
-    TagLib::String name = MetaDSF::getFrameNameByID(i.first);
-    
-    //std::cerr << "<ADD> set " << i.first << "(" << name << ") to ";
-    //std::cerr << i.second << std::endl;
-    dsf.setTag(name, i.second);
-  }
-  return true;
-}
 
-bool validatePictures(OptionObj &opt, PicTupleList &tupleList) {
+bool validatePictures(OptionObj &opt, PicTupleList &tupleList, 
+		      std::ostream &err) {
   for (auto &p : opt.addPicList) {
     StringVector tmp;
     TagLib::ID3v2::AttachedPictureFrame::Type pt = 
@@ -200,19 +1236,19 @@ bool validatePictures(OptionObj &opt, PicTupleList &tupleList) {
 
     // check extension
     if (!MetaDSF::isValidImage(tmp[0])) {
-      std::cerr << "Unknown image format: " << tmp[0] << std::endl;
+      err << "Unknown image format: " << tmp[0] << std::endl;
       return false;
     }
 
     if (!isReadableFile(tmp[0].toCString())) {
-      std::cerr << tmp[0] << " not accessible" << std::endl;
+      err << tmp[0] << " not accessible" << std::endl;
       return false;
     }
     if (tmp.size() >= 2) {
       if (tmp[1].size() != 0) {       // check if type is valid
 	long t;
 	if (!stringToLong(tmp[1].toCString(), t) || !MetaDSF::isValidPicType(t)) {
-	  std::cerr << "Picture type '" << tmp[1] << "' invalid'" << std::endl;
+	  err << "Picture type '" << tmp[1] << "' invalid'" << std::endl;
 	  return false;
 	}
 	pt = static_cast<TagLib::ID3v2::AttachedPictureFrame::Type>(t);
@@ -226,10 +1262,47 @@ bool validatePictures(OptionObj &opt, PicTupleList &tupleList) {
   return true;
 }
 
-bool importPictures(MetaDSF &dsf, PicTupleList &pList) {
+bool loadPictures(PicTupleList &pList, PictureCache &cache, 
+		  std::ostream &err) {
   for (auto &p : pList) {
-    if (!dsf.attachPicture(std::get<0>(p), std::get<1>(p), std::get<2>(p)))
+    const TagLib::String &path = std::get<0>(p);
+    if (cache.find(path) != cache.end())
+      continue;
+
+    TagLib::ByteVector v;
+    if (loadFileIntoVector(path.toCString(), v) <= 0) {
+      err << path << ": failed to load picture" << std::endl;
       return false;
+    }
+    cache[path] = v;
   }
   return true;
 }
+
+// Tags from --set-tag/--add-tag(s-from-file) first, then the pictures, 
+// in the same order they used to be added to each file
+void buildSharedFrames(OptionObj &opt, PicTupleList &pList, 
+		       PictureCache &cache, SharedFrames &shared) {
+  for (auto &i : opt.addTagMap) {
+    TagLib::String name = MetaDSF::getFrameNameByID(i.first);
+    TagLib::StringList vals(i.second);
+    bool replace = std::find(opt.replaceTagList.begin(), 
+			     opt.replaceTagList.end(), 
+			     i.first) != opt.replaceTagList.end();
+
+    shared.add([name, vals]() { 
+	return MetaDSF::createTextFrame(name, vals); 
+      }, replace);
+  }
+
+  for (auto &p : pList) {
+    TagLib::String path = std::get<0>(p);
+    TagLib::ID3v2::AttachedPictureFrame::Type t = std::get<1>(p);
+    TagLib::String comment = std::get<2>(p);
+    TagLib::ByteVector data = cache.find(path)->second;
+
+    shared.add([path, data, t, comment]() { 
+	return MetaDSF::createPictureFrame(path, data, t, comment); 
+      });
+  }
+}
@@ -0,0 +1,212 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include <taglib/id3v2frame.h>
+
+#include "manifest.h"
+#include "metadsf.h"
+#include "utils.h"
+#include "batch.h"
+
+//////////////////////////// IMPL //////////////////////////////
+class Manifest::ManifestImpl {
+ public:
+  enum Op { SET, ADD, REMOVE };
+
+  // All lines of a file for one tag and op, values in order
+  struct Edit {
+    StringVector frameIDs;      // all frames the tag is stored in
+    TagLib::String name;
+    TagLib::StringList values;
+    Op op;
+  };
+
+  ManifestImpl() {}
+  ~ManifestImpl() {}
+
+  // Frame IDs and name of tag. Returns false if it's unknown.
+  static bool resolve(const TagLib::String &tag, StringVector &frameIDs,
+		      TagLib::String &name);
+
+  /////////////// Variables //////////////
+  StringVector _files;
+  std::map<std::string, std::vector<Edit> > _edits; // by absolute path
+};
+
+bool Manifest::ManifestImpl::resolve(const TagLib::String &tag, 
+				     StringVector &frameIDs,
+				     TagLib::String &name)
+{
+  if (MetaDSF::isValidFrameID(tag)) {
+    frameIDs.push_back(tag);
+    name = MetaDSF::getFrameNameByID(tag);
+    return true;
+  }
+
+  // DATE for instance may be in any of TDRC, TYER, TDAT...
+  name = tag.upper();
+  frameIDs = MetaDSF::getFrameIDsByName(name);
+  return !frameIDs.empty();
+}
+
+///////////////////////////// MANIFEST //////////////////////////
+Manifest::Manifest()
+{
+  _i = new ManifestImpl;
+}
+
+Manifest::~Manifest()
+{
+  delete _i;
+}
+
+bool Manifest::load(const char *path, const std::string &dir)
+{
+  std::ifstream infile(path);
+  if (!infile.good()) {
+    BatchProcessor::err() << "Failed to open " << path << std::endl;
+    return false;
+  }
+
+  std::string line;
+  int n = 0;
+  while (std::getline(infile, line)) {
+    ++n;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::vector<std::string> v;
+    size_t start = 0, tab;
+    while ((tab = line.find('\t', start)) != std::string::npos) {
+      v.push_back(line.substr(start, tab - start));
+      start = tab + 1;
+    }
+    v.push_back(line.substr(start));
+
+    if (v.size() < 3 || v.size() > 4 || v[0].empty() || v[1].empty()) {
+      BatchProcessor::err() << path << ": line " << n << " is malformed"
+        << std::endl;
+      return false;
+    }
+
+    ManifestImpl::Edit e;
+    if (!ManifestImpl::resolve(TagLib::String(v[1], TagLib::String::UTF8),
+			       e.frameIDs, e.name)) {
+      BatchProcessor::err() << path << ": line " << n << " unknown tag "
+        << v[1] << std::endl;
+      return false;
+    }
+
+    std::string op = v.size() == 4 ? v[3] : "set";
+    if (op == "set")
+      e.op = ManifestImpl::SET;
+    else if (op == "add")
+      e.op = ManifestImpl::ADD;
+    else if (op == "remove")
+      e.op = ManifestImpl::REMOVE;
+    else {
+      BatchProcessor::err() << path << ": line " << n
+        << " unknown operation " << op << std::endl;
+      return false;
+    }
+    if (e.op != ManifestImpl::REMOVE && v[2].empty()) {
+      BatchProcessor::err() << path << ": line " << n
+        << " tag value missing" << std::endl;
+      return false;
+    }
+
+    // File names are kept byte for byte, like those on the command
+    // line, and matched by their absolute path: ./01.dsf is 01.dsf
+    std::string name = resolvePath(v[0].c_str(), dir);
+    std::string file = absolutePath(name.c_str());
+    auto it = _i->_edits.find(file);
+    if (it == _i->_edits.end()) {
+      _i->_files.push_back(TagLib::String(name));
+      it = _i->_edits.insert(std::make_pair(file, 
+        std::vector<ManifestImpl::Edit>())).first;
+    }
+
+    // More values for a tag already being set
+    bool merged = false;
+    if (e.op == ManifestImpl::SET) {
+      for (auto &prev : it->second) {
+	if (prev.op == ManifestImpl::SET && prev.name == e.name) {
+	  prev.values.append(TagLib::String(v[2], TagLib::String::UTF8));
+	  merged = true;
+	  break;
+	}
+      }
+    }
+    if (!merged) {
+      if (e.op != ManifestImpl::REMOVE)
+	e.values.append(TagLib::String(v[2], TagLib::String::UTF8));
+      it->second.push_back(e);
+    }
+  }
+  return true;
+}
+
+const StringVector &Manifest::files() const
+{
+  return _i->_files;
+}
+
+bool Manifest::contains(const TagLib::String &file) const
+{
+  return _i->_edits.count(absolutePath(file.toCString())) > 0;
+}
+
+int Manifest::apply(const TagLib::String &file, MetaDSF &dsf) const
+{
+  auto it = _i->_edits.find(absolutePath(file.toCString()));
+  if (it == _i->_edits.end())
+    return 0;
+
+  for (auto &e : it->second) {
+    switch (e.op) {
+    case ManifestImpl::SET: {
+      // The frame the value is stored in is replaced in place, so that
+      // it keeps its position in the tag
+      TagLib::String keep(TagLib::ID3v2::Frame::keyToFrameID(e.name));
+      for (auto &id : e.frameIDs)
+	if (id != keep)
+	  dsf.deleteTags(id);
+      dsf.setTag(e.name, e.values, true);
+      break;
+    }
+    case ManifestImpl::ADD:
+      dsf.setTag(e.name, e.values);
+      break;
+    case ManifestImpl::REMOVE:
+      for (auto &id : e.frameIDs)
+	dsf.deleteTags(id);
+      break;
+    }
+  }
+  return it->second.size();
+}
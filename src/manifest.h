@@ -0,0 +1,74 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+#include <taglib/tstring.h>
+#include <taglib/tstringlist.h>
+
+#include "typedefs.h"
+
+class MetaDSF;
+
+//
+// Tags that differ from file to file (--manifest), e.g. titles and
+// track numbers of an album.
+//
+// The manifest is a tab separated UTF-8 file, one edit per line:
+//
+//   path <TAB> tag <TAB> value [<TAB> set|add|remove]
+//
+// where tag is a frame ID (TIT2) or name (TITLE). "set" (the default)
+// replaces all frames of that tag, "add" adds one more, "remove"
+// removes them all and takes no value. Empty lines and lines starting
+// with # are skipped. Lines are grouped by path, so that every file is
+// opened and saved once however many lines it has. Paths are compared
+// once made absolute and normal, so ./01.dsf and 01.dsf are the same.
+//
+class Manifest {
+ public:
+  Manifest();
+  ~Manifest();
+
+  // Parse the manifest. Relative file names in it are taken from dir
+  // if one is given. Prints an error and returns false if it can't be
+  // read or is malformed.
+  bool load(const char *path, const std::string &dir = "");
+
+  // The files in the manifest, in the order they first appear
+  const StringVector &files() const;
+
+  // Whether the manifest has edits for file
+  bool contains(const TagLib::String &file) const;
+
+  // Apply the edits for file to dsf. Returns the number of edits.
+  int apply(const TagLib::String &file, MetaDSF &dsf) const;
+
+ private:
+  Manifest(const Manifest &);
+  Manifest &operator=(const Manifest &);
+
+  class ManifestImpl;
+  ManifestImpl *_i;
+};
+
+#endif
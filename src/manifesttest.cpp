@@ -0,0 +1,108 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+//
+// --manifest parsing: well formed manifests and the errors load()
+// reports. Run by "make check".
+//
+
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "manifest.h"
+
+namespace {
+
+const char *manifestFile = "manifesttest.tsv";
+int failures = 0;
+
+void fail(const std::string &what)
+{
+  std::cerr << "FAIL: " << what << std::endl;
+  failures++;
+}
+
+// Load a manifest made of text
+bool load(Manifest &m, const std::string &text)
+{
+  std::ofstream out(manifestFile, std::ios::binary | std::ios::trunc);
+  out << text;
+  out.close();
+  return m.load(manifestFile);
+}
+
+void expectError(const char *what, const std::string &text)
+{
+  Manifest m;
+  if (load(m, text))
+    fail(std::string(what) + " should be an error");
+}
+
+} // namespace
+
+int main()
+{
+  Manifest m;
+  if (!load(m, 
+	    "# Kind of Blue\n"
+	    "01.dsf\tTIT2\tSo What\n"
+	    "./02.dsf\tTITLE\tFreddie Freeloader\r\n"
+	    "\n"
+	    "01.dsf\tTPE1\tMiles Davis\tadd\n"
+	    "./01.dsf\tTCON\t\tremove\n"
+	    "02.dsf\tTIT2\tAlternate take\tset\n"))
+    fail("valid manifest doesn't load");
+  if (m.files().size() != 2)
+    fail("files should be listed once each");
+  else if (m.files()[0] != "01.dsf" || m.files()[1] != "./02.dsf")
+    fail("files should be in the order they first appear");
+  if (!m.contains("01.dsf") || !m.contains("./01.dsf") || 
+      !m.contains("02.dsf"))
+    fail("./x.dsf and x.dsf should be the same file");
+  if (m.contains("03.dsf"))
+    fail("03.dsf isn't in the manifest");
+
+  Manifest empty;
+  if (!load(empty, "# nothing yet\n\n") || !empty.files().empty())
+    fail("a manifest with only comments should be empty");
+
+  expectError("too few fields", "01.dsf\tTIT2\n");
+  expectError("too many fields", "01.dsf\tTIT2\tSo What\tset\tx\n");
+  expectError("an empty path", "\tTIT2\tSo What\n");
+  expectError("an empty tag", "01.dsf\t\tSo What\n");
+  expectError("an unknown tag", "01.dsf\tNOSUCHTAG\tSo What\n");
+  expectError("an unknown operation", "01.dsf\tTIT2\tSo What\treplace\n");
+  expectError("set without a value", "01.dsf\tTIT2\t\n");
+  expectError("add without a value", "01.dsf\tTPE1\t\tadd\n");
+  expectError("a bad line after good ones", 
+	      "01.dsf\tTIT2\tSo What\n01.dsf\tTIT2\n");
+
+  remove(manifestFile);
+  Manifest missing;
+  if (missing.load(manifestFile))
+    fail("a missing manifest should be an error");
+
+  if (failures)
+    std::cerr << failures << " failed" << std::endl;
+  return failures ? 1 : 0;
+}
@@ -22,6 +22,7 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <memory>
 
 #include <string.h>
 
@@ -31,18 +32,42 @@
 #include <taglib/id3v2tag.h>
 #include <taglib/id3v2frame.h>
 #include <taglib/id3v2header.h>
+#include <taglib/id3v2framefactory.h>
+#include <taglib/tfilestream.h>
 
 #include "dsffile.h"
 #include "utils.h"
 #include "metadsf.h"
+#include "sharedframes.h"
+#include "mmapstream.h"
+#include "groupcommit.h"
+#include "batch.h"
+
+// Falls back to TagLib's own stream when the file can't be mapped
+static TagLib::IOStream *openStream(const char *path, bool useMmap)
+{
+  if (useMmap && MmapStream::isSuitable(path)) {
+    MmapStream *s = new MmapStream(path);
+    if (s->isOpen())
+      return s;
+    delete s;
+  }
+  return new TagLib::FileStream(path);
+}
 
 //////////////////////////// IMPL //////////////////////////////
 class MetaDSF::MetaDSFImpl {
  public:
-  MetaDSFImpl(const char *path) : _changed(false), 
-				  _file(path), 
-				  _ID3v2_version(4), 
-				  _encoding(TagLib::String::UTF8)
+  MetaDSFImpl(const char *path, bool useMmap) : 
+    _changed(false), 
+    _written(false),
+    _stream(openStream(path, useMmap)),
+    _file(_stream.get(), TagLib::ID3v2::FrameFactory::instance()), 
+    _ID3v2_version(4), 
+    _encoding(TagLib::String::UTF8),
+    _prerenderedVersion(0),
+    _durability(DSFFile::NoSync),
+    _group(0)
   {}
   ~MetaDSFImpl() {}
 
@@ -57,18 +82,33 @@ class MetaDSF::MetaDSFImpl {
 
   int deleteTags(const TagLib::String &);
 
+  // Replace the frames with the ID of f by f. A text frame keeps its
+  // place in the tag: the first existing one takes the value of f, which
+  // is deleted, and the others are removed. Returns false if f still has
+  // to be added.
+  bool replaceFrames(TagLib::ID3v2::Frame *f);
+
   /////////////// Variables //////////////
   bool _changed; // whether there's any change to metadata
                  // save() uses this to determine whether to write to disk
+  bool _written; // whether the last save() wrote to disk
+  std::unique_ptr<TagLib::IOStream> _stream; // must outlive _file
   DSFFile _file;
   int _ID3v2_version; // What version of ID3v2 to save (3 or 4)
   TagLib::String::Type _encoding; // Text encoding
+
+  // Frames attached from a SharedFrames object and their renderings
+  PrerenderedFrames _prerendered;
+  int _prerenderedVersion; // ID3v2 version of _prerendered
+
+  DSFFile::Durability _durability;
+  GroupCommit *_group; // syncs the files saved with SyncGroup
 };
 
 ///////////////////////////// METADSF //////////////////////////
-MetaDSF::MetaDSF(const char *path)
+MetaDSF::MetaDSF(const char *path, bool useMmap)
 {
-  _i = new MetaDSFImpl(path);
+  _i = new MetaDSFImpl(path, useMmap);
 }
 
 MetaDSF::~MetaDSF() 
@@ -81,43 +121,74 @@ MetaDSF::~MetaDSF()
 
 bool MetaDSF::save() 
 {
+  _i->_written = false;
+
   // only save when changed were made
   if (_i->_changed) {
     _i->_changed = false;
-    return _i->_file.save(_i->_ID3v2_version, true);
+    bool ok;
+    if (_i->_prerenderedVersion != _i->_ID3v2_version)
+      ok = _i->_file.save(_i->_ID3v2_version, true);
+    else
+      ok = _i->_file.save(_i->_ID3v2_version, true, &_i->_prerendered);
+    _i->_written = _i->_file.lastSaveWritten();
+
+    // Only whether the file is queued, sync failures are counted by the
+    // group
+    if (ok && _i->_written && _i->_durability == DSFFile::SyncGroup && 
+	_i->_group)
+      ok = _i->_group->add(_i->_stream->name());
+    return ok;
   }
   return true;
 }
 
+bool MetaDSF::lastSaveWritten() const
+{
+  return _i->_written;
+}
+
+uint64_t MetaDSF::lastSaveBytesWritten() const
+{
+  return _i->_written ? _i->_file.lastSaveBytesWritten() : 0;
+}
+
 bool MetaDSF::isOK() const 
 {
   return (_i->_file.isOpen() && _i->_file.isValid());
 }
 
-void MetaDSF::printInfo(const char *prefix) const 
+void MetaDSF::printInfo(const char *prefix, std::ostream &os) const 
 {
   DSFProperties *p = static_cast<DSFProperties *>
     (_i->_file.audioProperties());
 
+  printInfo(p, _i->_file.ID3v2Header(), prefix, os);
+}
+
+void MetaDSF::printInfo(const DSFProperties *p, 
+			const TagLib::ID3v2::Header *h,
+			const char *prefix, std::ostream &os)
+{
   if (p) {
-    std::cout << prefix;
-    std::cout << "DSD version=" << p->version() << std::endl;
-    std::cout << prefix;
-    std::cout << "Sample rate=" << p->sampleRate() << "Hz" << std::endl;
-    std::cout << prefix;
-    std::cout << "No. of channels=" << p->channels() << std::endl;
-    std::cout << prefix;
-    std::cout << "Channel type=" << channelTypeDesc[p->channelType()] << std::endl;
-    std::cout << prefix;
-    std::cout << "Length=" << p->length() << "s" << std::endl;
-    std::cout << prefix;
-    std::cout << "No. of samples=" << p->sampleCount() << std::endl;
-    std::cout << prefix;
-    std::cout << "Bits per sample=" << p->bitsPerSample() << std::endl;
-    std::cout << prefix;
-    std::cout << "Metadata offset=" << p->ID3v2Offset() << std::endl;
-    std::cout << prefix;
-    std::cout << "File size=" << p->fileSize() << std::endl;
+    os << prefix;
+    os << "DSD version=" << p->version() << std::endl;
+    os << prefix;
+    os << "Sample rate=" << p->sampleRate() << "Hz" << std::endl;
+    os << prefix;
+    os << "No. of channels=" << p->channels() << std::endl;
+    os << prefix;
+    os << "Channel type=" << channelTypeDesc[p->channelType()] << std::endl;
+    os << prefix;
+    os << "Length=" << p->length() << "s" << std::endl;
+    os << prefix;
+    os << "No. of samples=" << p->sampleCount() << std::endl;
+    os << prefix;
+    os << "Bits per sample=" << p->bitsPerSample() << std::endl;
+    os << prefix;
+    os << "Metadata offset=" << p->ID3v2Offset() << std::endl;
+    os << prefix;
+    os << "File size=" << p->fileSize() << std::endl;
   }
 
   // if (_i->_file.ID3v2Tag()->isEmpty()) {
@@ -126,30 +197,35 @@ void MetaDSF::printInfo(const char *prefix) const
   //   return;
   // }
 
-  std::cout << prefix;
-  std::cout << "ID3v2 version=2."
-       << _i->_file.ID3v2Tag()->header()->majorVersion()
+  os << prefix;
+  os << "ID3v2 version=2."
+       << h->majorVersion()
        << "."
-       << _i->_file.ID3v2Tag()->header()->revisionNumber()
+       << h->revisionNumber()
        << std::endl;
-  std::cout << prefix;
-  std::cout << "Tag size="
-       << _i->_file.ID3v2Tag()->header()->completeTagSize()
+  os << prefix;
+  os << "Tag size="
+       << h->completeTagSize()
        << " bytes" << std::endl;
 }
 
-void MetaDSF::printTags(const char *prefix) const 
+void MetaDSF::printTags(const char *prefix, std::ostream &os) const 
 {
-  if (_i->_file.ID3v2Tag()->isEmpty()) {
+  if (_i->_file.isTagEmpty()) {
     return;
   }
 
-  TagLib::ID3v2::FrameList l = _i->_file.ID3v2Tag()->frameList();
+  printTags(_i->_file.frameList(), prefix, os);
+}
+
+void MetaDSF::printTags(const TagLib::ID3v2::FrameList &l,
+			const char *prefix, std::ostream &os)
+{
   TagLib::ID3v2::FrameList::ConstIterator it;
   
   for (it = l.begin(); it != l.end(); it++) {
-    std::cout << prefix;
-    std::cout << (*it)->frameID() << "=" << (*it)->toString() << std::endl;
+    os << prefix;
+    os << (*it)->frameID() << "=" << (*it)->toString() << std::endl;
   }
 }
  
@@ -167,11 +243,14 @@ int MetaDSF::setTag(const TagLib::String &key,
 		    bool replace) 
 {
   int nReplaced = 0;
-  if (replace) 
-    nReplaced = _i->deleteTags(key);
+  TagLib::ID3v2::Frame *f = createTextFrame(key, sl);
 
-  TagLib::ID3v2::Frame *f = TagLib::ID3v2::Frame::createTextualFrame(key, sl);
-  _i->_file.ID3v2Tag()->addFrame(f);
+  if (replace) {
+    nReplaced = _i->_file.frameList(f->frameID()).size();
+    if (_i->replaceFrames(f))
+      return nReplaced;
+  }
+  _i->_file.addFrame(f);
   _i->_changed = true;
   return nReplaced;
 }
@@ -188,11 +267,40 @@ int MetaDSF::setTagTXXX(const TagLib::String &desc,
     new TagLib::ID3v2::UserTextIdentificationFrame(TagLib::String(desc), 
 						   TagLib::String(val), 
 						   _i->_encoding);
-  _i->_file.ID3v2Tag()->addFrame(f);
+  _i->_file.addFrame(f);
   _i->_changed = true;
   return nReplaced;
 }
 
+TagLib::String MetaDSF::getTagTXXX(const TagLib::String &desc) const
+{
+  TagLib::ID3v2::FrameList l = _i->_file.frameList("TXXX");
+  for (auto it = l.begin(); it != l.end(); it++) {
+    TagLib::ID3v2::UserTextIdentificationFrame *f = 
+      dynamic_cast<TagLib::ID3v2::UserTextIdentificationFrame *>(*it);
+    if (f && f->description() == desc && f->fieldList().size() > 1)
+      return f->fieldList()[1];
+  }
+  return TagLib::String();
+}
+
+int MetaDSF::deleteTagTXXX(const TagLib::String &desc)
+{
+  TagLib::ID3v2::FrameList l = _i->_file.frameList("TXXX");
+  TagLib::ID3v2::FrameList dl; // a list of frames to be deleted
+  for (auto it = l.begin(); it != l.end(); it++) {
+    TagLib::ID3v2::UserTextIdentificationFrame *f = 
+      dynamic_cast<TagLib::ID3v2::UserTextIdentificationFrame *>(*it);
+    if (f && f->description() == desc)
+      dl.append(f);
+  }
+
+  _i->deleteFrames(dl);
+  if (!dl.isEmpty())
+    _i->_changed = true;
+  return dl.size();
+}
+
 int MetaDSF::setTagTMCL(const TagLib::PropertyMap &m, bool replace) 
 {
   int nReplaced = 0;
@@ -201,7 +309,7 @@ int MetaDSF::setTagTMCL(const TagLib::PropertyMap &m, bool replace)
 
   TagLib::ID3v2::TextIdentificationFrame *f = 
     TagLib::ID3v2::TextIdentificationFrame::createTMCLFrame(m);
-  _i->_file.ID3v2Tag()->addFrame(f);
+  _i->_file.addFrame(f);
   _i->_changed = true;
   return nReplaced;
 }
@@ -218,7 +326,7 @@ int MetaDSF::setTagWXXX(const TagLib::String &url,
     new TagLib::ID3v2::UserUrlLinkFrame(_i->_encoding);
   f->setDescription(urlDesc);
   f->setUrl(url);
-  _i->_file.ID3v2Tag()->addFrame(f);
+  _i->_file.addFrame(f);
   _i->_changed = true;
   return nReplaced;
 }
@@ -231,7 +339,7 @@ int MetaDSF::setTagTIPL(const TagLib::PropertyMap &m, bool replace)
 
   TagLib::ID3v2::TextIdentificationFrame *f = 
     TagLib::ID3v2::TextIdentificationFrame::createTIPLFrame(m);
-  _i->_file.ID3v2Tag()->addFrame(f);
+  _i->_file.addFrame(f);
   _i->_changed = true;
   return nReplaced;
 }
@@ -270,7 +378,7 @@ int MetaDSF::setTagTIPL(const TagLib::PropertyMap &m, bool replace)
 int MetaDSF::deleteTags(const TagLib::String &key) 
 {
   if (key.isEmpty()) {
-    std::cerr << "deleteTags(): key is empty" << std::endl;
+    BatchProcessor::err() << "deleteTags(): key is empty" << std::endl;
     return 0;
   }
   return _i->deleteTags(key);
@@ -285,35 +393,56 @@ bool MetaDSF::attachPicture(const TagLib::String &path,
 			    const TagLib::ID3v2::AttachedPictureFrame::Type t,
 			    const TagLib::String &comment)
 {
- // Determine MIME type  
-  TagLib::String mimeType;
-  TagLib::String ext = path.substr(path.rfind(".") + 1);
-
-  transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-  if (extToMIMETypeMap.find(ext) == extToMIMETypeMap.end()) {
-    std::cerr << "Unknown image format " << ext << std::endl;
-    return false;
-  }
-
-  mimeType = extToMIMETypeMap[ext];
-
   // Load file into memory
   TagLib::ByteVector v;
   if (loadFileIntoVector(path.toCString(), v) <= 0) {
     return false;
   }
+  return attachPicture(path, v, t, comment);
+}
 
-  TagLib::ID3v2::AttachedPictureFrame *apic = 
-    new TagLib::ID3v2::AttachedPictureFrame();
-  apic->setPicture(v);
-  apic->setMimeType(mimeType);
-  apic->setType(t);
-  apic->setDescription(comment);
-  _i->_file.ID3v2Tag()->addFrame(apic);
+bool MetaDSF::attachPicture(const TagLib::String &path,
+			    const TagLib::ByteVector &data,
+			    const TagLib::ID3v2::AttachedPictureFrame::Type t,
+			    const TagLib::String &comment)
+{
+  TagLib::ID3v2::Frame *apic = createPictureFrame(path, data, t, comment);
+  if (!apic)
+    return false;
+
+  _i->_file.addFrame(apic);
   _i->_changed = true;
   return true;
 }
 
+int MetaDSF::attachSharedFrames(const SharedFrames &shared)
+{
+  int n = 0;
+
+  if (_i->_prerenderedVersion != _i->_ID3v2_version) {
+    _i->_prerendered.clear();
+    _i->_prerenderedVersion = _i->_ID3v2_version;
+  }
+
+  for (unsigned int k = 0; k < shared.size(); k++) {
+    TagLib::ID3v2::Frame *f = shared.create(k);
+    if (!f)
+      continue;
+    if (shared.replaces(k) && _i->replaceFrames(f))
+      continue;
+    _i->_file.addFrame(f);
+    n++;
+
+    const TagLib::ByteVector &v = shared.rendered(k, _i->_ID3v2_version);
+    if (!v.isEmpty())
+      _i->_prerendered[f] = v;
+  }
+
+  if (n > 0)
+    _i->_changed = true;
+  return n;
+}
+
 bool MetaDSF::attachPicture(const TagLib::String &path, 
 			    const TagLib::String &ptype) 
 {
@@ -323,11 +452,11 @@ bool MetaDSF::attachPicture(const TagLib::String &path,
 
   transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
   if (extToMIMETypeMap.find(ext) == extToMIMETypeMap.end()) {
-    std::cerr << "Unknown image format " << ext << std::endl;
+    BatchProcessor::err() << "Unknown image format " << ext << std::endl;
     return false;
   }
 
-  mimeType = extToMIMETypeMap[ext];
+  mimeType = extToMIMETypeMap.find(ext)->second;
 
   // Load file into memory
   TagLib::ByteVector v;
@@ -343,14 +472,14 @@ bool MetaDSF::attachPicture(const TagLib::String &path,
   apic->setPicture(v);
   apic->setMimeType(mimeType);
   apic->setType(t);
-  _i->_file.ID3v2Tag()->addFrame(apic);
+  _i->_file.addFrame(apic);
   _i->_changed = true;
   return true;
 }
 
 int MetaDSF::deletePictures(const TagLib::String &ptype) 
 {
-  TagLib::ID3v2::FrameList l = _i->_file.ID3v2Tag()->frameList("APIC");
+  TagLib::ID3v2::FrameList l = _i->_file.frameList("APIC");
   TagLib::ID3v2::FrameList dl; // a list of frames to be deleted
   TagLib::ID3v2::FrameList::ConstIterator it;
   std::string pt = ptype.toCString();
@@ -367,21 +496,24 @@ int MetaDSF::deletePictures(const TagLib::String &ptype)
   }  
 
   _i->deleteFrames(dl);
-  _i->_changed = true;
+  if (!dl.isEmpty())
+    _i->_changed = true;
   return dl.size();
 }
 
 bool MetaDSF::exportPictures(const char *prefix) const
 {
   std::map<std::string, unsigned int> counter;
-  TagLib::ID3v2::FrameList l = _i->_file.ID3v2Tag()->frameList("APIC");
+  TagLib::ID3v2::FrameList l = _i->_file.frameList("APIC");
   TagLib::ID3v2::FrameList::ConstIterator it;
   for (it = l.begin(); it != l.end(); ++it) {
     TagLib::ID3v2::AttachedPictureFrame *f =
       static_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
     std::string fname = prefix;
     std::string tname = picTypeDesc[f->type()].toCString();
-    std::string ext = MIMETypeToExtMap[f->mimeType()].toCString();
+    auto m = MIMETypeToExtMap.find(f->mimeType());
+    std::string ext = (m == MIMETypeToExtMap.end()) ? 
+      "" : m->second.toCString();
     if (counter.find(tname) == counter.end())
       counter[tname] = 1;
     else
@@ -407,6 +539,19 @@ void MetaDSF::setID3v2Version(int v)
   }
 }
 
+void MetaDSF::setSafeSave(bool safe)
+{
+  _i->_file.setSafeSave(safe);
+}
+
+void MetaDSF::setDurability(DSFFile::Durability durability, 
+			    GroupCommit *group)
+{
+  _i->_durability = durability;
+  _i->_group = group;
+  _i->_file.setDurability(durability);
+}
+
 void MetaDSF::setEncoding(const TagLib::String::Type type) 
 {
   _i->_encoding = type;
@@ -417,18 +562,79 @@ void MetaDSF::setEncoding(const TagLib::String &name)
   if (!isValidEncoding(name)) {
     _i->_encoding = TagLib::String::UTF8;
   } else {
-    _i->_encoding = encodingType[name];
+    _i->_encoding = encodingType.find(name)->second;
+  }
+}
+
+//
+// The static maps are shared by all worker threads of a batch, so
+// lookups must never insert (as operator[] does for unknown keys).
+//
+TagLib::ID3v2::Frame *MetaDSF::createTextFrame(const TagLib::String &key,
+					       const TagLib::StringList &vals)
+{
+  return TagLib::ID3v2::Frame::createTextualFrame(key, vals);
+}
+
+TagLib::ID3v2::Frame *MetaDSF::createPictureFrame(
+  const TagLib::String &path,
+  const TagLib::ByteVector &data,
+  const TagLib::ID3v2::AttachedPictureFrame::Type t,
+  const TagLib::String &comment)
+{
+ // Determine MIME type  
+  TagLib::String ext = path.substr(path.rfind(".") + 1);
+
+  transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  auto m = extToMIMETypeMap.find(ext);
+  if (m == extToMIMETypeMap.end()) {
+    BatchProcessor::err() << "Unknown image format " << ext << std::endl;
+    return 0;
   }
+
+  // ByteVector is implicitly shared, so every frame created from the
+  // same data refers to a single copy of the picture
+  TagLib::ID3v2::AttachedPictureFrame *apic = 
+    new TagLib::ID3v2::AttachedPictureFrame();
+  apic->setPicture(data);
+  apic->setMimeType(m->second);
+  apic->setType(t);
+  apic->setDescription(comment);
+  return apic;
 }
 
 const TagLib::String::Type MetaDSF::getEncTypeByName(const TagLib::String &name) 
 {
-  return encodingType[name];
+  auto it = encodingType.find(name);
+  if (it == encodingType.end())
+    return TagLib::String::UTF8;
+  return it->second;
 }
 
 const TagLib::String &MetaDSF::getFrameNameByID(const TagLib::String &id) 
 {
-  return frameIDToNameMap[id];
+  static const TagLib::String empty;
+  auto it = frameIDToNameMap.find(id);
+  if (it == frameIDToNameMap.end())
+    return empty;
+  return it->second;
+}
+
+const TagLib::String &MetaDSF::getPicTypeDesc(unsigned int pos)
+{
+  static const TagLib::String empty;
+  if (pos >= picTypeDesc.size())
+    return empty;
+  return picTypeDesc[pos];
+}
+
+StringVector MetaDSF::getFrameIDsByName(const TagLib::String &name)
+{
+  StringVector v;
+  for (auto &i : frameIDToNameMap)
+    if (i.second == name)
+      v.push_back(i.first);
+  return v;
 }
 
 bool MetaDSF::isValidEncoding(const TagLib::String &name) {
@@ -457,7 +663,8 @@ void MetaDSF::MetaDSFImpl::deleteFrames(const TagLib::ID3v2::FrameList &l)
   TagLib::ID3v2::FrameList::ConstIterator it;
 
   for (it = l.begin(); it != l.end(); it++) {
-    _file.ID3v2Tag()->removeFrame(*it);
+    _prerendered.erase(*it);
+    _file.removeFrame(*it);
   }
 }
 
@@ -474,18 +681,58 @@ void MetaDSF::MetaDSFImpl::dupFrameList(const TagLib::ID3v2::FrameList &src,
 }
 
 int MetaDSF::MetaDSFImpl::deleteTags(const TagLib::String &key) {
+  TagLib::ByteVector id;
+  if (key != "")
+    id = TagLib::ByteVector(key.toCString());
+
+  // Forget the frames before they're gone, frames that are never read
+  // from the file can be dropped without parsing them
+  PrerenderedFrames::iterator it = _prerendered.begin();
+  while (it != _prerendered.end()) {
+    if (id.isEmpty() || it->first->frameID() == id)
+      _prerendered.erase(it++);
+    else
+      it++;
+  }
+
+  int n = _file.removeFrames(id);
+  if (n > 0)
+    _changed = true;
+  return n;
+}
+
+bool MetaDSF::MetaDSFImpl::replaceFrames(TagLib::ID3v2::Frame *f) {
   TagLib::ID3v2::FrameList l;
-  if (key == "") {
-    l = _file.ID3v2Tag()->frameList();
-  } else {
-    l = _file.ID3v2Tag()->frameList(key.toCString());
+  if (f->frameID() != "TXXX") // told apart by description, not replaced
+    l = _file.frameList(f->frameID());
+  if (l.isEmpty())
+    return false;
+
+  TagLib::ID3v2::TextIdentificationFrame *t = 
+    dynamic_cast<TagLib::ID3v2::TextIdentificationFrame *>(f);
+  TagLib::ID3v2::TextIdentificationFrame *first = 
+    dynamic_cast<TagLib::ID3v2::TextIdentificationFrame *>(l.front());
+  if (!t || !first) {
+    deleteTags(TagLib::String(f->frameID()));
+    return false;
   }
-  TagLib::ID3v2::FrameList ll;
 
-  dupFrameList(l, ll);
-  deleteFrames(ll);
-  _changed = true;
-  return ll.size();
+  // Leave the frame alone if it already has the value, so that an
+  // unchanged tag isn't written again
+  if (first->textEncoding() != t->textEncoding() ||
+      !(first->fieldList() == t->fieldList())) {
+    first->setTextEncoding(t->textEncoding());
+    first->setText(t->fieldList());
+    _prerendered.erase(first);
+    _changed = true;
+  }
+  for (auto it = ++l.begin(); it != l.end(); it++) {
+    _prerendered.erase(*it);
+    _file.removeFrame(*it);
+    _changed = true;
+  }
+  delete f;
+  return true;
 }
 
 /////////// static members ///////////
@@ -22,16 +22,26 @@
 #ifndef _METADSF_H_
 #define _METADSF_H_
 
+#include <stdint.h>
+#include <iostream>
+
 #include "typedefs.h"
+#include "dsffile.h"
 
 #include <taglib/attachedpictureframe.h>
 
+class SharedFrames;
+class GroupCommit;
+class DSFProperties;
+namespace TagLib { namespace ID3v2 { class Header; } }
 
 class MetaDSF {
  public:
   // initializes the above static members
 
-  MetaDSF(const char *);
+  // If useMmap is true the file is accessed through a memory mapping,
+  // unless it's on a file system where that's not safe
+  MetaDSF(const char *, bool useMmap = false);
   ~MetaDSF();
   
   // Check if object initializes OK
@@ -40,6 +50,13 @@ class MetaDSF {
   // Save changes to disk
   bool save();
 
+  // Whether the last save() wrote to disk. Nothing is written if there
+  // were no changes, or the new tag is identical to the one on disk.
+  bool lastSaveWritten() const;
+
+  // Number of bytes the last save() wrote to disk
+  uint64_t lastSaveBytesWritten() const;
+
   // Delete a picture. Return the number of pictures deleted
   int deletePictures(const TagLib::String &ptype);
 
@@ -51,9 +68,24 @@ class MetaDSF {
 		     const TagLib::ID3v2::AttachedPictureFrame::Type,
 		     const TagLib::String &comment = "");
 
+  // Same as above, but with the picture already loaded into memory.
+  // file is only used to determine the MIME type. The data is shared
+  // (not copied) by the new frame.
+  bool attachPicture(const TagLib::String &file,
+		     const TagLib::ByteVector &data,
+		     const TagLib::ID3v2::AttachedPictureFrame::Type,
+		     const TagLib::String &comment = "");
+
   bool exportPictures(const char *prefix) const;
 
-  // Set simple textual data
+  // Attach a copy of every frame in shared. Return the number of frames
+  // attached. On save, the frames' cached renderings are reused. Frames
+  // that replace others (--set-tag) update the existing frame in place.
+  int attachSharedFrames(const SharedFrames &shared);
+
+  // Set simple textual data. With replace, the first frame with the same
+  // ID takes the value in place and the others are removed. Returns the
+  // number of frames replaced.
   int setTag(const TagLib::String &key, 
 	     const TagLib::String &val, bool replace = false);
 
@@ -65,6 +97,13 @@ class MetaDSF {
   int setTagTXXX(const TagLib::String &desc, 
 		 const TagLib::String &vals, bool replace = false);
 
+  // Value of the TXXX frame described as desc, empty if there's none
+  TagLib::String getTagTXXX(const TagLib::String &desc) const;
+
+  // Delete the TXXX frames described as desc, leaving the other TXXX
+  // frames alone. Return the number of frames deleted.
+  int deleteTagTXXX(const TagLib::String &desc);
+
   // WXXX - user-defined URL
   int setTagWXXX(const TagLib::String &url, 
 		 const TagLib::String &urlDesc, bool replace = false);
@@ -92,15 +131,32 @@ class MetaDSF {
   // Delete all tags (frames). Return the number of frames deleted
   int deleteAllTags();
 
-  // Dump file info to cout
-  void printInfo(const char *prefix = "") const;
+  // Dump file info to os (cout by default)
+  void printInfo(const char *prefix = "", std::ostream &os = std::cout) const;
+
+  // Same as above, for properties and a tag header obtained elsewhere
+  // (e.g. from a DSFProbe)
+  static void printInfo(const DSFProperties *p, 
+			const TagLib::ID3v2::Header *h,
+			const char *prefix, std::ostream &os);
+
+  // Dump tags to os (cout by default)
+  void printTags(const char *prefix = "", std::ostream &os = std::cout) const;
 
-  // Dump tags to cout
-  void printTags(const char *prefix = "") const;
+  // Same as above, for frames obtained elsewhere (e.g. from a DSFProbe)
+  static void printTags(const TagLib::ID3v2::FrameList &l,
+			const char *prefix, std::ostream &os);
 
   // Set ID3v2 version. Can be either 3 or 4.
   void setID3v2Version(int);
 
+  // Make save() crash safe. See DSFFile::setSafeSave().
+  void setSafeSave(bool);
+
+  // When changes made by save() reach the disk. With SyncGroup, saved
+  // files are handed to group, which syncs them in waves.
+  void setDurability(DSFFile::Durability, GroupCommit *group = 0);
+
   // Set encoding
   void setEncoding(const TagLib::String &name);
   void setEncoding(const TagLib::String::Type type);
@@ -108,6 +164,8 @@ class MetaDSF {
   static const TagLib::String &getChannelTypeDesc(unsigned int pos);
   static const TagLib::String &getPicTypeDesc(unsigned int pos);
   static const TagLib::String &getFrameNameByID(const TagLib::String &id);
+  // All frame IDs that go by name (e.g. DATE: TDRC, TYER...)
+  static StringVector getFrameIDsByName(const TagLib::String &name);
   static const TagLib::String::Type getEncTypeByName(const TagLib::String &name);
   static bool isValidEncoding(const TagLib::String &name);
   static bool isValidImage(const TagLib::String &file);
@@ -115,6 +173,16 @@ class MetaDSF {
   static bool isValidPicType(uint i) {
     return (i < picType.size());
   }
+
+  // Frame factories used by setTag() and attachPicture(). They return a
+  // null pointer on error.
+  static TagLib::ID3v2::Frame *createTextFrame(const TagLib::String &key,
+					       const TagLib::StringList &vals);
+  static TagLib::ID3v2::Frame *createPictureFrame(
+    const TagLib::String &file,
+    const TagLib::ByteVector &data,
+    const TagLib::ID3v2::AttachedPictureFrame::Type,
+    const TagLib::String &comment = "");
  private:
   MetaDSF(const MetaDSF &);
   MetaDSF &operator=(const MetaDSF &);
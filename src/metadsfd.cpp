@@ -0,0 +1,104 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <iostream>
+#include <memory>
+
+#include "optionparser.h"
+#include "cli.h"
+#include "daemon.h"
+#include "utils.h"
+
+enum DaemonOptionIndex { 
+  D_UNKNOWN, 
+  D_HELP, 
+  D_SOCKET, 
+  D_JOBS, 
+  D_CATALOG,
+  D_CLIENTS
+};
+
+const option::Descriptor usage[] = {
+  { D_UNKNOWN, 0, "", "", option::Arg::None, "Usage: metadsfd [options]\n\nRuns metadsf requests sent by clients with METADSF_SOCKET set." },
+  { D_HELP, 0, "h", "help", option::Arg::None, "--help, -h\n          Print usage and exit" },
+  { D_SOCKET, 0, "", "socket", option::Arg::Optional, "--socket=<PATH>\n          Listen on PATH (default: $XDG_RUNTIME_DIR/metadsfd.sock)" },
+  { D_JOBS, 0, "j", "jobs", option::Arg::Optional, "--jobs, -j=N\n          Files processed in parallel by requests without --jobs (0: one per CPU core)" },
+  { D_CATALOG, 0, "", "catalog", option::Arg::Optional, "--catalog=<FILE>\n          Catalog used by read-only requests without --catalog" },
+  { D_CLIENTS, 0, "", "clients", option::Arg::Optional, "--clients=N\n          Requests run at the same time (default: 4)" },
+  { 0, 0, 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+  argc -= (argc > 0);
+  argv += (argc > 0);
+
+  option::Stats stats(usage, argc, argv);
+  std::unique_ptr<option::Option[]> options(
+    new option::Option[stats.options_max]);
+  std::unique_ptr<option::Option[]> buffer(
+    new option::Option[stats.buffer_max]);
+  option::Parser parser(usage, argc, argv, options.get(), buffer.get());
+
+  if (parser.error())
+    return 1;
+  if (options[D_HELP] || options[D_UNKNOWN] || parser.nonOptionsCount() > 0) {
+    std::cout << PROG << "d version " << VERSION << std::endl;
+    option::printUsage(std::cout, usage);
+    return options[D_HELP] ? 0 : 1;
+  }
+
+  // Relative paths of requests are taken from their client's directory,
+  // those of the daemon itself are made absolute once and for all
+  std::string socket = DaemonProtocol::defaultSocket();
+  if (options[D_SOCKET] && options[D_SOCKET].last()->arg)
+    socket = absolutePath(options[D_SOCKET].last()->arg);
+
+  RunContext context;
+  if (options[D_JOBS] && options[D_JOBS].last()->arg) {
+    long jobs;
+    if (!stringToLong(options[D_JOBS].last()->arg, jobs) || jobs < 0) {
+      std::cerr << "Invalid number of jobs: " << options[D_JOBS].last()->arg;
+      std::cerr << std::endl;
+      return 1;
+    }
+    context.jobs = jobs;
+  }
+  if (options[D_CATALOG] && options[D_CATALOG].last()->arg)
+    context.catalog = absolutePath(options[D_CATALOG].last()->arg);
+
+  long clients = Daemon::DEFAULT_CLIENTS;
+  if (options[D_CLIENTS] && options[D_CLIENTS].last()->arg &&
+      (!stringToLong(options[D_CLIENTS].last()->arg, clients) || 
+       clients <= 0)) {
+    std::cerr << "Invalid number of clients: ";
+    std::cerr << options[D_CLIENTS].last()->arg << std::endl;
+    return 1;
+  }
+
+  Daemon daemon(socket.c_str(), context, clients);
+  if (!daemon.listen())
+    return 1;
+
+  std::cerr << "Listening on " << socket << std::endl;
+  daemon.serve();
+  return 0;
+}
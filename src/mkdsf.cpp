@@ -21,6 +21,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 class fwriter {
@@ -94,11 +96,17 @@ int main(int argc, char *argv[]) {
 
   s = "data"; // data chunk
   w.write(s.c_str(), 4);
-  w.write(u64raw(8204, buf), 4); // data chunk size
+  w.write(u64raw(8204, buf), 8); // data chunk size
 
+  // sample data: one 4096 byte block per channel, of which the first
+  // 1024 bytes (8192 samples) are used and the rest is padding. The
+  // channels differ so that swapping or reversing them shows.
   memset(&buf[0], 0, 8192);
-  w.write(&buf[0], 8192); //sample data: 8192 samples = 2 x 4096 which 
-                          //is the block size per channel 
+  for (int i = 0; i < 1024; i++) {
+    buf[i] = i * 7 + 1;
+    buf[4096 + i] = i * 13 + 5;
+  }
+  w.write(&buf[0], 8192);
 
   w.print();
 
@@ -0,0 +1,296 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "mmapstream.h"
+#include "batch.h"
+
+//////////////////////////// IMPL //////////////////////////////
+class MmapStream::StreamPrivate
+{
+public:
+  StreamPrivate(TagLib::FileName file) :
+    name(file),
+    fd(-1),
+    readOnly(true),
+    map(0),
+    mapSize(0),
+    size(0),
+    pos(0)
+  {}
+
+  ~StreamPrivate()
+  {
+    unmap();
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // Map the whole file, [0, size)
+  bool remap();
+  void unmap();
+
+  // pwrite() all of data at offset, growing the mapping if needed
+  bool writeAt(const TagLib::ByteVector &data, uint64_t offset);
+
+  std::string name;
+  int fd;
+  bool readOnly;
+  char *map;
+  size_t mapSize;
+  uint64_t size; // file size
+  uint64_t pos;
+};
+
+bool MmapStream::StreamPrivate::remap()
+{
+  unmap();
+  if (size == 0)
+    return true;
+
+  void *p = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    return false;
+
+  // Tags are looked up here and there, don't read ahead into the audio
+  madvise(p, size, MADV_RANDOM);
+  map = static_cast<char *>(p);
+  mapSize = size;
+  return true;
+}
+
+void MmapStream::StreamPrivate::unmap()
+{
+  if (map)
+    munmap(map, mapSize);
+  map = 0;
+  mapSize = 0;
+}
+
+bool MmapStream::StreamPrivate::writeAt(const TagLib::ByteVector &data,
+					uint64_t offset)
+{
+  const char *p = data.data();
+  size_t left = data.size();
+  uint64_t o = offset;
+
+  while (left > 0) {
+    ssize_t n = pwrite(fd, p, left, o);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      BatchProcessor::err() << name << ": write error" << std::endl;
+      return false;
+    }
+    p += n;
+    o += n;
+    left -= n;
+  }
+
+  // The mapping is shared, so it already sees what was written over
+  // the old contents. Only a grown file has to be mapped again.
+  if (o > size) {
+    size = o;
+    return remap();
+  }
+  return true;
+}
+
+///////////////////////////// MMAPSTREAM //////////////////////////
+MmapStream::MmapStream(TagLib::FileName file, bool openReadOnly)
+{
+  d = new StreamPrivate(file);
+
+  if (!openReadOnly) {
+    d->fd = open(file, O_RDWR);
+    d->readOnly = false;
+  }
+  if (d->fd < 0) {
+    d->fd = open(file, O_RDONLY);
+    d->readOnly = true;
+  }
+  if (d->fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(d->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(d->fd);
+    d->fd = -1;
+    return;
+  }
+
+  d->size = st.st_size;
+  if (!d->remap()) {
+    close(d->fd);
+    d->fd = -1;
+  }
+}
+
+MmapStream::~MmapStream()
+{
+  delete d;
+}
+
+TagLib::FileName MmapStream::name() const
+{
+  return d->name.c_str();
+}
+
+TagLib::ByteVector MmapStream::readBlock(TagLib::ulong length)
+{
+  if (!isOpen() || d->pos >= d->size)
+    return TagLib::ByteVector();
+
+  uint64_t n = std::min(static_cast<uint64_t>(length), d->size - d->pos);
+  TagLib::ByteVector v(d->map + d->pos, n);
+  d->pos += n;
+  return v;
+}
+
+void MmapStream::writeBlock(const TagLib::ByteVector &data)
+{
+  if (!isOpen() || d->readOnly)
+    return;
+
+  if (d->writeAt(data, d->pos))
+    d->pos += data.size();
+}
+
+void MmapStream::insert(const TagLib::ByteVector &data, 
+			TagLib::ulong start, TagLib::ulong replace)
+{
+  if (!isOpen() || d->readOnly || start > d->size)
+    return;
+
+  if (data.size() == replace) {
+    d->writeAt(data, start);
+    return;
+  }
+
+  // Move everything after the replaced block. For a DSF file that's
+  // at most the ID3v2 chunk.
+  uint64_t end = std::min(static_cast<uint64_t>(start) + replace, d->size);
+  TagLib::ByteVector v(data);
+  v.append(TagLib::ByteVector(d->map + end, d->size - end));
+
+  if (!d->writeAt(v, start))
+    return;
+  if (start + v.size() < d->size)
+    truncate(start + v.size());
+}
+
+void MmapStream::removeBlock(TagLib::ulong start, TagLib::ulong length)
+{
+  insert(TagLib::ByteVector(), start, length);
+}
+
+bool MmapStream::readOnly() const
+{
+  return d->readOnly;
+}
+
+bool MmapStream::isOpen() const
+{
+  return d->fd >= 0;
+}
+
+void MmapStream::seek(long offset, Position p)
+{
+  switch (p) {
+  case Beginning:
+    d->pos = offset;
+    break;
+  case Current:
+    d->pos += offset;
+    break;
+  case End:
+    d->pos = d->size + offset;
+    break;
+  }
+}
+
+long MmapStream::tell() const
+{
+  return d->pos;
+}
+
+long MmapStream::length()
+{
+  return d->size;
+}
+
+void MmapStream::truncate(long length)
+{
+  if (!isOpen() || d->readOnly)
+    return;
+
+  if (ftruncate(d->fd, length) != 0) {
+    BatchProcessor::err() << d->name << ": truncate error" << std::endl;
+    return;
+  }
+  d->size = length;
+  if (!d->remap()) {
+    close(d->fd);
+    d->fd = -1;
+  }
+}
+
+const char *MmapStream::data() const
+{
+  return d->map;
+}
+
+bool MmapStream::isSuitable(TagLib::FileName file)
+{
+  struct stat st;
+  if (stat(file, &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+
+#ifdef __linux__
+  struct statfs fs;
+  if (statfs(file, &fs) != 0)
+    return false;
+
+  switch (static_cast<uint32_t>(fs.f_type)) {
+  case 0x6969:     // NFS
+  case 0x517b:     // SMB
+  case 0xff534d42: // CIFS
+  case 0xfe534d42: // SMB2
+  case 0x65735546: // FUSE
+  case 0x01021997: // 9P
+    return false;
+  }
+#endif
+  return true;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _MMAPSTREAM_H_
+#define _MMAPSTREAM_H_
+
+#include <taglib/tiostream.h>
+
+//
+// A TagLib::IOStream that reads a file through a read-only shared memory
+// mapping and writes with pwrite(). Reads are plain memory copies out of
+// the page cache: no system call and no stdio buffer in between. Only
+// the pages that are actually read get faulted in, the audio data in
+// the middle of a DSF file is never touched.
+//
+// Use with DSFFile(TagLib::IOStream *, ...). The stream must outlive
+// the DSFFile.
+//
+// A file that is truncated by another process while it's mapped makes
+// reads fail with SIGBUS, use isSuitable() to stay away from network
+// file systems.
+//
+class MmapStream : public TagLib::IOStream {
+ public:
+  MmapStream(TagLib::FileName file, bool openReadOnly = false);
+  virtual ~MmapStream();
+
+  TagLib::FileName name() const;
+  TagLib::ByteVector readBlock(TagLib::ulong length);
+  void writeBlock(const TagLib::ByteVector &data);
+  void insert(const TagLib::ByteVector &data, 
+	      TagLib::ulong start = 0, TagLib::ulong replace = 0);
+  void removeBlock(TagLib::ulong start = 0, TagLib::ulong length = 0);
+  bool readOnly() const;
+  bool isOpen() const;
+  void seek(long offset, Position p = Beginning);
+  long tell() const;
+  long length();
+  void truncate(long length);
+
+  // The whole file as mapped in memory. Invalidated by any write.
+  const char *data() const;
+
+  // Returns false if file is not a regular file on a local file system
+  static bool isSuitable(TagLib::FileName file);
+
+ private:
+  MmapStream(const MmapStream &);
+  MmapStream &operator=(const MmapStream &);
+
+  class StreamPrivate;
+  StreamPrivate *d;
+};
+
+#endif
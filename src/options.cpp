@@ -26,6 +26,7 @@
 #include "optionparser.h"
 #include "options.h"
 #include "utils.h"
+#include "batch.h"
 
 //namespace myopt {
 
@@ -47,6 +48,31 @@ enum OptionIndex {
   IMPORT_PICTURE,
   REMOVE_PICTURES,
   EXPORT_PICTURES,
+  JOBS,
+  MMAP,
+  STATS,
+  SAFE_SAVE,
+  REPAIR,
+  DURABILITY,
+  CATALOG,
+  FIND,
+  RECURSIVE,
+  FILES_FROM,
+  NULL_SEPARATED,
+  MANIFEST,
+  WATCH,
+  TO_WAV,
+  TO_DFF,
+  TO_DSF,
+  PCM_RATE,
+  PCM_FORMAT,
+  AUDIO_HASH,
+  STORE_AUDIO_HASH,
+  VERIFY,
+  ANALYZE,
+  ANALYSIS_WINDOW,
+  STORE_ANALYSIS,
+  REPLAYGAIN,
   //DRY_RUN
 };
 
@@ -69,6 +95,31 @@ const option::Descriptor usage[] = {
   { REMOVE_ALL_PICTURES, 0, "", "remove-all-pictures", option::Arg::Optional, "--remove-all-pictures\n          Remove ALL pictures" },
   { IMPORT_PICTURE, 0, "p", "import-picture", option::Arg::Optional, "--import-picture, -p=file[|type|comment]\n          Import picture into file."},
   { EXPORT_PICTURES, 0, "", "export-all-pictures", option::Arg::Optional, "--export-all-pictures\n          Export pictures" }, 
+  { JOBS, 0, "j", "jobs", option::Arg::Optional, "--jobs, -j=N\n          Process N files in parallel (0: one per CPU core)" },
+  { MMAP, 0, "", "mmap", option::Arg::None, "--mmap\n          Access files through memory mappings (local file systems only)" },
+  { STATS, 0, "", "stats", option::Arg::None, "--stats\n          Print the number of files saved and bytes written" },
+  { SAFE_SAVE, 0, "", "safe-save", option::Arg::None, "--safe-save\n          Save so that a crash never leaves a damaged file behind" },
+  { REPAIR, 0, "", "repair", option::Arg::None, "--repair\n          Fix files left damaged by an interrupted save" },
+  { DURABILITY, 0, "", "durability", option::Arg::Optional, "--durability=none|file|group\n          When saved files are synced to disk: never, one by one, or in waves" },
+  { CATALOG, 0, "", "catalog", option::Arg::Optional, "--catalog=<FILE>\n          Keep headers and tags in FILE so unchanged files aren't read again (--show-info/--show-tags/--find only)" },
+  { RECURSIVE, 0, "R", "recursive", option::Arg::None, "--recursive, -R\n          Process all DSF files in the directories given, and their subdirectories" },
+  { FILES_FROM, 0, "", "files-from", option::Arg::Optional, "--files-from=<FILE>\n          Also process the files listed in FILE, one per line (-: standard input)" },
+  { NULL_SEPARATED, 0, "0", "null", option::Arg::None, "--null, -0\n          File names in --files-from end with NUL instead of newline" },
+  { MANIFEST, 0, "", "manifest", option::Arg::Optional, "--manifest=<FILE>\n          Edit the files listed in FILE, one tab separated line per tag: path, tag, value[, set|add|remove]" },
+  { WATCH, 0, "", "watch", option::Arg::None, "--watch\n          Keep --catalog up to date with the directories given until interrupted" },
+  { TO_WAV, 0, "", "to-wav", option::Arg::None, "--to-wav\n          Convert the audio to PCM, saved next to each file with a .wav extension" },
+  { TO_DFF, 0, "", "to-dff", option::Arg::None, "--to-dff\n          Convert to DSDIFF, saved next to each file with a .dff extension" },
+  { TO_DSF, 0, "", "to-dsf", option::Arg::None, "--to-dsf\n          Convert DSDIFF files to DSF, saved next to each file with a .dsf extension" },
+  { PCM_RATE, 0, "", "pcm-rate", option::Arg::Optional, "--pcm-rate=<RATE>\n          Sample rate of --to-wav: 88200 (default), 176400, or the DSD rate divided by another power of 2" },
+  { PCM_FORMAT, 0, "", "pcm-format", option::Arg::Optional, "--pcm-format=24|float\n          Sample format of --to-wav: 24-bit integers (default) or 32-bit floats" },
+  { AUDIO_HASH, 0, "", "audio-hash", option::Arg::Optional, "--audio-hash[=xxh64|sha256]\n          Print a hash of the audio data, which edits of the tags don't change" },
+  { STORE_AUDIO_HASH, 0, "", "store-audio-hash", option::Arg::None, "--store-audio-hash\n          Also save the hash of --audio-hash in a TXXX frame, AUDIO_HASH, to be checked later" },
+  { VERIFY, 0, "", "verify", option::Arg::None, "--verify\n          Check the chunks of the files and read them to the end, printing a tab separated line per problem" },
+  { ANALYZE, 0, "", "analyze", option::Arg::None, "--analyze\n          Print the DC offset, peak modulation, overload and silence of every channel" },
+  { ANALYSIS_WINDOW, 0, "", "analysis-window", option::Arg::Optional, "--analysis-window=<N>\n          Samples over which --analyze measures modulation (default 4096)" },
+  { STORE_ANALYSIS, 0, "", "store-analysis", option::Arg::None, "--store-analysis\n          Also save the results of --analyze in TXXX frames" },
+  { REPLAYGAIN, 0, "", "replaygain", option::Arg::Optional, "--replaygain[=track|album]\n          Measure the loudness of the audio and save ReplayGain values in TXXX frames. With album, the files are one album" },
+  { FIND, 0, "", "find", option::Arg::Optional, "--find=<EXPR>\n          Print the files whose tags and properties match EXPR, e.g. 'ALBUMARTIST=X && DATE<2000'" },
   //{ DRY_RUN, 0, "d", "dry-run", option::Arg::None, "--dry-run\n          Run without saving" },
   { 0, 0, 0, 0, 0, 0 }
 };
@@ -83,16 +134,16 @@ void getOptionsToVector(option::Option *o, OptionIndex index, StringVector &v,
 
 inline void printOptMultiError(const char *tag)
 {
-  std::cerr << "Multiple --" << tag << " supplied" << std::endl;
+  BatchProcessor::err() << "Multiple --" << tag << " supplied" << std::endl;
 }
 
 inline void printOptArgMissingError(const char *txt) 
 {
-  std::cerr << "No " << txt << " specified" << std::endl;
+  BatchProcessor::err() << "No " << txt << " specified" << std::endl;
 }
 
 inline void printOptInvalidArgError(const char *txt) {
-  std::cerr << "Invalid " << txt << std::endl;
+  BatchProcessor::err() << "Invalid " << txt << std::endl;
 }
 
 void printMap(StringMap &m) {
@@ -123,17 +174,46 @@ void OptionObj::print()
   std::cout << "Set Tags File: " << setTagsFile << std::endl;
   std::cout << "Add Tags File: " << addTagsFile << std::endl;
   std::cout << "Separator: " << separator << std::endl;
+  std::cout << "Jobs: " << jobs << std::endl;
+  std::cout << "Durability: " << durability << std::endl;
+  std::cout << "Catalog: " << catalog << std::endl;
+  std::cout << "Find: " << find << std::endl;
+  std::cout << "Files from: " << filesFrom << std::endl;
+  std::cout << "Manifest: " << manifest << std::endl;
+  std::cout << "PCM rate: " << pcmRate << std::endl;
+  std::cout << "PCM format: " << pcmFormat << std::endl;
+  std::cout << "Hash algorithm: " << hashAlgorithm << std::endl;
+  std::cout << "Analysis window: " << analysisWindow << std::endl;
+  std::cout << "ReplayGain mode: " << replayGainMode << std::endl;
   std::cout << "Remove everything? " << removeEverything << std::endl;
   std::cout << "Remove all pictures? " << removeAllPics << std::endl;
   std::cout << "Show tags? " << showTags << std::endl;
   std::cout << "Show info? " << showInfo << std::endl;
   std::cout << "Export pics? " << exportPics << std::endl;
   std::cout << "Dry run? " << dryRun << std::endl;
+  std::cout << "Use mmap? " << useMmap << std::endl;
+  std::cout << "Show stats? " << showStats << std::endl;
+  std::cout << "Safe save? " << safeSave << std::endl;
+  std::cout << "Repair? " << repair << std::endl;
+  std::cout << "Recursive? " << recursive << std::endl;
+  std::cout << "NUL separated? " << nullSeparated << std::endl;
+  std::cout << "Watch? " << watch << std::endl;
+  std::cout << "To WAV? " << toWav << std::endl;
+  std::cout << "To DSDIFF? " << toDSDIFF << std::endl;
+  std::cout << "To DSF? " << toDSF << std::endl;
+  std::cout << "Audio hash? " << audioHash << std::endl;
+  std::cout << "Store audio hash? " << storeAudioHash << std::endl;
+  std::cout << "Verify? " << verify << std::endl;
+  std::cout << "Analyze? " << analyze << std::endl;
+  std::cout << "Store analysis? " << storeAnalysis << std::endl;
+  std::cout << "ReplayGain? " << replayGain << std::endl;
 
   std::cout << "File List: " << std::endl;
   printVector(fileList);
   std::cout << "Remove Tag List: " << std::endl;
   printVector(removeTagList);
+  std::cout << "Replace Tag List: " << std::endl;
+  printVector(replaceTagList);
   std::cout << "Add Pic List: " << std::endl;
   printVector(addPicList);
   std::cout << "Delete Pic List: " << std::endl;
@@ -174,8 +254,27 @@ bool OptionObj::parse(int argc, char *argv[])
     fileList.push_back(op.nonOption(i));
   }
 
-  if (fileList.size() == 0) {
-    std::cerr << "No files specified" << std::endl;
+  // The list may come from --files-from or --manifest instead
+  int c = getUniqueReqdArg(options, FILES_FROM, filesFrom);
+  if (c > 1) {
+    printOptMultiError("files-from");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("file list");
+    return false;
+  }
+
+  c = getUniqueReqdArg(options, MANIFEST, manifest);
+  if (c > 1) {
+    printOptMultiError("manifest");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("manifest");
+    return false;
+  }
+
+  if (fileList.size() == 0 && filesFrom.isEmpty() && manifest.isEmpty()) {
+    BatchProcessor::err() << "No files specified" << std::endl;
     return false;
   }
 
@@ -188,9 +287,51 @@ bool OptionObj::parse(int argc, char *argv[])
   if (options[EXPORT_PICTURES].count() >= 1) {
     exportPics = true;
   }
+  if (options[MMAP].count() >= 1) {
+    useMmap = true;
+  }
+  if (options[STATS].count() >= 1) {
+    showStats = true;
+  }
+  if (options[SAFE_SAVE].count() >= 1) {
+    safeSave = true;
+  }
+  if (options[REPAIR].count() >= 1) {
+    repair = true;
+  }
+  if (options[RECURSIVE].count() >= 1) {
+    recursive = true;
+  }
+  if (options[NULL_SEPARATED].count() >= 1) {
+    nullSeparated = true;
+  }
+  if (options[WATCH].count() >= 1) {
+    watch = true;
+  }
+  if (options[TO_WAV].count() >= 1) {
+    toWav = true;
+  }
+  if (options[TO_DFF].count() >= 1) {
+    toDSDIFF = true;
+  }
+  if (options[TO_DSF].count() >= 1) {
+    toDSF = true;
+  }
+  if (options[STORE_AUDIO_HASH].count() >= 1) {
+    storeAudioHash = true;
+  }
+  if (options[VERIFY].count() >= 1) {
+    verify = true;
+  }
+  if (options[ANALYZE].count() >= 1) {
+    analyze = true;
+  }
+  if (options[STORE_ANALYSIS].count() >= 1) {
+    storeAnalysis = true;
+  }
 
   // Encoding
-  int c = getUniqueReqdArg(options, ENCODING, encoding);
+  c = getUniqueReqdArg(options, ENCODING, encoding);
   if (c > 1) {
     printOptMultiError("encoding");
     return false;
@@ -202,21 +343,111 @@ bool OptionObj::parse(int argc, char *argv[])
   // Separator
   // c = getUniqueReqdArg(options, SEPARATOR, separator);
   // if (c > 1) {
-  //   std::cerr << "Multiple --separator supplied" << std::endl;
+  //   BatchProcessor::err() << "Multiple --separator supplied" << std::endl;
   //   return false;
   // } else if (c == -1) {
-  //   std::cerr << "No separator specified" << std::endl;
+  //   BatchProcessor::err() << "No separator specified" << std::endl;
   //   return false;
   // }
 
   // ID3v2 Version
   c = getUniqueReqdArg(options, ID3V2_VERSION, version);
   if (c > 1) {
-    std::cerr << "Multiple --id3v2-version supplied" << std::endl;
+    BatchProcessor::err() << "Multiple --id3v2-version supplied" << std::endl;
+    return false;
+  } else if (c == -1) {
+    BatchProcessor::err() << "No ID3v2 version specified" << std::endl;
+    return false;
+  }
+
+  // --jobs
+  c = getUniqueReqdArg(options, JOBS, jobs);
+  if (c > 1) {
+    printOptMultiError("jobs");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("number of jobs");
+    return false;
+  }
+
+  // --durability
+  c = getUniqueReqdArg(options, DURABILITY, durability);
+  if (c > 1) {
+    printOptMultiError("durability");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("durability");
+    return false;
+  }
+
+  // --catalog
+  c = getUniqueReqdArg(options, CATALOG, catalog);
+  if (c > 1) {
+    printOptMultiError("catalog");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("catalog file");
+    return false;
+  }
+
+  // --find
+  c = getUniqueReqdArg(options, FIND, find);
+  if (c > 1) {
+    printOptMultiError("find");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("expression");
+    return false;
+  }
+
+  // --pcm-rate
+  c = getUniqueReqdArg(options, PCM_RATE, pcmRate);
+  if (c > 1) {
+    printOptMultiError("pcm-rate");
     return false;
   } else if (c == -1) {
-    std::cerr << "No ID3v2 version specified" << std::endl;
+    printOptArgMissingError("PCM rate");
+    return false;
+  }
+
+  // --pcm-format
+  c = getUniqueReqdArg(options, PCM_FORMAT, pcmFormat);
+  if (c > 1) {
+    printOptMultiError("pcm-format");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("PCM format");
+    return false;
+  }
+
+  // --analysis-window
+  c = getUniqueReqdArg(options, ANALYSIS_WINDOW, analysisWindow);
+  if (c > 1) {
+    printOptMultiError("analysis-window");
+    return false;
+  } else if (c == -1) {
+    printOptArgMissingError("analysis window");
+    return false;
+  }
+
+  // --replaygain, with an optional mode
+  if (options[REPLAYGAIN].count() > 1) {
+    printOptMultiError("replaygain");
+    return false;
+  } else if (options[REPLAYGAIN].count() == 1) {
+    replayGain = true;
+    if (options[REPLAYGAIN].arg != nullptr)
+      replayGainMode = options[REPLAYGAIN].arg;
+  }
+
+  // --audio-hash, with an optional algorithm
+  if (options[AUDIO_HASH].count() > 1) {
+    printOptMultiError("audio-hash");
     return false;
+  } else if (options[AUDIO_HASH].count() == 1) {
+    audioHash = true;
+    if (options[AUDIO_HASH].arg != nullptr)
+      hashAlgorithm = options[AUDIO_HASH].arg;
   }
 
   // --remove-tag and
@@ -237,25 +468,31 @@ bool OptionObj::parse(int argc, char *argv[])
   //StringMap tmp;
   c = getUniqueReqdArg(options, SET_TAGS_FROM_FILE, setTagsFile);
   if (c > 1) {
-    std::cerr << "Multiple --set-tags-from-file supplied" << std::endl;
+    BatchProcessor::err() << "Multiple --set-tags-from-file supplied"
+      << std::endl;
     return false;
   } else if (c == -1) {
-    std::cerr << "--set-tags-from-file: no file specified" << std::endl;
+    BatchProcessor::err() << "--set-tags-from-file: no file specified"
+      << std::endl;
     return false;
   }
 
   // --set-tag
-  //StringMap addMap;
-  getOptionPairsToMap(options, SET_TAG, addTagMap);
-  //addMap.insert(tmp.begin(), tmp.end());
+  StringMap setMap;
+  getOptionPairsToMap(options, SET_TAG, setMap);
+  for (auto &p : setMap)
+    replaceTagList.push_back(p.first);
+  addTagMap.insert(setMap.begin(), setMap.end());
 
   // --add-tags-from-file
   c = getUniqueReqdArg(options, ADD_TAGS_FROM_FILE, addTagsFile);
   if (c > 1) {
-    std::cerr << "Multiple --add-tags-from-file supplied" << std::endl;
+    BatchProcessor::err() << "Multiple --add-tags-from-file supplied"
+      << std::endl;
     return false;
   } else if (c == -1) {
-    std::cerr << "--add-tags-from-file: no file specified" << std::endl;
+    BatchProcessor::err() << "--add-tags-from-file: no file specified"
+      << std::endl;
     return false;
   }
 
@@ -336,8 +573,8 @@ int getUniqueReqdArg(option::Option *op, OptionIndex index, TagLib::String &val)
   return 0;
 }
 
-void OptionObj::printUsage()
+void OptionObj::printUsage(std::ostream &out)
 {
-  option::printUsage(std::cout, usage);
+  option::printUsage(out, usage);
 }
 //} // namespace
@@ -20,6 +20,7 @@
  ***************************************************************************/
 
 #include <list>
+#include <ostream>
 #include <string>
 #include <taglib/tstring.h>
 
@@ -37,11 +38,23 @@ public:
   TagLib::String setTagsFile;
   TagLib::String addTagsFile;
   TagLib::String separator;
+  TagLib::String jobs;
+  TagLib::String durability;
+  TagLib::String catalog;
+  TagLib::String find;
+  TagLib::String filesFrom;
+  TagLib::String manifest;
+  TagLib::String pcmRate;
+  TagLib::String pcmFormat;
+  TagLib::String hashAlgorithm;
+  TagLib::String analysisWindow;
+  TagLib::String replayGainMode;
   StringMap addTagMap;
   //StringMap handyMap;
   StringVector fileList;
   StringVector addPicList;
   StringVector removeTagList;
+  StringVector replaceTagList; // keys of addTagMap that replace (--set-tag)
   StringVector removePicList;
   StringVector exportPicList;
   bool showTags;
@@ -52,6 +65,22 @@ public:
   bool exportPics;
   bool showVersion;
   bool showHelp;
+  bool useMmap;
+  bool showStats;
+  bool safeSave;
+  bool repair;
+  bool recursive;
+  bool nullSeparated;
+  bool watch;
+  bool toWav;
+  bool toDSDIFF;
+  bool toDSF;
+  bool audioHash;
+  bool storeAudioHash;
+  bool verify;
+  bool analyze;
+  bool storeAnalysis;
+  bool replayGain;
 
   OptionObj() : 
     showTags(false),
@@ -61,9 +90,25 @@ public:
     removeAllPics(false), 
     exportPics(false), 
     showVersion(false),
-    showHelp(false) {}
+    showHelp(false),
+    useMmap(false),
+    showStats(false),
+    safeSave(false),
+    repair(false),
+    recursive(false),
+    nullSeparated(false),
+    watch(false),
+    toWav(false),
+    toDSDIFF(false),
+    toDSF(false),
+    audioHash(false),
+    storeAudioHash(false),
+    verify(false),
+    analyze(false),
+    storeAnalysis(false),
+    replayGain(false) {}
 
-  void printUsage();
+  void printUsage(std::ostream &out);
   void print();
   bool parse(int argc, char *argv[]);  
 };
@@ -0,0 +1,266 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <math.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "dsfdatareader.h"
+#include "dsddecimator.h"
+#include "pcmconverter.h"
+
+namespace {
+  // Groups of blocks decoded between two calls to the sink
+  const unsigned int GROUPS = 64;
+
+  // WAVE_FORMAT_EXTENSIBLE channel masks, by DSF channel type. The
+  // channels of a DSF file are in the order WAV files want them.
+  const uint32_t CHANNEL_MASKS[] = {
+    0, 0x4, 0x3, 0x7, 0x33, 0xf, 0x37, 0x3f
+  };
+
+  void putLE(std::vector<char> &v, uint32_t n, int bytes)
+  {
+    for (int i = 0; i < bytes; i++)
+      v.push_back((n >> (i * 8)) & 0xff);
+  }
+
+  // A canonical WAVE_FORMAT_EXTENSIBLE header, for frames frames
+  std::vector<char> wavHeader(const DSFHeader &h, unsigned int rate, 
+			      PCMConverter::Format format, uint32_t frames)
+  {
+    unsigned int channels = h.channelNum();
+    unsigned int bytes = format == PCMConverter::Int24 ? 3 : 4;
+    uint32_t dataSize = frames * channels * bytes;
+    int type = h.channelType();
+
+    std::vector<char> v;
+    v.insert(v.end(), { 'R', 'I', 'F', 'F' });
+    putLE(v, 4 + 8 + 40 + 8 + dataSize, 4);
+    v.insert(v.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+    putLE(v, 40, 4);
+    putLE(v, 0xfffe, 2);                      // WAVE_FORMAT_EXTENSIBLE
+    putLE(v, channels, 2);
+    putLE(v, rate, 4);
+    putLE(v, rate * channels * bytes, 4);     // bytes per second
+    putLE(v, channels * bytes, 2);            // bytes per frame
+    putLE(v, bytes * 8, 2);
+    putLE(v, 22, 2);                          // size of the extension
+    putLE(v, bytes * 8, 2);                   // valid bits
+    putLE(v, type > 0 && type < 8 ? CHANNEL_MASKS[type] : 0, 4);
+    putLE(v, format == PCMConverter::Int24 ? 1 : 3, 4); // sub format
+    v.insert(v.end(), { 0x00, 0x00, 0x10, 0x00, char(0x80), 0x00, 0x00, 
+	  char(0xaa), 0x00, 0x38, char(0x9b), 0x71 });
+    v.insert(v.end(), { 'd', 'a', 't', 'a' });
+    putLE(v, dataSize, 4);
+    return v;
+  }
+}
+
+//////////////////////////// IMPL //////////////////////////////
+class PCMConverter::PCMConverterImpl {
+ public:
+  PCMConverterImpl(unsigned int rate) :
+    _rate(rate),
+    _audioSeconds(0),
+    _elapsedSeconds(0)
+  {}
+  ~PCMConverterImpl() {}
+
+  /////////////// Variables //////////////
+  unsigned int _rate;
+  double _audioSeconds;
+  double _elapsedSeconds;
+};
+
+//////////////////////////// PUBLIC //////////////////////////////
+
+PCMConverter::PCMConverter(unsigned int rate) :
+  _i(new PCMConverterImpl(rate))
+{
+}
+
+PCMConverter::~PCMConverter()
+{
+  delete _i;
+}
+
+bool PCMConverter::decode(DSFDataReader &reader, const Sink &sink,
+			  std::ostream &err)
+{
+  auto start = std::chrono::steady_clock::now();
+  _i->_audioSeconds = _i->_elapsedSeconds = 0;
+
+  const DSFHeader &h = reader.header();
+  if (h.bitsPerSample() != 1) {
+    err << "Only 1 bit per sample can be converted to PCM" << std::endl;
+    return false;
+  }
+
+  unsigned int channels = h.channelNum();
+  std::vector<std::unique_ptr<DSDDecimator> > decimators;
+  for (unsigned int ch = 0; ch < channels; ch++)
+    decimators.emplace_back(new DSDDecimator(h.sampleRate(), _i->_rate));
+  if (!decimators[0]->isValid()) {
+    err << "Can't convert " << h.sampleRate() << " Hz DSD to " 
+	<< _i->_rate << " Hz PCM" << std::endl;
+    return false;
+  }
+
+  uint64_t frames = h.sampleCount() / decimators[0]->ratio();
+  size_t perGroup = DSFDataReader::BLOCK_SIZE * 8 / decimators[0]->ratio();
+  std::vector<std::vector<unsigned char> > in(channels);
+  std::vector<std::vector<float> > out(channels);
+  std::vector<float> interleaved;
+  uint64_t done = 0;
+
+  reader.rewind();
+  while (done < frames) {
+    // The next groups of blocks, one buffer per channel since blocks
+    // aren't valid after the next call to next()
+    size_t groups = 0;
+    for (; groups < GROUPS && reader.next(); groups++) {
+      for (unsigned int ch = 0; ch < channels; ch++) {
+	DSFDataReader::Span s = reader.channel(ch);
+	in[ch].resize((groups + 1) * s.size);
+	memcpy(&in[ch][groups * s.size], s.data, s.size);
+      }
+    }
+    if (groups == 0) {
+      err << "Error reading the audio data" << std::endl;
+      return false;
+    }
+
+    auto filter = [&](unsigned int ch) {
+      out[ch].resize(groups * perGroup + 1);
+      out[ch].resize(decimators[ch]->process(&in[ch][0], 
+					     groups * DSFDataReader::BLOCK_SIZE,
+					     &out[ch][0]));
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int ch = 1; ch < channels; ch++)
+      threads.emplace_back(filter, ch);
+    filter(0);
+    for (auto &t : threads)
+      t.join();
+
+    // The padding of the last blocks isn't audio
+    size_t count = out[0].size();
+    if (count > frames - done)
+      count = frames - done;
+
+    interleaved.resize(count * channels);
+    for (unsigned int ch = 0; ch < channels; ch++)
+      for (size_t i = 0; i < count; i++)
+	interleaved[i * channels + ch] = out[ch][i];
+    if (count > 0 && !sink(&interleaved[0], count))
+      return false;
+    done += count;
+  }
+
+  _i->_audioSeconds = static_cast<double>(frames) / _i->_rate;
+  _i->_elapsedSeconds = std::chrono::duration<double>
+    (std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+bool PCMConverter::convert(const char *file, const char *wavFile, 
+			   Format format, std::ostream &err)
+{
+  DSFDataReader reader(file);
+  if (!reader.isValid()) {
+    err << file << ": error reading audio data." << std::endl;
+    return false;
+  }
+
+  // Checked again by decode(), without writing anything
+  DSDDecimator probe(reader.header().sampleRate(), _i->_rate);
+  if (!probe.isValid()) {
+    err << file << ": can't convert " << reader.header().sampleRate() 
+	<< " Hz DSD to " << _i->_rate << " Hz PCM." << std::endl;
+    return false;
+  }
+
+  unsigned int bytes = format == Int24 ? 3 : 4;
+  uint64_t frames = reader.header().sampleCount() / probe.ratio();
+  if (frames * reader.header().channelNum() * bytes > 0xffffff00) {
+    err << file << ": too long for a WAV file." << std::endl;
+    return false;
+  }
+
+  std::ofstream o(wavFile, std::ofstream::binary);
+  if (!o) {
+    err << wavFile << ": can't create file." << std::endl;
+    return false;
+  }
+  std::vector<char> header = wavHeader(reader.header(), _i->_rate, format,
+				       frames);
+  o.write(&header[0], header.size());
+
+  std::vector<char> buf;
+  bool ok = decode(reader, [&](const float *pcm, size_t count) {
+      size_t n = count * reader.header().channelNum();
+      buf.resize(n * bytes);
+      if (format == Float32) {
+	memcpy(&buf[0], pcm, n * 4);  // little endian hosts only
+      } else {
+	char *p = &buf[0];
+	for (size_t i = 0; i < n; i++) {
+	  float f = pcm[i];
+	  long v = lrintf(f * 8388608.0f);
+	  if (v > 8388607)
+	    v = 8388607;
+	  else if (v < -8388608)
+	    v = -8388608;
+	  *p++ = v & 0xff;
+	  *p++ = (v >> 8) & 0xff;
+	  *p++ = (v >> 16) & 0xff;
+	}
+      }
+      o.write(&buf[0], buf.size());
+      return o.good();
+    }, err);
+
+  o.close();
+  if (!ok || !o) {
+    if (ok)
+      err << wavFile << ": error writing file." << std::endl;
+    unlink(wavFile);
+    return false;
+  }
+  return true;
+}
+
+double PCMConverter::audioSeconds() const
+{
+  return _i->_audioSeconds;
+}
+
+double PCMConverter::elapsedSeconds() const
+{
+  return _i->_elapsedSeconds;
+}
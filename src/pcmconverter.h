@@ -0,0 +1,72 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _PCMCONVERTER_H_
+#define _PCMCONVERTER_H_
+
+#include <stddef.h>
+#include <functional>
+#include <ostream>
+
+class DSFDataReader;
+
+//
+// Decodes the audio of DSF files to PCM (--to-wav).
+//
+// Every channel is filtered by its own DSDDecimator, on its own thread.
+// The data chunk is read 256 KB per channel at a time, so memory use
+// doesn't depend on the length of the file.
+//
+class PCMConverter {
+ public:
+  // Sample formats of WAV files
+  enum Format { Int24, Float32 };
+
+  // Gets count frames, channels interleaved, as they are decoded.
+  // Return false to stop.
+  typedef std::function<bool (const float *frames, size_t count)> Sink;
+
+  // To rate, e.g. 88200 or 176400
+  PCMConverter(unsigned int rate);
+  ~PCMConverter();
+
+  // Decode the audio of reader from the start. Fail if the rate isn't
+  // the DSD rate divided by a power of 2 (8 at least), or if sink
+  // returns false.
+  bool decode(DSFDataReader &reader, const Sink &sink, std::ostream &err);
+
+  // Decode file into a new WAV file wavFile
+  bool convert(const char *file, const char *wavFile, Format format,
+	       std::ostream &err);
+
+  // About the last file decoded: seconds of audio, and seconds it took
+  double audioSeconds() const;
+  double elapsedSeconds() const;
+
+ private:
+  PCMConverter(const PCMConverter &);
+  PCMConverter &operator=(const PCMConverter &);
+
+  class PCMConverterImpl;
+  PCMConverterImpl *_i;
+};
+
+#endif
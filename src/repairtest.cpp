@@ -0,0 +1,172 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+//
+// --repair on the states an interrupted --safe-save leaves on disk: each
+// one must end up the same as a save that went through, and a second
+// --repair must find nothing. Run by "make check" from the build
+// directory.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+const char *dsfFile = "repairtest.dsf";
+const uint64_t audioEnd = 8284; // size of a file made by mkdsf
+int failures = 0;
+
+void fail(const std::string &what)
+{
+  std::cerr << "FAIL: " << what << std::endl;
+  failures++;
+}
+
+std::string u64raw(uint64_t n)
+{
+  std::string s(8, 0);
+  for (int i = 0; i < 8; i++, n >>= 8)
+    s[i] = n & 0xff;
+  return s;
+}
+
+std::string readFile(const char *path)
+{
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+bool writeFile(const char *path, const std::string &data)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << data;
+  return out.good();
+}
+
+// Run cmd, with what it prints in out
+bool run(const std::string &cmd, std::string &out)
+{
+  FILE *p = popen(cmd.c_str(), "r");
+  if (!p)
+    return false;
+
+  out.clear();
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), p)) > 0)
+    out.append(buf, n);
+  return pclose(p) == 0;
+}
+
+// The file size and metadata pointer of the DSD chunk
+void setHeader(std::string &data, uint64_t fileSize, uint64_t ID3v2Offset)
+{
+  data.replace(12, 16, u64raw(fileSize) + u64raw(ID3v2Offset));
+}
+
+// data after the tags are set by an ordinary save
+bool save(const std::string &data, const std::string &tags, 
+	  std::string &saved)
+{
+  std::string out;
+  if (!writeFile(dsfFile, data) ||
+      !run(std::string("./metadsf ") + tags + " " + dsfFile, out)) {
+    fail("can't save " + tags);
+    return false;
+  }
+  saved = readFile(dsfFile);
+  return true;
+}
+
+void expectRepaired(const std::string &what, const std::string &state,
+		    const std::string &expected)
+{
+  std::string cmd = std::string("./metadsf --repair ") + dsfFile;
+  std::string out;
+
+  if (!writeFile(dsfFile, state) || !run(cmd, out)) {
+    fail(what + ": --repair failed");
+    return;
+  }
+  if (out.empty())
+    fail(what + ": nothing to repair found");
+  if (readFile(dsfFile) != expected)
+    fail(what + ": not the same as a clean save");
+
+  if (!run(cmd, out))
+    fail(what + ": second --repair failed");
+  else if (!out.empty())
+    fail(what + ": second --repair found " + out);
+}
+
+} // namespace
+
+int main()
+{
+  std::string out;
+  if (!run(std::string("./mkdsf ") + dsfFile, out)) {
+    fail("mkdsf");
+    return 1;
+  }
+
+  // The file before and after the save that gets interrupted
+  std::string before, after;
+  if (!save(readFile(dsfFile), "--set-tag=TIT2='So What'", before) ||
+      !save(before, "--set-tag=TIT2='Freddie Freeloader' "
+	    "--set-tag=TALB='Kind of Blue'", after))
+    return 1;
+  std::string tag = after.substr(audioEnd);
+
+  // DSFFile::safeWriteTail() first writes the new tag past everything
+  // in use
+  uint64_t tmp = std::max<uint64_t>(before.size(), audioEnd + tag.size());
+  std::string state = before;
+  state.resize(tmp, 0);
+  state += tag;
+  expectRepaired("copy past the end, header not switched", state, before);
+
+  // The header points to the copy, leaving a gap after the data chunk
+  setHeader(state, tmp + tag.size(), tmp);
+  expectRepaired("header pointing to the copy", state, after);
+
+  // Part of the copy back to its final place
+  state.replace(audioEnd, tag.size() / 2, tag, 0, tag.size() / 2);
+  expectRepaired("partial final copy", state, after);
+
+  // All of it, and the header switched back, but not truncated yet
+  state.replace(audioEnd, tag.size(), tag);
+  setHeader(state, audioEnd + tag.size(), audioEnd);
+  expectRepaired("trailing bytes", state, after);
+
+  remove(dsfFile);
+  if (failures)
+    std::cerr << failures << " failed" << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# DSF -> DSDIFF -> DSF gives back the very same file, tag included.
+# Run by "make check" from the build directory.
+#
+
+set -e
+
+dir=`mktemp -d`
+trap 'rm -rf "$dir"' 0
+
+./mkdsf "$dir/a.dsf" > /dev/null
+
+# Tag it through --manifest and --set-tag
+printf '%s\tTITLE\tSo What\n' "$dir/a.dsf" > "$dir/album.tsv"
+printf '%s\tTPE1\tMiles Davis\n' "$dir/a.dsf" >> "$dir/album.tsv"
+printf '%s\tTPE1\tJohn Coltrane\tadd\n' "$dir/a.dsf" >> "$dir/album.tsv"
+./metadsf --manifest="$dir/album.tsv" --set-tag=TALB="Kind of Blue"
+if [ `wc -c < "$dir/a.dsf"` -le 8284 ]; then
+  echo "FAIL: no tag was written" >&2
+  exit 1
+fi
+
+./metadsf --to-dff "$dir/a.dsf"
+test -f "$dir/a.dff"
+
+# --to-dsf never overwrites, so convert a copy
+cp "$dir/a.dff" "$dir/b.dff"
+./metadsf --to-dsf "$dir/b.dff"
+if ! cmp "$dir/a.dsf" "$dir/b.dsf"; then
+  echo "FAIL: a.dsf changed on the way through DSDIFF" >&2
+  exit 1
+fi
+
+# And once more from the converted file, to the same DSDIFF
+mv "$dir/b.dff" "$dir/c.dff"
+./metadsf --to-dff "$dir/b.dsf"
+cmp "$dir/a.dff" "$dir/b.dff"
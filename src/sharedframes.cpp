@@ -0,0 +1,120 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <taglib/id3v2frame.h>
+
+#include "sharedframes.h"
+
+//////////////////////////// IMPL //////////////////////////////
+class SharedFrames::SharedFramesImpl {
+ public:
+  SharedFramesImpl() {}
+  ~SharedFramesImpl() {}
+
+  std::vector<FrameMaker> _makers;
+  std::vector<bool> _replaces; // same order as _makers
+  // version => rendered frames (same order as _makers)
+  std::map<int, std::vector<TagLib::ByteVector> > _rendered;
+};
+
+///////////////////////////// SHAREDFRAMES //////////////////////////
+SharedFrames::SharedFrames()
+{
+  _i = new SharedFramesImpl;
+}
+
+SharedFrames::~SharedFrames()
+{
+  delete _i;
+}
+
+void SharedFrames::add(const FrameMaker &maker, bool replace)
+{
+  _i->_makers.push_back(maker);
+  _i->_replaces.push_back(replace);
+  _i->_rendered.clear(); // stale now
+}
+
+unsigned int SharedFrames::size() const
+{
+  return _i->_makers.size();
+}
+
+void SharedFrames::render(int version)
+{
+  std::vector<TagLib::ByteVector> &v = _i->_rendered[version];
+
+  v.clear();
+  for (auto &m : _i->_makers) {
+    TagLib::ID3v2::Frame *f = m();
+
+    // Leave out what TagLib would have to convert (version 3 only),
+    // or would skip when rendering a tag.
+    if (!f || f->frameID().size() != 4 ||
+	(version == 3 && !isID3v23Frame(f->frameID())))
+    {
+      v.push_back(TagLib::ByteVector());
+    } else {
+      f->header()->setVersion(version);
+      TagLib::ByteVector data = f->render();
+      if (data.size() <= TagLib::ID3v2::Frame::headerSize(version))
+	data.clear();
+      v.push_back(data);
+    }
+    delete f;
+  }
+}
+
+bool SharedFrames::replaces(unsigned int i) const
+{
+  return _i->_replaces[i];
+}
+
+TagLib::ID3v2::Frame *SharedFrames::create(unsigned int i) const
+{
+  return _i->_makers[i]();
+}
+
+const TagLib::ByteVector &SharedFrames::rendered(unsigned int i,
+						 int version) const
+{
+  static const TagLib::ByteVector empty;
+
+  auto it = _i->_rendered.find(version);
+  if (it == _i->_rendered.end() || i >= it->second.size())
+    return empty;
+  return it->second[i];
+}
+
+bool SharedFrames::isID3v23Frame(const TagLib::ByteVector &id)
+{
+  // Frames that ID3v2::Tag::render(3) either converts or drops
+  static const std::set<TagLib::ByteVector> v24Only = {
+    "ASPI", "EQU2", "RVA2", "SEEK", "SIGN", "TDRL", "TDTG", "TMOO",
+    "TPRO", "TSOA", "TSOT", "TSST", "TSOP", "TDOR", "TDRC", "TIPL",
+    "TMCL"
+  };
+  return v24Only.find(id) == v24Only.end();
+}
@@ -0,0 +1,80 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _SHAREDFRAMES_H_
+#define _SHAREDFRAMES_H_
+
+#include <functional>
+
+#include <taglib/tbytevector.h>
+
+namespace TagLib { namespace ID3v2 { class Frame; } }
+
+//
+// Frames that are added to every file of a batch (--set-tag, --add-tag,
+// --import-picture...).
+//
+// Each frame is serialized once per ID3v2 version. DSFFile::save() then
+// splices the cached bytes into every tag instead of rendering identical
+// frames over and over again.
+//
+class SharedFrames {
+ public:
+  // Creates a new frame. Returns a null pointer on error.
+  typedef std::function<TagLib::ID3v2::Frame *()> FrameMaker;
+
+  SharedFrames();
+  ~SharedFrames();
+
+  // Add a frame to be attached to every file. If replace is true, it
+  // replaces the frames with the same ID (--set-tag).
+  void add(const FrameMaker &maker, bool replace = false);
+
+  // Number of frames
+  unsigned int size() const;
+
+  // Serialize all frames for ID3v2 version 3 or 4. Must be called before
+  // the object is shared between threads.
+  void render(int version);
+
+  // Whether frame i replaces the frames with the same ID
+  bool replaces(unsigned int i) const;
+
+  // Create a new copy of frame i, to be owned by the caller
+  TagLib::ID3v2::Frame *create(unsigned int i) const;
+
+  // Frame i as rendered for version. Empty if render(version) wasn't
+  // called or the frame has to be converted by TagLib for that version.
+  const TagLib::ByteVector &rendered(unsigned int i, int version) const;
+
+  // Returns true if a frame with this ID can be written to an ID3v2.3 tag
+  // as is. Frames like TDRC have to be converted or dropped by TagLib.
+  static bool isID3v23Frame(const TagLib::ByteVector &id);
+
+ private:
+  SharedFrames(const SharedFrames &);
+  SharedFrames &operator=(const SharedFrames &);
+
+  class SharedFramesImpl;
+  SharedFramesImpl *_i;
+};
+
+#endif
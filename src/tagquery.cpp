@@ -0,0 +1,450 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <taglib/id3v2header.h>
+#include <taglib/id3v2frame.h>
+#include <taglib/attachedpictureframe.h>
+
+#include "tagquery.h"
+#include "dsfproperties.h"
+#include "metadsf.h"
+#include "batch.h"
+
+namespace {
+
+enum Property {
+  FRAME = -1,
+  SAMPLE_RATE,
+  CHANNELS,
+  LENGTH,
+  BITRATE,
+  SAMPLES,
+  BITS_PER_SAMPLE,
+  FILE_SIZE,
+  TAG_SIZE,
+  TAG_VERSION
+};
+
+const char *propertyNames[] = {
+  "samplerate", "channels", "length", "bitrate", "samples",
+  "bitspersample", "filesize", "tagsize", "version", 0
+};
+
+enum Op { EXISTS, EQ, NE, LT, LE, GT, GE, CONTAINS };
+
+struct Node {
+  enum Type { AND, OR, NOT, TEST } type;
+  std::unique_ptr<Node> left;
+  std::unique_ptr<Node> right;
+
+  // TEST only
+  int property;
+  std::vector<TagLib::ByteVector> ids;
+  Op op;
+  TagLib::String value;
+  bool isNumber;
+  double number;
+};
+
+// Leading number of s. Returns false if there's none.
+bool toNumber(const std::string &s, double &n)
+{
+  const char *p = s.c_str();
+  char *end;
+  n = strtod(p, &end);
+  return end != p;
+}
+
+bool compare(double a, Op op, double b)
+{
+  switch (op) {
+  case EQ: return a == b;
+  case NE: return a != b;
+  case LT: return a < b;
+  case LE: return a <= b;
+  case GT: return a > b;
+  case GE: return a >= b;
+  default: return a != 0;
+  }
+}
+
+// Whether a single frame value satisfies n. NE is handled by the caller.
+bool compare(const TagLib::String &v, const Node &n)
+{
+  switch (n.op) {
+  case EQ:
+    return v == n.value;
+  case CONTAINS:
+    return v.upper().find(n.value.upper()) >= 0;
+  case LT: case LE: case GT: case GE: {
+    double d;
+    if (n.isNumber && toNumber(v.to8Bit(true), d))
+      return compare(d, n.op, n.number);
+    int c = v < n.value ? -1 : (v == n.value ? 0 : 1);
+    return compare(c, n.op, 0);
+  }
+  default:
+    return true;
+  }
+}
+
+} // namespace
+
+//////////////////////////// IMPL //////////////////////////////
+class TagQuery::TagQueryImpl {
+ public:
+  TagQueryImpl() : _pos(0), _needsTag(false) {}
+  ~TagQueryImpl() {}
+
+  // Split _text into _tokens. Returns false on error.
+  bool tokenize(const std::string &text);
+
+  // Recursive descent parser. Each returns null on error.
+  Node *parseExpr();
+  Node *parseTerm();
+  Node *parseFactor();
+  Node *parseTest();
+
+  bool isToken(const char *s) const {
+    return _pos < _tokens.size() && !_quoted[_pos] && _tokens[_pos] == s;
+  }
+  bool atEnd() const { return _pos >= _tokens.size(); }
+
+  bool evaluate(const Node *n, const DSFProperties *p, 
+		const TagLib::ID3v2::Header *h, const Lookup &lookup) const;
+  static double propertyValue(int property, const DSFProperties *p,
+			      const TagLib::ID3v2::Header *h);
+
+  /////////////// Variables //////////////
+  std::vector<std::string> _tokens;
+  std::vector<bool> _quoted;
+  size_t _pos;
+  std::unique_ptr<Node> _root;
+  bool _needsTag;
+};
+
+bool TagQuery::TagQueryImpl::tokenize(const std::string &text)
+{
+  static const char *ops[] = { 
+    "&&", "||", "!=", "<=", ">=", "(", ")", "!", "=", "<", ">", "~", 0 
+  };
+
+  size_t i = 0;
+  while (i < text.size()) {
+    if (isspace(static_cast<unsigned char>(text[i]))) {
+      i++;
+      continue;
+    }
+
+    // Quoted value
+    if (text[i] == '"' || text[i] == '\'') {
+      size_t end = text.find(text[i], i + 1);
+      if (end == std::string::npos) {
+	BatchProcessor::err() << "Unterminated string in --find" << std::endl;
+	return false;
+      }
+      _tokens.push_back(text.substr(i + 1, end - i - 1));
+      _quoted.push_back(true);
+      i = end + 1;
+      continue;
+    }
+
+    const char **op;
+    for (op = ops; *op; op++)
+      if (text.compare(i, strlen(*op), *op) == 0)
+	break;
+    if (*op) {
+      _tokens.push_back(*op);
+      _quoted.push_back(false);
+      i += strlen(*op);
+      continue;
+    }
+
+    // Bare word, up to the next space or operator
+    size_t end = i;
+    while (end < text.size() && 
+	   !isspace(static_cast<unsigned char>(text[end])) &&
+	   !strchr("()!=<>~&|", text[end]))
+      end++;
+    if (end == i) {
+      BatchProcessor::err() << "Unexpected '" << text[i] << "' in --find"
+        << std::endl;
+      return false;
+    }
+    _tokens.push_back(text.substr(i, end - i));
+    _quoted.push_back(false);
+    i = end;
+  }
+  return true;
+}
+
+Node *TagQuery::TagQueryImpl::parseExpr()
+{
+  std::unique_ptr<Node> n(parseTerm());
+  while (n && (isToken("||") || isToken("or"))) {
+    _pos++;
+    std::unique_ptr<Node> r(parseTerm());
+    if (!r)
+      return 0;
+    Node *o = new Node;
+    o->type = Node::OR;
+    o->left.reset(n.release());
+    o->right.reset(r.release());
+    n.reset(o);
+  }
+  return n.release();
+}
+
+Node *TagQuery::TagQueryImpl::parseTerm()
+{
+  std::unique_ptr<Node> n(parseFactor());
+  while (n && (isToken("&&") || isToken("and"))) {
+    _pos++;
+    std::unique_ptr<Node> r(parseFactor());
+    if (!r)
+      return 0;
+    Node *a = new Node;
+    a->type = Node::AND;
+    a->left.reset(n.release());
+    a->right.reset(r.release());
+    n.reset(a);
+  }
+  return n.release();
+}
+
+Node *TagQuery::TagQueryImpl::parseFactor()
+{
+  if (isToken("!") || isToken("not")) {
+    _pos++;
+    Node *f = parseFactor();
+    if (!f)
+      return 0;
+    Node *n = new Node;
+    n->type = Node::NOT;
+    n->left.reset(f);
+    return n;
+  }
+
+  if (isToken("(")) {
+    _pos++;
+    std::unique_ptr<Node> n(parseExpr());
+    if (!n)
+      return 0;
+    if (!isToken(")")) {
+      BatchProcessor::err() << "Missing ')' in --find" << std::endl;
+      return 0;
+    }
+    _pos++;
+    return n.release();
+  }
+
+  return parseTest();
+}
+
+Node *TagQuery::TagQueryImpl::parseTest()
+{
+  if (atEnd() || isToken(")") || isToken("&&") || isToken("||")) {
+    BatchProcessor::err() << "Missing tag or property in --find" << std::endl;
+    return 0;
+  }
+
+  std::unique_ptr<Node> n(new Node);
+  n->type = Node::TEST;
+  n->property = FRAME;
+  n->op = EXISTS;
+  n->isNumber = false;
+  n->number = 0;
+
+  const std::string &key = _tokens[_pos++];
+  for (int i = 0; propertyNames[i]; i++)
+    if (key == propertyNames[i])
+      n->property = i;
+
+  if (n->property == FRAME) {
+    TagLib::String name = TagLib::String(key, TagLib::String::UTF8).upper();
+    StringVector ids = MetaDSF::getFrameIDsByName(name);
+    for (auto &id : ids)
+      n->ids.push_back(id.data(TagLib::String::Latin1));
+
+    bool isID = key.size() == 4;
+    for (size_t i = 0; i < key.size(); i++)
+      isID = isID && (isupper(key[i]) || isdigit(key[i]));
+    if (n->ids.empty() && isID)
+      n->ids.push_back(TagLib::ByteVector(key.c_str(), 4));
+
+    if (n->ids.empty()) {
+      BatchProcessor::err() << "Unknown tag or property in --find: " << key
+        << std::endl;
+      return 0;
+    }
+    _needsTag = true;
+  }
+
+  static const struct { const char *token; Op op; } ops[] = {
+    { "=", EQ }, { "!=", NE }, { "<", LT }, { "<=", LE },
+    { ">", GT }, { ">=", GE }, { "~", CONTAINS }, { 0, EXISTS }
+  };
+  for (int i = 0; ops[i].token; i++)
+    if (isToken(ops[i].token))
+      n->op = ops[i].op;
+  if (n->op == EXISTS)
+    return n.release();
+  _pos++;
+
+  if (atEnd()) {
+    BatchProcessor::err() << "Missing value for " << key << " in --find"
+      << std::endl;
+    return 0;
+  }
+  const std::string &value = _tokens[_pos++];
+  n->value = TagLib::String(value, TagLib::String::UTF8);
+
+  double d;
+  n->isNumber = toNumber(value, d);
+  n->number = d;
+  if (n->property != FRAME && (!n->isNumber || n->op == CONTAINS)) {
+    BatchProcessor::err() << key << " needs a number in --find" << std::endl;
+    return 0;
+  }
+  return n.release();
+}
+
+double TagQuery::TagQueryImpl::propertyValue(int property,
+					     const DSFProperties *p,
+					     const TagLib::ID3v2::Header *h)
+{
+  switch (property) {
+  case SAMPLE_RATE: return p->sampleRate();
+  case CHANNELS: return p->channels();
+  case LENGTH: return p->length();
+  case BITRATE: return p->bitrate();
+  case SAMPLES: return p->sampleCount();
+  case BITS_PER_SAMPLE: return p->bitsPerSample();
+  case FILE_SIZE: return p->fileSize();
+  case TAG_SIZE: return h->completeTagSize();
+  case TAG_VERSION: return h->majorVersion();
+  default: return 0;
+  }
+}
+
+bool TagQuery::TagQueryImpl::evaluate(const Node *n, const DSFProperties *p,
+				      const TagLib::ID3v2::Header *h,
+				      const Lookup &lookup) const
+{
+  switch (n->type) {
+  case Node::AND:
+    return evaluate(n->left.get(), p, h, lookup) && 
+      evaluate(n->right.get(), p, h, lookup);
+  case Node::OR:
+    return evaluate(n->left.get(), p, h, lookup) || 
+      evaluate(n->right.get(), p, h, lookup);
+  case Node::NOT:
+    return !evaluate(n->left.get(), p, h, lookup);
+  case Node::TEST:
+    break;
+  }
+
+  if (n->property != FRAME)
+    return compare(propertyValue(n->property, p, h), n->op, n->number);
+
+  // TPE2!=X holds if no TPE2 is X, including when there's none
+  bool found = false;
+  for (auto &id : n->ids) {
+    TagLib::StringList l = lookup(id);
+    for (auto it = l.begin(); it != l.end(); it++) {
+      if (n->op == NE ? *it == n->value : compare(*it, *n)) {
+	found = true;
+	break;
+      }
+    }
+    if (found)
+      break;
+  }
+  return n->op == NE ? !found : found;
+}
+
+///////////////////////////// TAGQUERY //////////////////////////
+TagQuery::TagQuery()
+{
+  _i = new TagQueryImpl;
+}
+
+TagQuery::~TagQuery()
+{
+  delete _i;
+}
+
+bool TagQuery::parse(const TagLib::String &expr)
+{
+  if (!_i->tokenize(expr.to8Bit(true)))
+    return false;
+  if (_i->_tokens.empty()) {
+    BatchProcessor::err() << "Empty --find expression" << std::endl;
+    return false;
+  }
+
+  _i->_root.reset(_i->parseExpr());
+  if (!_i->_root)
+    return false;
+  if (!_i->atEnd()) {
+    BatchProcessor::err() << "Unexpected '" << _i->_tokens[_i->_pos];
+    BatchProcessor::err() << "' in --find" << std::endl;
+    _i->_root.reset();
+    return false;
+  }
+  return true;
+}
+
+bool TagQuery::needsTag() const
+{
+  return _i->_needsTag;
+}
+
+bool TagQuery::matches(const DSFProperties *p, const TagLib::ID3v2::Header *h,
+		       const Lookup &lookup) const
+{
+  if (!_i->_root)
+    return false;
+  return _i->evaluate(_i->_root.get(), p, h, lookup);
+}
+
+TagLib::StringList TagQuery::values(const TagLib::ID3v2::FrameList &l)
+{
+  TagLib::StringList v;
+  for (auto it = l.begin(); it != l.end(); it++) {
+    TagLib::ID3v2::AttachedPictureFrame *apic = 
+      dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
+    if (apic)
+      v.append(MetaDSF::getPicTypeDesc(apic->type()));
+    else
+      v.append((*it)->toString());
+  }
+  return v;
+}
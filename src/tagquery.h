@@ -0,0 +1,85 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+#ifndef _TAGQUERY_H_
+#define _TAGQUERY_H_
+
+#include <functional>
+
+#include <taglib/tstring.h>
+#include <taglib/tstringlist.h>
+#include <taglib/tbytevector.h>
+#include <taglib/id3v2tag.h>
+
+class DSFProperties;
+namespace TagLib { namespace ID3v2 { class Header; } }
+
+//
+// A predicate over the tags and audio properties of a file (--find).
+//
+//   expr := term { ("||" | "or") term }
+//   term := factor { ("&&" | "and") factor }
+//   factor := ("!" | "not") factor | "(" expr ")" | key [op value]
+//   op := "=" | "!=" | "<" | "<=" | ">" | ">=" | "~"
+//
+// A key is a frame ID (TPE2), a tag name (ALBUMARTIST) or an audio
+// property in lower case (samplerate, channels, length, bitrate,
+// samples, bitspersample, filesize, tagsize, version). A key alone is
+// true if the file has such a frame. A frame compares true if any of its
+// values does. < and > compare numbers if the value is one, taking the
+// leading number of the frame ("1999-05-01" is 1999, "3/12" is 3). ~ is
+// a case insensitive substring match. Pictures (APIC) compare by type,
+// e.g. APIC=FrontCover.
+//
+// Frames are asked for only when a predicate needs them, so frames
+// that the expression doesn't mention are never decoded.
+//
+class TagQuery {
+ public:
+  // Returns the values of all frames with ID id, as printed by
+  // --show-tags except for pictures, see above.
+  typedef std::function<TagLib::StringList (const TagLib::ByteVector &id)>
+    Lookup;
+
+  TagQuery();
+  ~TagQuery();
+
+  // Prints an error and returns false if expr isn't valid
+  bool parse(const TagLib::String &expr);
+
+  // Whether the expression references any frame
+  bool needsTag() const;
+
+  bool matches(const DSFProperties *p, const TagLib::ID3v2::Header *h,
+	       const Lookup &lookup) const;
+
+  // Values of frames, for a Lookup
+  static TagLib::StringList values(const TagLib::ID3v2::FrameList &l);
+
+ private:
+  TagQuery(const TagQuery &);
+  TagQuery &operator=(const TagQuery &);
+
+  class TagQueryImpl;
+  TagQueryImpl *_i;
+};
+
+#endif
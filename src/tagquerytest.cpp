@@ -0,0 +1,138 @@
+/***************************************************************************
+    copyright            : (C) 2014 by Peking Duck Labs
+    email                : pekingducklabs@gmail.com
+ ***************************************************************************/
+
+/***************************************************************************
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License version   *
+ *   2.1 as published by the Free Software Foundation.                     *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful, but   *
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *   Lesser General Public License for more details.                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this library; if not, write to the Free Software   *
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA         *
+ *   02110-1301  USA                                                       *
+ ***************************************************************************/
+
+//
+// --find expressions: what parses, what doesn't, and what matches
+// against a fixed set of frames. Run by "make check".
+//
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "tagquery.h"
+
+namespace {
+
+int failures = 0;
+
+// The frames of the file the queries are matched against
+std::map<std::string, TagLib::StringList> frames;
+
+TagLib::StringList lookup(const TagLib::ByteVector &id)
+{
+  auto it = frames.find(std::string(id.data(), id.size()));
+  if (it == frames.end())
+    return TagLib::StringList();
+  return it->second;
+}
+
+void expectParse(const char *expr, bool valid)
+{
+  TagQuery q;
+  if (q.parse(TagLib::String(expr, TagLib::String::UTF8)) != valid) {
+    std::cerr << "FAIL: " << expr << " should ";
+    std::cerr << (valid ? "parse" : "not parse") << std::endl;
+    failures++;
+  }
+}
+
+void expectMatch(const char *expr, bool match)
+{
+  TagQuery q;
+  if (!q.parse(TagLib::String(expr, TagLib::String::UTF8))) {
+    std::cerr << "FAIL: " << expr << " doesn't parse" << std::endl;
+    failures++;
+    return;
+  }
+  if (q.matches(0, 0, lookup) != match) {
+    std::cerr << "FAIL: " << expr << " should ";
+    std::cerr << (match ? "match" : "not match") << std::endl;
+    failures++;
+  }
+}
+
+} // namespace
+
+int main()
+{
+  frames["TIT2"].append(TagLib::String("So What"));
+  frames["TPE1"].append(TagLib::String("Miles Davis"));
+  frames["TPE2"].append(TagLib::String("Miles Davis"));
+  frames["TPE2"].append(TagLib::String("John Coltrane"));
+  frames["TDRC"].append(TagLib::String("1959-08-17"));
+  frames["TRCK"].append(TagLib::String("1/5"));
+
+  expectParse("TPE1", true);
+  expectParse("ARTIST='Miles Davis'", true);
+  expectParse("TDRC < 1960 and not TIT2~blue", true);
+  expectParse("(TPE1='A' || TPE2=\"B\") && TRCK >= 2", true);
+  expectParse("samplerate >= 2822400", true);
+  expectParse("!TCON", true);
+
+  expectParse("", false);
+  expectParse("   ", false);
+  expectParse("TPE1 =", false);
+  expectParse("(TPE1", false);
+  expectParse("TPE1 = 'x", false);
+  expectParse("NOSUCHTAG", false);
+  expectParse("samplerate ~ 1", false);
+  expectParse("samplerate = abc", false);
+  expectParse("TPE1 TIT2", false);
+  expectParse("&& TPE1", false);
+  expectParse("TPE1 ||", false);
+
+  // Only queries on frames need the tag
+  TagQuery props;
+  props.parse("samplerate >= 2822400 && channels = 2");
+  if (props.needsTag()) {
+    std::cerr << "FAIL: audio properties shouldn't need the tag" << std::endl;
+    failures++;
+  }
+  TagQuery tags;
+  tags.parse("samplerate >= 2822400 && TIT2");
+  if (!tags.needsTag()) {
+    std::cerr << "FAIL: TIT2 should need the tag" << std::endl;
+    failures++;
+  }
+
+  expectMatch("TIT2", true);
+  expectMatch("TITLE = 'So What'", true);
+  expectMatch("TIT2 = 'so what'", false);
+  expectMatch("TIT2 ~ WHAT", true);
+  expectMatch("TDRC < 1960", true);
+  expectMatch("DATE >= 1960", false);
+  expectMatch("TRCK = 1/5", true);
+  expectMatch("TRACKNUMBER < 2", true);
+  expectMatch("TPE2 = 'John Coltrane'", true);
+  expectMatch("ALBUMARTIST != 'John Coltrane'", false);
+  expectMatch("TPE1 != 'Miles Davis'", false);
+  expectMatch("TCON", false);
+  expectMatch("!TCON", true);
+  expectMatch("GENRE != Jazz", true);
+  expectMatch("(TCON || TIT2) && not TALB", true);
+  expectMatch("TCON or TALB", false);
+  expectMatch("TCON or TALB and TIT2 or TPE1", true);
+
+  if (failures)
+    std::cerr << failures << " failed" << std::endl;
+  return failures ? 1 : 0;
+}
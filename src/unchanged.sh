@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Setting a tag to the value it already has leaves the file alone.
+# Run by "make check" from the build directory.
+#
+
+set -e
+
+dir=`mktemp -d`
+trap 'rm -rf "$dir"' 0
+
+./mkdsf "$dir/a.dsf" > /dev/null
+
+./metadsf --set-tag=TIT2="So What" --set-tag=TALB="Kind of Blue" "$dir/a.dsf"
+cp "$dir/a.dsf" "$dir/saved.dsf"
+
+# Make sure a rewrite would show in the mtime
+sleep 1
+touch "$dir/marker"
+sleep 1
+
+./metadsf --set-tag=TIT2="So What" --set-tag=TALB="Kind of Blue" \
+  "$dir/a.dsf" 2> "$dir/err"
+if ! grep -q "unchanged, not saved" "$dir/err"; then
+  echo "FAIL: second run didn't report the file as unchanged" >&2
+  cat "$dir/err" >&2
+  exit 1
+fi
+if [ -n "`find "$dir/a.dsf" -newer "$dir/marker"`" ]; then
+  echo "FAIL: second run rewrote the file" >&2
+  exit 1
+fi
+cmp "$dir/a.dsf" "$dir/saved.dsf"
+
+# A new value replaces the frame where it is
+./metadsf --set-tag=TALB="Milestones" "$dir/a.dsf"
+./metadsf --show-tags "$dir/a.dsf" > "$dir/tags"
+printf 'TALB=Milestones\nTIT2=So What\n' > "$dir/expected"
+if ! cmp "$dir/tags" "$dir/expected"; then
+  echo "FAIL: TALB wasn't replaced in place" >&2
+  cat "$dir/tags" >&2
+  exit 1
+fi
@@ -21,7 +21,9 @@
 
 #include <fstream>
 #include <algorithm>
+#include <unistd.h>
 #include "utils.h"
+#include "batch.h"
 
 //namespace utils {
 
@@ -61,7 +63,7 @@ bool readPairsFromFile(const char *path, StringMap &m)
   // check if open was successful
 
   if (!infile.good()) {
-    std::cerr << "Failed to open " << path << std::endl;
+    BatchProcessor::err() << "Failed to open " << path << std::endl;
     return false;
   }
 
@@ -72,15 +74,17 @@ bool readPairsFromFile(const char *path, StringMap &m)
     StringVector v;
     split(line, "=", v, false, 2);
     if (v.size() != 2) {
-      std::cerr << path << ": line " << i << " is malformed" << std::endl;
+      BatchProcessor::err() << path << ": line " << i << " is malformed"
+        << std::endl;
       return false;
     }
     if (v[0].size() == 0) {
-      std::cerr << path << ": line " << i << " tag name missing";
+      BatchProcessor::err() << path << ": line " << i << " tag name missing";
       return false;
     }
     if (v[1].size() == 0) {
-      std::cerr << path << ": line " << i << " tag value missing" << std::endl;
+      BatchProcessor::err() << path << ": line " << i << " tag value missing"
+        << std::endl;
       return false;
     }
     //std::cout << i << ": key=[" << key << "], val=[" << val << "]" << std::endl;
@@ -102,18 +106,33 @@ size_t loadFileIntoVector(const char *path, TagLib::ByteVector &v)
   size_t len = is.tellg();
   is.seekg(0, is.beg);
 
-  char *buf = new char[len];
-
-  // read into buffer
-  is.read(buf, len);
-  v.setData(buf, len);
+  // read straight into the vector, no intermediate buffer
+  v.resize(len);
+  is.read(v.data(), len);
+  if (static_cast<size_t>(is.gcount()) != len) {
+    v.clear();
+    return 0;
+  }
 
   is.close();
-  delete[] buf;
 
   return len;
 }
 
+TagLib::ByteVector readAt(int fd, uint64_t offset, unsigned int length)
+{
+  TagLib::ByteVector v(length, 0);
+  unsigned int n = 0;
+
+  while (n < length) {
+    ssize_t r = pread(fd, v.data() + n, length - n, offset + n);
+    if (r <= 0)
+      return TagLib::ByteVector();
+    n += r;
+  }
+  return v;
+}
+
 bool isReadableFile(const char *path)
 {
   std::ifstream is(path, std::ifstream::binary);
@@ -142,4 +161,47 @@ bool writeFileFromVector(const char *path, const TagLib::ByteVector &v) {
   return true;
 }
 
+std::string absolutePath(const char *path)
+{
+  std::string s;
+  if (path[0] != '/') {
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+      return path;
+    s = cwd;
+  }
+  s += '/';
+  s += path;
+
+  // Lexically, so that symbolic links keep their name and the file
+  // needn't exist
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t end = s.find('/', start);
+    if (end == std::string::npos)
+      end = s.size();
+    std::string part = s.substr(start, end - start);
+    if (part == "..") {
+      if (!parts.empty())
+	parts.pop_back();
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    start = end + 1;
+  }
+
+  std::string normal;
+  for (auto &p : parts)
+    normal += "/" + p;
+  return normal.empty() ? "/" : normal;
+}
+
+std::string resolvePath(const char *path, const std::string &dir)
+{
+  if (path[0] == '/' || dir.empty())
+    return path;
+  return dir + "/" + path;
+}
+
 //} // namespace
@@ -22,6 +22,7 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <map>
@@ -38,6 +39,18 @@ void split(const std::string &s,
 
 size_t loadFileIntoVector(const char *path, TagLib::ByteVector &v);
 
+// Read exactly length bytes at offset of fd. Returns an empty vector on
+// error or short read.
+TagLib::ByteVector readAt(int fd, uint64_t offset, unsigned int length);
+
+// Prepend the current directory to a relative path, and drop ".",
+// ".." and repeated slashes from it
+std::string absolutePath(const char *path);
+
+// A relative path as seen from dir. Unchanged if it's absolute or dir
+// is empty.
+std::string resolvePath(const char *path, const std::string &dir);
+
 bool isReadableFile(const char *path);
 
 bool stringToLong(const std::string &, long &l);